@@ -253,7 +253,7 @@ int main(int argc, const char* argv[]) {
     
     // index buffer
     VulkanIndexBuffer *indexBuffer = nullptr;
-    runtime->createIndexBuffer(indexBuffer, ElementType::UINT, 3);
+    runtime->createIndexBuffer(indexBuffer, ElementType::UINT, 3, true);
     runtime->updateIndexBuffer(indexBuffer, indexDesc, 0);
     
     VulkanRenderPrimitive *renderPrimitive = nullptr;
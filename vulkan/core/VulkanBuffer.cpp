@@ -1,12 +1,40 @@
 #include "VulkanBuffer.h"
 #include "VulkanMemoryPool.h"
 #include "VulkanCommandPool.h"
+#include "VulkanTrace.h"
 
 namespace VR {
 namespace backend {
 
+// everything that may consume the buffer after an upload, derived from how it was created
+static void getUploadConsumers(VkBufferUsageFlags usage, VkPipelineStageFlags& stages, VkAccessFlags& access) {
+    stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    access = VK_ACCESS_TRANSFER_WRITE_BIT;
+    if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) {
+        stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+        access |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    }
+    if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT) {
+        stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+        access |= VK_ACCESS_INDEX_READ_BIT;
+    }
+    if (usage & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT) {
+        stages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+        access |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    }
+    if (usage & (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)) {
+        stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        access |= VK_ACCESS_SHADER_READ_BIT;
+    }
+    if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+        access |= VK_ACCESS_SHADER_WRITE_BIT;
+    }
+}
+
 VulkanBuffer::VulkanBuffer(VulkanContext& context, VulkanMemoryPool& memoryPool,
-        VkBufferUsageFlags usage, uint32_t numBytes) : mContext(context), mMemoryPool(memoryPool), mByteCount(numBytes) {
+        VkBufferUsageFlags usage, uint32_t numBytes) : mContext(context), mMemoryPool(memoryPool), mByteCount(numBytes),
+        mUsage(usage) {
 
     VkBufferCreateInfo bufferInfo {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -24,6 +52,8 @@ VulkanBuffer::~VulkanBuffer() {
 }
 
 void VulkanBuffer::upload(const void* cpuData, uint32_t byteOffset, uint32_t numBytes) {
+    VR_TRACE_SCOPE("VulkanBuffer::upload");
+    VR_TRACE_COUNTER(BYTES_UPLOADED, numBytes);
     VR_ASSERT(byteOffset == 0);
     VulkanBufferMemory const* buffer = mMemoryPool.acquireBuffer(numBytes);
     VR_ASSERT(buffer->memory != nullptr);
@@ -33,25 +63,49 @@ void VulkanBuffer::upload(const void* cpuData, uint32_t byteOffset, uint32_t num
     vmaUnmapMemory(mContext.allocator, buffer->memory);
     vmaFlushAllocation(mContext.allocator, buffer->memory, byteOffset, numBytes);
 
-    const VkCommandBuffer cmdbuffer = mContext.commandpool->get().cmdbuffer;
+    // the first upload runs on the transfer queue and hands the buffer over to graphics
+    VulkanCommandPool* uploadpool = mUploaded ? nullptr : mContext.uploadpool;
+    const VkCommandBuffer graphicsCmdbuffer = mContext.commandpool->get().cmdbuffer;
+    const VkCommandBuffer cmdbuffer = uploadpool ? uploadpool->get().cmdbuffer : graphicsCmdbuffer;
+    mUploaded = true;
 
     VkBufferCopy region { .size = numBytes };
     vkCmdCopyBuffer(cmdbuffer, buffer->buffer, mGpuBuffer, 1, &region);
 
+    VkPipelineStageFlags dstStages;
+    VkAccessFlags dstAccess;
+    getUploadConsumers(mUsage, dstStages, dstAccess);
     VkBufferMemoryBarrier barrier {
         .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
         .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-        .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
-                         VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = dstAccess,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .buffer = mGpuBuffer,
         .size = VK_WHOLE_SIZE
     };
 
+    if (uploadpool) {
+        // release on the transfer queue, acquire on the graphics queue
+        barrier.srcQueueFamilyIndex = mContext.transferQueueFamilyIndex;
+        barrier.dstQueueFamilyIndex = mContext.graphicsQueueFamilyIndex;
+        VkBufferMemoryBarrier release = barrier;
+        release.dstAccessMask = 0;
+        vkCmdPipelineBarrier(cmdbuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                0, 0, nullptr, 1, &release, 0, nullptr);
+        barrier.srcAccessMask = 0;
+        vkCmdPipelineBarrier(graphicsCmdbuffer,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                dstStages,
+                0, 0, nullptr, 1, &barrier, 0, nullptr);
+        return;
+    }
+
     vkCmdPipelineBarrier(cmdbuffer,
             VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            dstStages,
             0, 0, nullptr, 1, &barrier, 0, nullptr);
 }
 
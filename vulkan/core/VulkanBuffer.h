@@ -20,6 +20,10 @@ private:
     VulkanMemoryPool& mMemoryPool;
     VmaAllocation mGpuMemory = VK_NULL_HANDLE;
     VkBuffer mGpuBuffer = VK_NULL_HANDLE;
+    // picks the stages an upload's barrier makes the new contents visible to
+    VkBufferUsageFlags mUsage = 0;
+    // once the graphics queue may read the buffer, later uploads stay on the graphics queue
+    bool mUploaded = false;
 };
 
 } // namespace backend
@@ -1,18 +1,19 @@
+#include <algorithm>
 #include "VulkanMacros.h"
 #include "VulkanCommandPool.h"
-#include "VulkanFence.h"
 #include "VulkanAlloc.h"
+#include "VulkanTrace.h"
 
 namespace VR {
 namespace backend {
 
 CommandBufferObserver::~CommandBufferObserver() {}
 
-VulkanCommandPool::VulkanCommandPool(const VkDevice& device, uint32_t queueFamilyIndex) : mDevice(device) {
+VulkanCommandPool::VulkanCommandPool(const VkDevice& device, uint32_t queueFamilyIndex, bool timelineSemaphoreSupported) : mDevice(device) {
     VkCommandPoolCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    // should be RESET|RANSIENT flag
-    createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    // command buffers are recycled per slot, so they must be individually resettable
+    createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     createInfo.queueFamilyIndex = queueFamilyIndex;
     vkCreateCommandPool(mDevice, &createInfo, VKALLOC, &mPool);
     vkGetDeviceQueue(mDevice, queueFamilyIndex, 0, &mQueue);
@@ -22,18 +23,59 @@ VulkanCommandPool::VulkanCommandPool(const VkDevice& device, uint32_t queueFamil
         vkCreateSemaphore(mDevice, &semaphoreCreateInfo, nullptr, &semaphore);
     }
 
+    // allocate all command buffers and fences up front, get() only resets them
+    VkCommandBuffer cmdbuffers[VK_MAX_COMMAND_BUFFERS];
+    const VkCommandBufferAllocateInfo allocateInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = mPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = VK_MAX_COMMAND_BUFFERS
+    };
+    VkResult result = vkAllocateCommandBuffers(mDevice, &allocateInfo, cmdbuffers);
+    VR_VK_ASSERT(result == VK_SUCCESS, "allocate command buffers failed");
+
+    VkFenceCreateInfo fenceCreateInfo { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
     for (uint32_t index = 0; index < VK_MAX_COMMAND_BUFFERS; ++index) {
-        mCommandBuffers[index].cmdBufferIndex = index;
+        VulkanCommandBuffer& cmdBuffer = mCommandBuffers[index];
+        cmdBuffer.cmdbuffer = cmdbuffers[index];
+        cmdBuffer.cmdBufferIndex = index;
+        cmdBuffer.state = VulkanCommandBuffer::FREE;
+        vkCreateFence(mDevice, &fenceCreateInfo, VKALLOC, &cmdBuffer.queueSubmitFence);
+    }
+
+    if (timelineSemaphoreSupported) {
+        mGetSemaphoreCounterValue = vkGetSemaphoreCounterValueKHR ? vkGetSemaphoreCounterValueKHR : vkGetSemaphoreCounterValue;
+        mWaitSemaphores = vkWaitSemaphoresKHR ? vkWaitSemaphoresKHR : vkWaitSemaphores;
+    }
+    if (mGetSemaphoreCounterValue && mWaitSemaphores) {
+        VkSemaphoreTypeCreateInfo typeCreateInfo {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0,
+        };
+        VkSemaphoreCreateInfo timelineCreateInfo {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &typeCreateInfo,
+        };
+        result = vkCreateSemaphore(mDevice, &timelineCreateInfo, VKALLOC, &mTimeline);
+        VR_VK_ASSERT(result == VK_SUCCESS, "create timeline semaphore failed");
     }
 }
 
 VulkanCommandPool::~VulkanCommandPool() {
     wait();
     gc();
+    for (auto& cmdBuffer : mCommandBuffers) {
+        vkFreeCommandBuffers(mDevice, mPool, 1, &cmdBuffer.cmdbuffer);
+        vkDestroyFence(mDevice, cmdBuffer.queueSubmitFence, VKALLOC);
+    }
     vkDestroyCommandPool(mDevice, mPool, VKALLOC);
     for (VkSemaphore semaphore : mSubmissionSignals) {
         vkDestroySemaphore(mDevice, semaphore, VKALLOC);
     }
+    if (mTimeline) {
+        vkDestroySemaphore(mDevice, mTimeline, VKALLOC);
+    }
 }
 
 VulkanCommandBuffer const& VulkanCommandPool::get() {
@@ -44,31 +86,32 @@ VulkanCommandBuffer const& VulkanCommandPool::get() {
     }
 
     while (mFreeCmdBufferCount == 0) {
-        wait();
+        // wait for the oldest submission only
+        uint64_t oldest = mSubmittedValue;
+        for (auto& cmdBuffer : mCommandBuffers) {
+            if (cmdBuffer.state == VulkanCommandBuffer::SUBMITTED) {
+                oldest = std::min(oldest, cmdBuffer.submitValue);
+            }
+        }
+        waitFor(oldest);
         gc();
     }
     // get an unused command buffer
     for (VulkanCommandBuffer& cmdBuffer : mCommandBuffers) {
-        if (cmdBuffer.cmdbuffer == VK_NULL_HANDLE) {
+        if (cmdBuffer.state == VulkanCommandBuffer::FREE) {
             mCurrentCmdBuffer = &cmdBuffer;
             break;
         }
     }
 
     VR_ASSERT(mCurrentCmdBuffer);
-     --mFreeCmdBufferCount;
+    --mFreeCmdBufferCount;
 
-    const VkCommandBufferAllocateInfo allocateInfo {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = mPool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1
-    };
-    vkAllocateCommandBuffers(mDevice, &allocateInfo, &mCurrentCmdBuffer->cmdbuffer);
-
-    mCurrentCmdBuffer->queueSubmitFence = std::make_shared<VulkanFence>(mDevice);
-    VkResult r = vkGetFenceStatus(mDevice, mCurrentCmdBuffer->queueSubmitFence->get());
-    VR_ASSERT(r == VK_NOT_READY);
+    // the slot's previous submission has completed, recycle its buffer and fence
+    vkResetCommandBuffer(mCurrentCmdBuffer->cmdbuffer, 0);
+    vkResetFences(mDevice, 1, &mCurrentCmdBuffer->queueSubmitFence);
+    mCurrentCmdBuffer->state = VulkanCommandBuffer::RECORDING;
+    mCurrentCmdBuffer->serial = ++mSerial;
 
     const VkCommandBufferBeginInfo binfo {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -77,61 +120,60 @@ VulkanCommandBuffer const& VulkanCommandPool::get() {
     // begin of command recording
     vkBeginCommandBuffer(mCurrentCmdBuffer->cmdbuffer, &binfo);
 
-    if (mObserver) {
-        mObserver->onCommandBuffer(*mCurrentCmdBuffer);
+    for (CommandBufferObserver* observer : mObservers) {
+        observer->onCommandBuffer(*mCurrentCmdBuffer);
     }
 
     return *mCurrentCmdBuffer;
 }
 
 bool VulkanCommandPool::flush() {
+    VR_TRACE_SCOPE("VulkanCommandPool::flush");
+
+    // uploads are queued first, even without graphics work. Their signal stays with the transfer
+    // pool until a graphics command buffer waits on it
+    if (mTransferPool) {
+        mTransferPool->flush();
+    }
 
     if (mCurrentCmdBuffer == nullptr) {
         return false;
     }
 
+    VkSemaphore transferFinished = mTransferPool ? mTransferPool->getRenderFinishedSignal() : VK_NULL_HANDLE;
+
     const int64_t index = mCurrentCmdBuffer - &mCommandBuffers[0];
     VkSemaphore renderFinished = mSubmissionSignals[index];
     // end of command recording
     vkEndCommandBuffer(mCurrentCmdBuffer->cmdbuffer);
 
-    VkPipelineStageFlags waitDestStageMasks[2] = {
-        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-    };
-    // set wait and release signals
-    VkSemaphore signals[2] = {
-        VK_NULL_HANDLE,
-        VK_NULL_HANDLE,
-    };
-
-    VkSubmitInfo submitInfo {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 0,
-        .pWaitSemaphores = signals,
-        .pWaitDstStageMask = waitDestStageMasks,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &mCurrentCmdBuffer->cmdbuffer,
-        .signalSemaphoreCount = 1u,
-        .pSignalSemaphores = &renderFinished,
+    const uint64_t submitValue = mSubmittedValue + 1;
+    PendingSubmission& pending = mPending[mPendingCount++];
+    pending = {
+        .cmdBuffer = mCurrentCmdBuffer,
+        .waitCount = 0,
+        .signalSemaphores = { renderFinished, mTimeline },
+        // values of binary semaphores are ignored
+        .signalValues = { 0, submitValue },
     };
 
+    // set wait signals
     if (mRenderFinishedSignal) {
-        signals[submitInfo.waitSemaphoreCount++] = mRenderFinishedSignal;
+        pending.waitSemaphores[pending.waitCount++] = mRenderFinishedSignal;
     }
 
     if (mAcquireImageSignal) {
-        signals[submitInfo.waitSemaphoreCount++] = mAcquireImageSignal;
+        pending.waitSemaphores[pending.waitCount++] = mAcquireImageSignal;
     }
 
-    auto fence = mCurrentCmdBuffer->queueSubmitFence;
-    // FIXME: should be called later?
-    VkFence vkfence = fence->get();
-    vkResetFences(mDevice, 1, &vkfence);
-    VR_ASSERT(fence != nullptr);
-    VkResult result = vkQueueSubmit(mQueue, 1, &submitInfo, fence->get());
+    if (transferFinished) {
+        pending.waitSemaphores[pending.waitCount++] = transferFinished;
+    }
 
-    VR_ASSERT(result == VK_SUCCESS);
+    mCurrentCmdBuffer->state = VulkanCommandBuffer::SUBMITTED;
+    mCurrentCmdBuffer->submitValue = submitValue;
+    mCurrentCmdBuffer->batchFence = VK_NULL_HANDLE;
+    mSubmittedValue = submitValue;
     // signal for previous frame 
     mRenderFinishedSignal = renderFinished;
     mAcquireImageSignal = VK_NULL_HANDLE;
@@ -139,6 +181,62 @@ bool VulkanCommandPool::flush() {
     return true;
 }
 
+bool VulkanCommandPool::submit() {
+    VR_TRACE_SCOPE("VulkanCommandPool::submit");
+
+    // the work we wait on has to be submitted before us
+    if (mTransferPool) {
+        mTransferPool->submit();
+    }
+
+    if (mPendingCount == 0) {
+        return false;
+    }
+
+    const VkPipelineStageFlags waitDestStageMasks[3] = {
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+    };
+    const uint64_t waitValues[3] = {};
+
+    VkTimelineSemaphoreSubmitInfo timelineInfos[VK_MAX_COMMAND_BUFFERS];
+    VkSubmitInfo submitInfos[VK_MAX_COMMAND_BUFFERS];
+    for (uint32_t i = 0; i < mPendingCount; ++i) {
+        PendingSubmission& pending = mPending[i];
+        timelineInfos[i] = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = pending.waitCount,
+            .pWaitSemaphoreValues = waitValues,
+            .signalSemaphoreValueCount = 2,
+            .pSignalSemaphoreValues = pending.signalValues,
+        };
+        submitInfos[i] = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = mTimeline ? &timelineInfos[i] : nullptr,
+            .waitSemaphoreCount = pending.waitCount,
+            .pWaitSemaphores = pending.waitSemaphores,
+            .pWaitDstStageMask = waitDestStageMasks,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &pending.cmdBuffer->cmdbuffer,
+            .signalSemaphoreCount = mTimeline ? 2u : 1u,
+            .pSignalSemaphores = pending.signalSemaphores,
+        };
+    }
+
+    // one fence covers the whole batch, the last slot's fence is free to use
+    VkFence fence = mTimeline ? VK_NULL_HANDLE : mPending[mPendingCount - 1].cmdBuffer->queueSubmitFence;
+    VkResult result = vkQueueSubmit(mQueue, mPendingCount, submitInfos, fence);
+    VR_ASSERT(result == VK_SUCCESS);
+
+    for (uint32_t i = 0; i < mPendingCount; ++i) {
+        mPending[i].cmdBuffer->batchFence = fence;
+    }
+    mIssuedValue = mSubmittedValue;
+    mPendingCount = 0;
+    return true;
+}
+
 VkSemaphore VulkanCommandPool::getRenderFinishedSignal() {
     VkSemaphore semaphore = mRenderFinishedSignal;
     mRenderFinishedSignal = VK_NULL_HANDLE;
@@ -151,11 +249,38 @@ void VulkanCommandPool::setAcquireNextImageSignal(VkSemaphore acquireNext) {
 }
 
 void VulkanCommandPool::wait() {
+    // uploads flushed without graphics work are not on the graphics timeline
+    if (mTransferPool) {
+        mTransferPool->wait();
+    }
+    waitFor(mSubmittedValue);
+}
+
+void VulkanCommandPool::waitFor(uint64_t value) {
+    VR_TRACE_SCOPE("VulkanCommandPool::wait");
+    VR_TRACE_COUNTER(WAITS, 1);
+    if (value > mIssuedValue) {
+        submit();
+    }
+
+    if (mTimeline) {
+        const VkSemaphoreWaitInfo waitInfo {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .semaphoreCount = 1,
+            .pSemaphores = &mTimeline,
+            .pValues = &value,
+        };
+        VkResult result = mWaitSemaphores(mDevice, &waitInfo, UINT64_MAX);
+        VR_ASSERT(result == VK_SUCCESS);
+        return;
+    }
+
     VkFence fences[VK_MAX_COMMAND_BUFFERS];
     uint32_t count = 0;
     for (auto& cmdBuffer : mCommandBuffers) {
-        if (cmdBuffer.cmdbuffer != VK_NULL_HANDLE && mCurrentCmdBuffer != &cmdBuffer) {
-            fences[count++] = cmdBuffer.queueSubmitFence->get();
+        if (cmdBuffer.state == VulkanCommandBuffer::SUBMITTED && cmdBuffer.submitValue <= value &&
+                std::find(fences, fences + count, cmdBuffer.batchFence) == fences + count) {
+            fences[count++] = cmdBuffer.batchFence;
         }
     }
     if (count > 0) {
@@ -165,29 +290,87 @@ void VulkanCommandPool::wait() {
 }
 
 void VulkanCommandPool::gc() {
+    updateFences();
+}
+
+void VulkanCommandPool::updateFences() {
+    // return completed slots to the free list, nothing is freed here
+    const uint64_t completed = getCompletedValue();
     for (auto& cmdBuffer : mCommandBuffers) {
-        if (cmdBuffer.cmdbuffer != VK_NULL_HANDLE) {
-            auto fence = cmdBuffer.queueSubmitFence->get();
-            VkResult result = vkWaitForFences(mDevice, 1, &fence, VK_TRUE, 0);
-            if (result == VK_SUCCESS) {
-                vkFreeCommandBuffers(mDevice, mPool, 1, &cmdBuffer.cmdbuffer);
-                cmdBuffer.cmdbuffer = VK_NULL_HANDLE;
-                cmdBuffer.queueSubmitFence.reset();
-                ++mFreeCmdBufferCount;
-            }
+        if (cmdBuffer.state == VulkanCommandBuffer::SUBMITTED && cmdBuffer.submitValue <= completed) {
+            cmdBuffer.state = VulkanCommandBuffer::FREE;
+            ++mFreeCmdBufferCount;
         }
     }
 }
 
-void VulkanCommandPool::updateFences() {
+uint64_t VulkanCommandPool::getCompletedValue() {
+    if (mTimeline) {
+        uint64_t value = 0;
+        VkResult result = mGetSemaphoreCounterValue(mDevice, mTimeline, &value);
+        VR_ASSERT(result == VK_SUCCESS);
+        return value;
+    }
+
+    // submissions complete in order, so everything before the oldest pending one is done
+    uint64_t completed = mSubmittedValue;
     for (auto& cmdBuffer : mCommandBuffers) {
-        if (cmdBuffer.cmdbuffer != VK_NULL_HANDLE) {
-            auto fence = cmdBuffer.queueSubmitFence;
-            if (fence != nullptr) {
-                VkResult status = vkGetFenceStatus(mDevice, fence->get());
-            }
+        if (cmdBuffer.state == VulkanCommandBuffer::SUBMITTED && (cmdBuffer.batchFence == VK_NULL_HANDLE ||
+                vkGetFenceStatus(mDevice, cmdBuffer.batchFence) != VK_SUCCESS)) {
+            completed = std::min(completed, cmdBuffer.submitValue - 1);
         }
     }
+    return completed;
+}
+
+VulkanSecondaryCommandPool::VulkanSecondaryCommandPool(const VkDevice& device, uint32_t queueFamilyIndex) : mDevice(device) {
+    VkCommandPoolCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    createInfo.queueFamilyIndex = queueFamilyIndex;
+    for (auto& pool : mPools) {
+        vkCreateCommandPool(mDevice, &createInfo, VKALLOC, &pool);
+    }
+}
+
+VulkanSecondaryCommandPool::~VulkanSecondaryCommandPool() {
+    for (auto& pool : mPools) {
+        vkDestroyCommandPool(mDevice, pool, VKALLOC);
+    }
+}
+
+VkCommandBuffer VulkanSecondaryCommandPool::begin(VulkanCommandBuffer const& primary, const VkCommandBufferInheritanceInfo& inheritance) {
+    const uint32_t index = primary.cmdBufferIndex;
+
+    // the primary slot was recycled, everything recorded for its previous use has completed
+    if (mSerials[index] != primary.serial) {
+        vkResetCommandPool(mDevice, mPools[index], 0);
+        mSerials[index] = primary.serial;
+        mUsedCount[index] = 0;
+    }
+
+    std::vector<VkCommandBuffer>& cmdbuffers = mCommandBuffers[index];
+    if (mUsedCount[index] == cmdbuffers.size()) {
+        const VkCommandBufferAllocateInfo allocateInfo {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = mPools[index],
+            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+            .commandBufferCount = 1
+        };
+        VkCommandBuffer cmdbuffer;
+        VkResult result = vkAllocateCommandBuffers(mDevice, &allocateInfo, &cmdbuffer);
+        VR_VK_ASSERT(result == VK_SUCCESS, "allocate secondary command buffer failed");
+        cmdbuffers.push_back(cmdbuffer);
+    }
+    VkCommandBuffer cmdbuffer = cmdbuffers[mUsedCount[index]++];
+
+    const VkCommandBufferBeginInfo binfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance,
+    };
+    vkBeginCommandBuffer(cmdbuffer, &binfo);
+    return cmdbuffer;
 }
 
 } // namespace backend
@@ -2,6 +2,7 @@
 #define VULKAN_COMMANDS_H
 
 #include <memory>
+#include <vector>
 #include "NonCopyable.h"
 #include "VulkanWrapper.h"
 #include "VulkanMacros.h"
@@ -9,15 +10,23 @@
 namespace VR {
 namespace backend {
 
-class VulkanFence;
-
+// per-slot state, the command buffer and its fence live as long as the pool
 struct VulkanCommandBuffer {
-    VulkanCommandBuffer() {}
-    VulkanCommandBuffer(VulkanCommandBuffer const&) = delete;
-    VulkanCommandBuffer& operator=(VulkanCommandBuffer const&) = delete;
+    enum State : uint8_t {
+        FREE,
+        RECORDING,
+        SUBMITTED,
+    };
     VkCommandBuffer cmdbuffer = VK_NULL_HANDLE;
-    std::shared_ptr<VulkanFence> queueSubmitFence;
+    VkFence queueSubmitFence = VK_NULL_HANDLE;
     uint32_t cmdBufferIndex = 0;
+    // bumped each time the slot is recycled
+    uint64_t serial = 0;
+    // submission value signalled when the slot's work completes
+    uint64_t submitValue = 0;
+    // signalled once the vkQueueSubmit batch holding this slot completes, null until it is issued
+    VkFence batchFence = VK_NULL_HANDLE;
+    State state = FREE;
 };
 
 class CommandBufferObserver {
@@ -28,19 +37,35 @@ public:
 
 class VulkanCommandPool : public NonCopyable {
     public:
-        VulkanCommandPool(const VkDevice& device, uint32_t queueFamilyIndex);
+        VulkanCommandPool(const VkDevice& device, uint32_t queueFamilyIndex, bool timelineSemaphoreSupported = false);
         virtual ~VulkanCommandPool();
 
         VulkanCommandBuffer const& get();
+        // ends recording and queues the command buffer, submit() hands all queued ones to the queue at once
         bool flush();
+        bool submit();
         void wait();
         void gc();
         void updateFences();
-        void setObserver(CommandBufferObserver* observer) { mObserver = observer; }
+        // every submission signals an increasing value, resources record the value they were used at
+        uint64_t getCurrentValue() const { return mSubmittedValue + 1; }
+        uint64_t getCompletedValue();
+        void waitFor(uint64_t value);
+        void addObserver(CommandBufferObserver* observer) { mObservers.push_back(observer); }
         VkSemaphore getRenderFinishedSignal();
         void setAcquireNextImageSignal(VkSemaphore next);
+        // submitted ahead of this pool's work, which then waits on its signal
+        void setTransferPool(VulkanCommandPool* pool) { mTransferPool = pool; }
 
     private:
+        struct PendingSubmission {
+            VulkanCommandBuffer* cmdBuffer;
+            VkSemaphore waitSemaphores[3];
+            uint32_t waitCount;
+            VkSemaphore signalSemaphores[2];
+            uint64_t signalValues[2];
+        };
+
         const VkDevice& mDevice;
         VkQueue mQueue;
         VkCommandPool mPool;
@@ -50,7 +75,35 @@ class VulkanCommandPool : public NonCopyable {
         VulkanCommandBuffer mCommandBuffers[VK_MAX_COMMAND_BUFFERS] = {};
         VkSemaphore mSubmissionSignals[VK_MAX_COMMAND_BUFFERS] = {};
         size_t mFreeCmdBufferCount = VK_MAX_COMMAND_BUFFERS;
-        CommandBufferObserver* mObserver = nullptr;
+        std::vector<CommandBufferObserver*> mObservers;
+        VulkanCommandPool* mTransferPool = nullptr;
+        uint64_t mSerial = 0;
+        uint64_t mSubmittedValue = 0;
+        // highest value handed to vkQueueSubmit, mSubmittedValue counts queued work too
+        uint64_t mIssuedValue = 0;
+        PendingSubmission mPending[VK_MAX_COMMAND_BUFFERS] = {};
+        uint32_t mPendingCount = 0;
+        // VK_KHR_timeline_semaphore path, fences are only used without it
+        VkSemaphore mTimeline = VK_NULL_HANDLE;
+        PFN_vkGetSemaphoreCounterValue mGetSemaphoreCounterValue = nullptr;
+        PFN_vkWaitSemaphores mWaitSemaphores = nullptr;
+};
+
+// secondary command buffers owned by a single recording thread, one pool per primary slot
+// so a slot can be reset as a whole once its primary command buffer has completed
+class VulkanSecondaryCommandPool : public NonCopyable {
+    public:
+        VulkanSecondaryCommandPool(const VkDevice& device, uint32_t queueFamilyIndex);
+        virtual ~VulkanSecondaryCommandPool();
+
+        VkCommandBuffer begin(VulkanCommandBuffer const& primary, const VkCommandBufferInheritanceInfo& inheritance);
+
+    private:
+        const VkDevice& mDevice;
+        VkCommandPool mPools[VK_MAX_COMMAND_BUFFERS] = {};
+        std::vector<VkCommandBuffer> mCommandBuffers[VK_MAX_COMMAND_BUFFERS];
+        uint32_t mUsedCount[VK_MAX_COMMAND_BUFFERS] = {};
+        uint64_t mSerials[VK_MAX_COMMAND_BUFFERS] = {};
 };
 
 } // namespace backend
@@ -0,0 +1,383 @@
+#include "VulkanCommandStream.h"
+
+namespace VR {
+namespace backend {
+
+VulkanCommandStream::VulkanCommandStream(VulkanRuntime& runtime, size_t bufferSize) : mRuntime(runtime), mBufferSize(bufferSize) {
+    mBuffers[0].resize(mBufferSize);
+    mBuffers[1].resize(mBufferSize);
+    mPublished[0].store(0);
+    mPublished[1].store(0);
+    mExit.store(false);
+    mRenderThread = std::thread(&VulkanCommandStream::renderLoop, this);
+}
+
+VulkanCommandStream::~VulkanCommandStream() {
+    waitIdle();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExit.store(true);
+    }
+    mCondition.notify_all();
+    mRenderThread.join();
+}
+
+uint8_t* VulkanCommandStream::allocate(size_t size) {
+    VR_VK_ASSERT(size <= mBufferSize, "Command larger than the command stream.");
+    if (mWriteOffset + size > mBufferSize) {
+        flush();
+    }
+    uint8_t* command = mBuffers[mWriteIndex].data() + mWriteOffset;
+    mWriteOffset += size;
+    return command;
+}
+
+void VulkanCommandStream::flush() {
+    if (mWriteOffset == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPublished[mWriteIndex].store(mWriteOffset, std::memory_order_release);
+    }
+    mCondition.notify_all();
+
+    // continue in the other buffer once the render thread has replayed it
+    mWriteIndex ^= 1;
+    mWriteOffset = 0;
+    if (mPublished[mWriteIndex].load(std::memory_order_acquire) != 0) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this] { return mPublished[mWriteIndex].load(std::memory_order_acquire) == 0; });
+    }
+}
+
+void VulkanCommandStream::waitIdle() {
+    flush();
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock, [this] {
+        return mPublished[0].load(std::memory_order_acquire) == 0 && mPublished[1].load(std::memory_order_acquire) == 0;
+    });
+}
+
+void VulkanCommandStream::renderLoop() {
+    uint32_t readIndex = 0;
+    while (true) {
+        size_t size = mPublished[readIndex].load(std::memory_order_acquire);
+        if (size == 0) {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this, readIndex] {
+                return mExit.load() || mPublished[readIndex].load(std::memory_order_acquire) != 0;
+            });
+            size = mPublished[readIndex].load(std::memory_order_acquire);
+            if (size == 0) {
+                return;
+            }
+        }
+
+        uint8_t* commands = mBuffers[readIndex].data();
+        for (size_t offset = 0; offset < size;) {
+            CommandBase* command = reinterpret_cast<CommandBase*>(commands + offset);
+            offset += command->size;
+            command->execute(command, mRuntime);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mPublished[readIndex].store(0, std::memory_order_release);
+        }
+        mCondition.notify_all();
+        readIndex ^= 1;
+    }
+}
+
+void VulkanCommandStream::beginFrame(DeferredHandle<VulkanSwapChain>* swapchain, uint64_t timeStamps, uint32_t frameId) {
+    queue([=](VulkanRuntime& runtime) { runtime.beginFrame(swapchain->object, timeStamps, frameId); });
+}
+
+void VulkanCommandStream::endFrame(uint32_t frameId) {
+    queue([=](VulkanRuntime& runtime) { runtime.endFrame(frameId); });
+    // the frame is the unit of work handed to the render thread
+    flush();
+}
+
+void VulkanCommandStream::commit(DeferredHandle<VulkanSwapChain>* swapchain) {
+    queue([=](VulkanRuntime& runtime) { runtime.commit(swapchain->object); });
+}
+
+void VulkanCommandStream::finish() {
+    run([](VulkanRuntime& runtime) { runtime.finish(); });
+}
+
+DeferredHandle<VulkanUniformBuffer>* VulkanCommandStream::createUniformBuffer(uint32_t size, BufferUsage usage) {
+    DeferredHandle<VulkanUniformBuffer>* handle = new DeferredHandle<VulkanUniformBuffer>();
+    queue([=](VulkanRuntime& runtime) { runtime.createUniformBuffer(handle->object, size, usage); });
+    return handle;
+}
+
+void VulkanCommandStream::destroyUniformBuffer(DeferredHandle<VulkanUniformBuffer>* uniformBuffer) {
+    queue([=](VulkanRuntime& runtime) {
+        runtime.destroyUniformBuffer(uniformBuffer->object);
+        delete uniformBuffer;
+    });
+}
+
+DeferredHandle<VulkanRenderPrimitive>* VulkanCommandStream::createRenderPrimitive() {
+    DeferredHandle<VulkanRenderPrimitive>* handle = new DeferredHandle<VulkanRenderPrimitive>();
+    queue([=](VulkanRuntime& runtime) { runtime.createRenderPrimitive(handle->object); });
+    return handle;
+}
+
+void VulkanCommandStream::destroyRenderPrimitive(DeferredHandle<VulkanRenderPrimitive>* primitive) {
+    queue([=](VulkanRuntime& runtime) {
+        runtime.destroyRenderPrimitive(primitive->object);
+        delete primitive;
+    });
+}
+
+DeferredHandle<VulkanVertexBuffer>* VulkanCommandStream::createVertexBuffer(uint8_t bufferCount, uint8_t attributeCount,
+        uint32_t elementCount, AttributeArray attributes) {
+    DeferredHandle<VulkanVertexBuffer>* handle = new DeferredHandle<VulkanVertexBuffer>();
+    queue([=](VulkanRuntime& runtime) { runtime.createVertexBuffer(handle->object, bufferCount, attributeCount, elementCount, attributes); });
+    return handle;
+}
+
+void VulkanCommandStream::destroyVertexBuffer(DeferredHandle<VulkanVertexBuffer>* vertexBuffer) {
+    queue([=](VulkanRuntime& runtime) {
+        runtime.destroyVertexBuffer(vertexBuffer->object);
+        delete vertexBuffer;
+    });
+}
+
+DeferredHandle<VulkanIndexBuffer>* VulkanCommandStream::createIndexBuffer(ElementType elementType, uint32_t indexCount, bool narrow) {
+    DeferredHandle<VulkanIndexBuffer>* handle = new DeferredHandle<VulkanIndexBuffer>();
+    queue([=](VulkanRuntime& runtime) { runtime.createIndexBuffer(handle->object, elementType, indexCount, narrow); });
+    return handle;
+}
+
+void VulkanCommandStream::destroyIndexBuffer(DeferredHandle<VulkanIndexBuffer>* indexBuffer) {
+    queue([=](VulkanRuntime& runtime) {
+        runtime.destroyIndexBuffer(indexBuffer->object);
+        delete indexBuffer;
+    });
+}
+
+DeferredHandle<VulkanBufferObject>* VulkanCommandStream::createBufferObject(uint32_t byteCount) {
+    DeferredHandle<VulkanBufferObject>* handle = new DeferredHandle<VulkanBufferObject>();
+    queue([=](VulkanRuntime& runtime) { runtime.createBufferObject(handle->object, byteCount); });
+    return handle;
+}
+
+void VulkanCommandStream::destroyBufferObject(DeferredHandle<VulkanBufferObject>* bufferObject) {
+    queue([=](VulkanRuntime& runtime) {
+        runtime.destroyBufferObject(bufferObject->object);
+        delete bufferObject;
+    });
+}
+
+DeferredHandle<VulkanTexture>* VulkanCommandStream::createTexture(SamplerType target, uint8_t levels, TextureFormat format, uint8_t samples,
+        uint32_t w, uint32_t h, uint32_t depth, TextureUsage usage) {
+    DeferredHandle<VulkanTexture>* handle = new DeferredHandle<VulkanTexture>();
+    queue([=](VulkanRuntime& runtime) { runtime.createTexture(handle->object, target, levels, format, samples, w, h, depth, usage); });
+    return handle;
+}
+
+void VulkanCommandStream::destroyTexture(DeferredHandle<VulkanTexture>* texture) {
+    queue([=](VulkanRuntime& runtime) {
+        runtime.destroyTexture(texture->object);
+        delete texture;
+    });
+}
+
+DeferredHandle<VulkanProgram>* VulkanCommandStream::createProgram(Program& program, std::string programName) {
+    // the program's shader sources are only borrowed, so build it before returning
+    DeferredHandle<VulkanProgram>* handle = new DeferredHandle<VulkanProgram>();
+    Program* source = &program;
+    std::string* name = &programName;
+    run([=](VulkanRuntime& runtime) { runtime.createProgram(handle->object, *source, *name); });
+    return handle;
+}
+
+void VulkanCommandStream::destroyProgram(DeferredHandle<VulkanProgram>* program) {
+    queue([=](VulkanRuntime& runtime) {
+        runtime.destroyProgram(program->object);
+        delete program;
+    });
+}
+
+DeferredHandle<VulkanRenderTarget>* VulkanCommandStream::createDefaultRenderTarget() {
+    DeferredHandle<VulkanRenderTarget>* handle = new DeferredHandle<VulkanRenderTarget>();
+    queue([=](VulkanRuntime& runtime) { runtime.createDefaultRenderTarget(handle->object); });
+    return handle;
+}
+
+DeferredHandle<VulkanRenderTarget>* VulkanCommandStream::createRenderTarget(uint32_t width, uint32_t height, uint8_t samples,
+        DeferredHandle<VulkanTexture>* color[MAX_SUPPORTED_RENDER_TARGET_COUNT],
+        DeferredHandle<VulkanTexture>* depth, DeferredHandle<VulkanTexture>* stencil) {
+    VR_ASSERT(depth != nullptr && stencil != nullptr);
+    DeferredHandle<VulkanRenderTarget>* handle = new DeferredHandle<VulkanRenderTarget>();
+    std::array<DeferredHandle<VulkanTexture>*, MAX_SUPPORTED_RENDER_TARGET_COUNT> colorTargets;
+    for (int i = 0; i < MAX_SUPPORTED_RENDER_TARGET_COUNT; i++) {
+        colorTargets[i] = color[i];
+    }
+    queue([=](VulkanRuntime& runtime) {
+        VulkanAttachment attachments[MAX_SUPPORTED_RENDER_TARGET_COUNT] = {};
+        for (int i = 0; i < MAX_SUPPORTED_RENDER_TARGET_COUNT; i++) {
+            attachments[i].texture = colorTargets[i] ? colorTargets[i]->object : nullptr;
+        }
+        runtime.createRenderTarget(handle->object, width, height, samples, attachments, *depth->object, *stencil->object);
+    });
+    return handle;
+}
+
+void VulkanCommandStream::destroyRenderTarget(DeferredHandle<VulkanRenderTarget>* renderTarget) {
+    queue([=](VulkanRuntime& runtime) {
+        runtime.destroyRenderTarget(renderTarget->object);
+        delete renderTarget;
+    });
+}
+
+DeferredHandle<VulkanSwapChain>* VulkanCommandStream::createSwapChain(void* nativeWindow, uint64_t flags) {
+    // the surface belongs to the caller's window, create it while the caller waits
+    DeferredHandle<VulkanSwapChain>* handle = new DeferredHandle<VulkanSwapChain>();
+    run([=](VulkanRuntime& runtime) { runtime.createSwapChain(handle->object, nativeWindow, flags); });
+    return handle;
+}
+
+void VulkanCommandStream::destroySwapChain(DeferredHandle<VulkanSwapChain>* swapchain) {
+    run([=](VulkanRuntime& runtime) {
+        runtime.destroySwapChain(swapchain->object);
+        delete swapchain;
+    });
+}
+
+void VulkanCommandStream::setVertexBufferObject(DeferredHandle<VulkanVertexBuffer>* vertexBuffer, uint32_t index,
+        DeferredHandle<VulkanBufferObject>* bufferObject) {
+    queue([=](VulkanRuntime& runtime) { runtime.setVertexBufferObject(vertexBuffer->object, index, bufferObject->object); });
+}
+
+void VulkanCommandStream::updateIndexBuffer(DeferredHandle<VulkanIndexBuffer>* indexBuffer, BufferDescriptor&& data, uint32_t byteOffset) {
+    BufferDescriptor* descriptor = new BufferDescriptor(std::move(data));
+    queue([=](VulkanRuntime& runtime) {
+        runtime.updateIndexBuffer(indexBuffer->object, *descriptor, byteOffset);
+        delete descriptor;
+    });
+}
+
+void VulkanCommandStream::updateBufferObject(DeferredHandle<VulkanBufferObject>* bufferObject, BufferDescriptor&& data, uint32_t byteOffset) {
+    BufferDescriptor* descriptor = new BufferDescriptor(std::move(data));
+    queue([=](VulkanRuntime& runtime) {
+        runtime.updateBufferObject(bufferObject->object, *descriptor, byteOffset);
+        delete descriptor;
+    });
+}
+
+void VulkanCommandStream::update2DImage(DeferredHandle<VulkanTexture>* texture, uint32_t level, uint32_t xoffset, uint32_t yoffset,
+        uint32_t width, uint32_t height, PixelBufferDescriptor&& data) {
+    PixelBufferDescriptor* descriptor = new PixelBufferDescriptor(std::move(data));
+    queue([=](VulkanRuntime& runtime) {
+        runtime.update2DImage(texture->object, level, xoffset, yoffset, width, height, *descriptor);
+        delete descriptor;
+    });
+}
+
+void VulkanCommandStream::updateCubeImage(DeferredHandle<VulkanTexture>* texture, uint32_t level, PixelBufferDescriptor&& data, FaceOffsets faceOffsets) {
+    PixelBufferDescriptor* descriptor = new PixelBufferDescriptor(std::move(data));
+    queue([=](VulkanRuntime& runtime) {
+        runtime.updateCubeImage(texture->object, level, *descriptor, faceOffsets);
+        delete descriptor;
+    });
+}
+
+void VulkanCommandStream::setMinMaxLevels(DeferredHandle<VulkanTexture>* texture, uint32_t minLevel, uint32_t maxLevel) {
+    queue([=](VulkanRuntime& runtime) { runtime.setMinMaxLevels(texture->object, minLevel, maxLevel); });
+}
+
+void VulkanCommandStream::loadUniformBuffer(DeferredHandle<VulkanUniformBuffer>* uniformBuffer, BufferDescriptor&& data) {
+    BufferDescriptor* descriptor = new BufferDescriptor(std::move(data));
+    queue([=](VulkanRuntime& runtime) {
+        runtime.loadUniformBuffer(uniformBuffer->object, *descriptor);
+        delete descriptor;
+    });
+}
+
+void VulkanCommandStream::beginRenderPass(DeferredHandle<VulkanRenderTarget>* renderTarget, const RenderPassParams& params) {
+    VR_VK_ASSERT(params.workerCount == 0, "Parallel render passes are not streamed.");
+    queue([=](VulkanRuntime& runtime) { runtime.beginRenderPass(renderTarget->object, params); });
+}
+
+void VulkanCommandStream::endRenderPass() {
+    queue([](VulkanRuntime& runtime) { runtime.endRenderPass(); });
+}
+
+void VulkanCommandStream::nextSubpass() {
+    queue([](VulkanRuntime& runtime) { runtime.nextSubpass(); });
+}
+
+void VulkanCommandStream::setRenderPrimitiveBuffer(DeferredHandle<VulkanRenderPrimitive>* primitive,
+        DeferredHandle<VulkanVertexBuffer>* vertexBuffer, DeferredHandle<VulkanIndexBuffer>* indexBuffer) {
+    queue([=](VulkanRuntime& runtime) { runtime.setRenderPrimitiveBuffer(primitive->object, vertexBuffer->object, indexBuffer->object); });
+}
+
+void VulkanCommandStream::setRenderPrimitiveRange(DeferredHandle<VulkanRenderPrimitive>* primitive, PrimitiveType pt, uint32_t offset,
+        uint32_t minIndex, uint32_t maxIndex, uint32_t count) {
+    queue([=](VulkanRuntime& runtime) { runtime.setRenderPrimitiveRange(primitive->object, pt, offset, minIndex, maxIndex, count); });
+}
+
+void VulkanCommandStream::setRenderPrimitiveLods(DeferredHandle<VulkanRenderPrimitive>* primitive, const MeshLod* lods, uint32_t lodCount) {
+    VR_ASSERT(lodCount <= MAX_LOD_COUNT);
+    std::array<MeshLod, MAX_LOD_COUNT> copy;
+    memcpy(copy.data(), lods, lodCount * sizeof(MeshLod));
+    queue([=](VulkanRuntime& runtime) { runtime.setRenderPrimitiveLods(primitive->object, copy.data(), lodCount); });
+}
+
+void VulkanCommandStream::bindUniformBuffer(uint32_t index, DeferredHandle<VulkanUniformBuffer>* uniformBuffer) {
+    queue([=](VulkanRuntime& runtime) { runtime.bindUniformBuffer(index, uniformBuffer->object); });
+}
+
+void VulkanCommandStream::bindUniformBufferRange(uint32_t index, DeferredHandle<VulkanUniformBuffer>* uniformBuffer, uint32_t offset, uint32_t size) {
+    queue([=](VulkanRuntime& runtime) { runtime.bindUniformBufferRange(index, uniformBuffer->object, offset, size); });
+}
+
+void VulkanCommandStream::bindSampler(uint32_t index, DeferredHandle<VulkanTexture>* texture, SamplerParams params) {
+    queue([=](VulkanRuntime& runtime) mutable {
+        // non-owning, the texture lives until its destroy command
+        VulkanSampler sampler(std::shared_ptr<VulkanTexture>(std::shared_ptr<VulkanTexture>(), texture->object), params);
+        runtime.bindSampler(index, sampler);
+    });
+}
+
+void VulkanCommandStream::draw(DeferredHandle<VulkanProgram>* program, const RasterStateT& rasterState, const PolygonOffset& polygonOffset,
+        const Viewport& scissor, DeferredHandle<VulkanRenderPrimitive>* primitive, uint32_t instanceCount, uint32_t lod) {
+    queue([=](VulkanRuntime& runtime) {
+        PipelineState pipelineState;
+        // non-owning, the program lives until its destroy command
+        pipelineState.program = std::shared_ptr<VulkanProgram>(std::shared_ptr<VulkanProgram>(), program->object);
+        pipelineState.rasterState = rasterState;
+        pipelineState.polygonOffset = polygonOffset;
+        pipelineState.scissor = scissor;
+        runtime.draw(pipelineState, primitive->object, instanceCount, lod);
+    });
+}
+
+void VulkanCommandStream::drawIndirect(DeferredHandle<VulkanProgram>* program, const RasterStateT& rasterState, const PolygonOffset& polygonOffset,
+        const Viewport& scissor, DeferredHandle<VulkanRenderPrimitive>* primitive, DeferredHandle<VulkanBufferObject>* commands,
+        uint32_t offset, uint32_t drawCount, DeferredHandle<VulkanBufferObject>* countBuffer, uint32_t countOffset) {
+    queue([=](VulkanRuntime& runtime) {
+        PipelineState pipelineState;
+        pipelineState.program = std::shared_ptr<VulkanProgram>(std::shared_ptr<VulkanProgram>(), program->object);
+        pipelineState.rasterState = rasterState;
+        pipelineState.polygonOffset = polygonOffset;
+        pipelineState.scissor = scissor;
+        runtime.drawIndirect(pipelineState, primitive->object, commands->object, offset, drawCount,
+                             countBuffer ? countBuffer->object : nullptr, countOffset);
+    });
+}
+
+void VulkanCommandStream::readPixels(DeferredHandle<VulkanRenderTarget>* renderTarget, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+        PixelBufferDescriptor& pbd) {
+    PixelBufferDescriptor* descriptor = &pbd;
+    run([=](VulkanRuntime& runtime) { runtime.readPixels(renderTarget->object, x, y, width, height, *descriptor); });
+}
+
+} // namespace backend
+} // namespace VR
@@ -0,0 +1,161 @@
+#ifndef VULKAN_COMMAND_STREAM_H
+#define VULKAN_COMMAND_STREAM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "NonCopyable.h"
+#include "VulkanRuntime.h"
+
+namespace VR {
+namespace backend {
+
+// backing object filled in by the render thread when the create command runs,
+// the handle itself is valid immediately and is freed by the matching destroy command
+template<typename T>
+struct DeferredHandle {
+    T* object = nullptr;
+};
+
+// front end that records runtime calls into a double-buffered byte stream, a dedicated render thread
+// replays them in order. Filled buffers are handed over by an atomic byte count, a mutex and condition
+// variable only put the side that has to wait to sleep. Programs, swap chains, finish and readPixels
+// drain the stream and run synchronously, everything else including render targets is queued behind
+// a DeferredHandle. Parallel render passes are not streamed, their workers talk to the runtime directly
+// from the render thread's pass.
+class VulkanCommandStream : public NonCopyable {
+public:
+    explicit VulkanCommandStream(VulkanRuntime& runtime, size_t bufferSize = 2 * 1024 * 1024);
+    virtual ~VulkanCommandStream();
+
+    // hands the recorded commands to the render thread, blocks only if it is still a buffer behind
+    void flush();
+    // flushes and waits until the render thread has executed everything
+    void waitIdle();
+
+    // frame
+    void beginFrame(DeferredHandle<VulkanSwapChain>* swapchain, uint64_t timeStamps, uint32_t frameId);
+    void endFrame(uint32_t frameId);
+    void commit(DeferredHandle<VulkanSwapChain>* swapchain);
+    void finish();
+
+    // resources
+    DeferredHandle<VulkanUniformBuffer>* createUniformBuffer(uint32_t size, BufferUsage usage);
+    void destroyUniformBuffer(DeferredHandle<VulkanUniformBuffer>* uniformBuffer);
+    DeferredHandle<VulkanRenderPrimitive>* createRenderPrimitive();
+    void destroyRenderPrimitive(DeferredHandle<VulkanRenderPrimitive>* primitive);
+    DeferredHandle<VulkanVertexBuffer>* createVertexBuffer(uint8_t bufferCount, uint8_t attributeCount, uint32_t elementCount, AttributeArray attributes);
+    void destroyVertexBuffer(DeferredHandle<VulkanVertexBuffer>* vertexBuffer);
+    DeferredHandle<VulkanIndexBuffer>* createIndexBuffer(ElementType elementType, uint32_t indexCount, bool narrow = false);
+    void destroyIndexBuffer(DeferredHandle<VulkanIndexBuffer>* indexBuffer);
+    DeferredHandle<VulkanBufferObject>* createBufferObject(uint32_t byteCount);
+    void destroyBufferObject(DeferredHandle<VulkanBufferObject>* bufferObject);
+    DeferredHandle<VulkanTexture>* createTexture(SamplerType target, uint8_t levels, TextureFormat format, uint8_t samples,
+                                                 uint32_t w, uint32_t h, uint32_t depth, TextureUsage usage);
+    void destroyTexture(DeferredHandle<VulkanTexture>* texture);
+    DeferredHandle<VulkanProgram>* createProgram(Program& program, std::string programName);
+    void destroyProgram(DeferredHandle<VulkanProgram>* program);
+    DeferredHandle<VulkanRenderTarget>* createDefaultRenderTarget();
+    DeferredHandle<VulkanRenderTarget>* createRenderTarget(uint32_t width, uint32_t height, uint8_t samples,
+                                                           DeferredHandle<VulkanTexture>* color[MAX_SUPPORTED_RENDER_TARGET_COUNT],
+                                                           DeferredHandle<VulkanTexture>* depth, DeferredHandle<VulkanTexture>* stencil);
+    void destroyRenderTarget(DeferredHandle<VulkanRenderTarget>* renderTarget);
+    DeferredHandle<VulkanSwapChain>* createSwapChain(void* nativeWindow, uint64_t flags);
+    void destroySwapChain(DeferredHandle<VulkanSwapChain>* swapchain);
+
+    // updates, descriptors are released on the render thread once uploaded
+    void setVertexBufferObject(DeferredHandle<VulkanVertexBuffer>* vertexBuffer, uint32_t index, DeferredHandle<VulkanBufferObject>* bufferObject);
+    void updateIndexBuffer(DeferredHandle<VulkanIndexBuffer>* indexBuffer, BufferDescriptor&& data, uint32_t byteOffset);
+    void updateBufferObject(DeferredHandle<VulkanBufferObject>* bufferObject, BufferDescriptor&& data, uint32_t byteOffset);
+    void update2DImage(DeferredHandle<VulkanTexture>* texture, uint32_t level, uint32_t xoffset, uint32_t yoffset,
+                       uint32_t width, uint32_t height, PixelBufferDescriptor&& data);
+    void updateCubeImage(DeferredHandle<VulkanTexture>* texture, uint32_t level, PixelBufferDescriptor&& data, FaceOffsets faceOffsets);
+    void setMinMaxLevels(DeferredHandle<VulkanTexture>* texture, uint32_t minLevel, uint32_t maxLevel);
+    void loadUniformBuffer(DeferredHandle<VulkanUniformBuffer>* uniformBuffer, BufferDescriptor&& data);
+
+    // rendering
+    void beginRenderPass(DeferredHandle<VulkanRenderTarget>* renderTarget, const RenderPassParams& params);
+    void endRenderPass();
+    void nextSubpass();
+    void setRenderPrimitiveBuffer(DeferredHandle<VulkanRenderPrimitive>* primitive, DeferredHandle<VulkanVertexBuffer>* vertexBuffer,
+                                  DeferredHandle<VulkanIndexBuffer>* indexBuffer);
+    void setRenderPrimitiveRange(DeferredHandle<VulkanRenderPrimitive>* primitive, PrimitiveType pt, uint32_t offset,
+                                 uint32_t minIndex, uint32_t maxIndex, uint32_t count);
+    void setRenderPrimitiveLods(DeferredHandle<VulkanRenderPrimitive>* primitive, const MeshLod* lods, uint32_t lodCount);
+    void bindUniformBuffer(uint32_t index, DeferredHandle<VulkanUniformBuffer>* uniformBuffer);
+    void bindUniformBufferRange(uint32_t index, DeferredHandle<VulkanUniformBuffer>* uniformBuffer, uint32_t offset, uint32_t size);
+    void bindSampler(uint32_t index, DeferredHandle<VulkanTexture>* texture, SamplerParams params);
+    void draw(DeferredHandle<VulkanProgram>* program, const RasterStateT& rasterState, const PolygonOffset& polygonOffset,
+              const Viewport& scissor, DeferredHandle<VulkanRenderPrimitive>* primitive, uint32_t instanceCount = 1,
+              uint32_t lod = 0);
+    void drawIndirect(DeferredHandle<VulkanProgram>* program, const RasterStateT& rasterState, const PolygonOffset& polygonOffset,
+                      const Viewport& scissor, DeferredHandle<VulkanRenderPrimitive>* primitive, DeferredHandle<VulkanBufferObject>* commands,
+                      uint32_t offset, uint32_t drawCount, DeferredHandle<VulkanBufferObject>* countBuffer = nullptr, uint32_t countOffset = 0);
+    void readPixels(DeferredHandle<VulkanRenderTarget>* renderTarget, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                    PixelBufferDescriptor& pbd);
+
+private:
+
+    struct CommandBase {
+        using Execute = void (*)(CommandBase* command, VulkanRuntime& runtime);
+        Execute execute;
+        size_t size;
+    };
+
+    template<typename Fn>
+    struct Command : public CommandBase {
+        Fn fn;
+        Command(Fn&& f, size_t commandSize) : fn(std::move(f)) {
+            execute = &Command::run;
+            size = commandSize;
+        }
+        static void run(CommandBase* base, VulkanRuntime& runtime) {
+            Command* command = static_cast<Command*>(base);
+            command->fn(runtime);
+            command->~Command();
+        }
+    };
+
+    template<typename Fn>
+    void queue(Fn fn) {
+        using Cmd = Command<Fn>;
+        const size_t align = alignof(std::max_align_t);
+        const size_t size = (sizeof(Cmd) + align - 1) & ~(align - 1);
+        new (allocate(size)) Cmd(std::move(fn), size);
+    }
+
+    // runs on the render thread and waits for it, for calls that hand results back
+    template<typename Fn>
+    void run(Fn fn) {
+        queue(std::move(fn));
+        waitIdle();
+    }
+
+    uint8_t* allocate(size_t size);
+    void renderLoop();
+
+    VulkanRuntime& mRuntime;
+    const size_t mBufferSize;
+    std::vector<uint8_t> mBuffers[2];
+    // bytes of a buffer published to the render thread, 0 once it has been replayed
+    std::atomic<size_t> mPublished[2];
+    uint32_t mWriteIndex = 0;
+    size_t mWriteOffset = 0;
+
+    std::atomic<bool> mExit;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::thread mRenderThread;
+};
+
+} // namespace backend
+} // namespace VR
+
+#endif // VULKAN_COMMAND_STREAM_H
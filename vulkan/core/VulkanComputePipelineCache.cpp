@@ -0,0 +1,263 @@
+#include "VulkanComputePipelineCache.h"
+#include "VulkanAlloc.h"
+#include "VulkanTrace.h"
+
+namespace VR {
+namespace backend {
+
+VulkanComputePipelineCache::VulkanComputePipelineCache() {
+}
+
+VulkanComputePipelineCache::~VulkanComputePipelineCache() {
+    // Do nothing
+}
+
+void VulkanComputePipelineCache::bindStorageBuffer(uint32_t bindingIndex, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) {
+    VR_VK_ASSERT(bindingIndex < STORAGE_BUFFER_BINDING_COUNT, "Storage buffer bindings out of range.");
+    mDescriptorInfo.storageBuffers[bindingIndex] = {
+        .buffer = buffer,
+        .offset = offset,
+        .range = size,
+    };
+}
+
+void VulkanComputePipelineCache::bindStorageImage(uint32_t bindingIndex, VkImage image, VkImageView imageView) {
+    VR_VK_ASSERT(bindingIndex < STORAGE_IMAGE_BINDING_COUNT, "Storage image bindings out of range.");
+    mDescriptorInfo.storageImages[bindingIndex] = {
+        .sampler = VK_NULL_HANDLE,
+        .imageView = imageView,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+    mDescriptorInfo.images[bindingIndex] = image;
+}
+
+void VulkanComputePipelineCache::bindPushConstants(const void* data, uint32_t size) {
+    VR_VK_ASSERT(size <= COMPUTE_PUSH_CONSTANT_SIZE, "Push constants out of range.");
+    ::memcpy(mPushConstants, data, size);
+    mPushConstantSize = size;
+}
+
+void VulkanComputePipelineCache::unbindBuffer(VkBuffer buffer) {
+    for (auto& storageBuffer : mDescriptorInfo.storageBuffers) {
+        if (storageBuffer.buffer == buffer) {
+            storageBuffer = {};
+        }
+    }
+}
+
+void VulkanComputePipelineCache::unbindImage(VkImage image) {
+    for (uint32_t bindingIndex = 0; bindingIndex < STORAGE_IMAGE_BINDING_COUNT; bindingIndex++) {
+        if (mDescriptorInfo.images[bindingIndex] == image) {
+            mDescriptorInfo.storageImages[bindingIndex] = {};
+            mDescriptorInfo.images[bindingIndex] = VK_NULL_HANDLE;
+        }
+    }
+}
+
+void VulkanComputePipelineCache::bindPipeline(VkCommandBuffer cmdbuffer, VkShaderModule shader) {
+    VR_VK_ASSERT(shader != VK_NULL_HANDLE, "Compute shader is not bound.");
+    if (!mPipelineLayout) {
+        createLayouts();
+    }
+
+    VkPipeline& pipeline = mPipelines[shader];
+    if (pipeline == VK_NULL_HANDLE) {
+        VkComputePipelineCreateInfo pipelineCreateInfo = {};
+        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineCreateInfo.stage.module = shader;
+        pipelineCreateInfo.stage.pName = "main";
+        pipelineCreateInfo.layout = mPipelineLayout;
+        VkResult result = vkCreateComputePipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, VKALLOC, &pipeline);
+        VR_VK_ASSERT(result == VK_SUCCESS, "vkCreateComputePipelines error.");
+        VR_TRACE_COUNTER(PIPELINES_CREATED, 1);
+    }
+    vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+    VkDescriptorSet descriptorSets[2];
+    allocateDescriptorSets(descriptorSets);
+
+    uint32_t writesCount = 0;
+    VkWriteDescriptorSet writeDescriptorSets[STORAGE_BUFFER_BINDING_COUNT + STORAGE_IMAGE_BINDING_COUNT];
+    for (uint32_t binding = 0; binding < STORAGE_BUFFER_BINDING_COUNT; binding++) {
+        if (mDescriptorInfo.storageBuffers[binding].buffer == VK_NULL_HANDLE) {
+            continue;
+        }
+        writeDescriptorSets[writesCount++] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSets[0],
+            .dstBinding = binding,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &mDescriptorInfo.storageBuffers[binding],
+        };
+    }
+    for (uint32_t binding = 0; binding < STORAGE_IMAGE_BINDING_COUNT; binding++) {
+        if (mDescriptorInfo.storageImages[binding].imageView == VK_NULL_HANDLE) {
+            continue;
+        }
+        writeDescriptorSets[writesCount++] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSets[1],
+            .dstBinding = binding,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .pImageInfo = &mDescriptorInfo.storageImages[binding],
+        };
+    }
+    vkUpdateDescriptorSets(mDevice, writesCount, writeDescriptorSets, 0, nullptr);
+    vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout, 0, 2, descriptorSets, 0, nullptr);
+
+    if (mPushConstantSize != 0) {
+        vkCmdPushConstants(cmdbuffer, mPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, mPushConstantSize, mPushConstants);
+    }
+}
+
+void VulkanComputePipelineCache::retirePipeline(VkShaderModule shader) {
+    auto iter = mPipelines.find(shader);
+    if (iter == mPipelines.end()) {
+        return;
+    }
+    mRetiredPipelines.push_back(std::make_pair(iter->second, 0u));
+    mPipelines.erase(iter);
+}
+
+void VulkanComputePipelineCache::allocateDescriptorSets(VkDescriptorSet descriptorSets[2]) {
+    DescriptorPools& slot = mDescriptorPools[mCmdBufferIndex];
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorSetCount = 2;
+    allocInfo.pSetLayouts = mDescriptorSetLayouts;
+
+    VkResult result = VK_ERROR_OUT_OF_POOL_MEMORY;
+    while (result != VK_SUCCESS) {
+        // the current pool is exhausted, move on to the next one
+        if (slot.current == slot.pools.size()) {
+            slot.pools.push_back(createDescriptorPool());
+        }
+        allocInfo.descriptorPool = slot.pools[slot.current];
+        result = vkAllocateDescriptorSets(mDevice, &allocInfo, descriptorSets);
+        if (result != VK_SUCCESS) {
+            VR_ASSERT(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL);
+            slot.current++;
+        }
+    }
+    VR_TRACE_COUNTER(DESCRIPTOR_SETS_ALLOCATED, 2);
+}
+
+void VulkanComputePipelineCache::onCommandBuffer(const VulkanCommandBuffer& cmdbuffer) {
+    mCmdBufferIndex = cmdbuffer.cmdBufferIndex;
+    // the slot's previous submission has completed, its descriptor sets can go
+    DescriptorPools& slot = mDescriptorPools[mCmdBufferIndex];
+    for (VkDescriptorPool pool : slot.pools) {
+        vkResetDescriptorPool(mDevice, pool, 0);
+    }
+    slot.current = 0;
+
+    // the command buffer that last used a pipeline has completed once all of them have cycled
+    for (size_t i = 0; i < mRetiredPipelines.size();) {
+        if (++mRetiredPipelines[i].second > VK_MAX_COMMAND_BUFFERS) {
+            vkDestroyPipeline(mDevice, mRetiredPipelines[i].first, VKALLOC);
+            mRetiredPipelines[i] = mRetiredPipelines.back();
+            mRetiredPipelines.pop_back();
+        } else {
+            ++i;
+        }
+    }
+}
+
+void VulkanComputePipelineCache::createLayouts() {
+    VkDescriptorSetLayoutBinding bufferBindings[STORAGE_BUFFER_BINDING_COUNT];
+    VkDescriptorSetLayoutBinding imageBindings[STORAGE_IMAGE_BINDING_COUNT];
+    VkDescriptorSetLayoutBinding binding = {};
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    for (uint32_t i = 0; i < STORAGE_BUFFER_BINDING_COUNT; i++) {
+        binding.binding = i;
+        bufferBindings[i] = binding;
+    }
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    for (uint32_t i = 0; i < STORAGE_IMAGE_BINDING_COUNT; i++) {
+        binding.binding = i;
+        imageBindings[i] = binding;
+    }
+
+    VkDescriptorSetLayoutCreateInfo dlinfo = {};
+    dlinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    dlinfo.bindingCount = STORAGE_BUFFER_BINDING_COUNT;
+    dlinfo.pBindings = bufferBindings;
+    vkCreateDescriptorSetLayout(mDevice, &dlinfo, VKALLOC, &mDescriptorSetLayouts[0]);
+    dlinfo.bindingCount = STORAGE_IMAGE_BINDING_COUNT;
+    dlinfo.pBindings = imageBindings;
+    vkCreateDescriptorSetLayout(mDevice, &dlinfo, VKALLOC, &mDescriptorSetLayouts[1]);
+
+    const VkPushConstantRange pushConstantRange {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = COMPUTE_PUSH_CONSTANT_SIZE,
+    };
+    VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo = {};
+    pPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pPipelineLayoutCreateInfo.setLayoutCount = 2;
+    pPipelineLayoutCreateInfo.pSetLayouts = mDescriptorSetLayouts;
+    pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    VkResult err = vkCreatePipelineLayout(mDevice, &pPipelineLayoutCreateInfo, VKALLOC, &mPipelineLayout);
+    VR_VK_CHECK(err == VK_SUCCESS, "Unable to create compute pipeline layout.");
+}
+
+VkDescriptorPool VulkanComputePipelineCache::createDescriptorPool() const {
+    VkDescriptorPoolSize poolSizes[2] = {};
+    VkDescriptorPoolCreateInfo poolInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .maxSets = mDescriptorPoolSize * 2,
+        .poolSizeCount = 2,
+        .pPoolSizes = poolSizes
+    };
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = mDescriptorPoolSize * STORAGE_BUFFER_BINDING_COUNT;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = mDescriptorPoolSize * STORAGE_IMAGE_BINDING_COUNT;
+
+    VkDescriptorPool pool;
+    VkResult result = vkCreateDescriptorPool(mDevice, &poolInfo, VKALLOC, &pool);
+    VR_ASSERT(result == VK_SUCCESS);
+    return pool;
+}
+
+void VulkanComputePipelineCache::destroyCache() {
+    for (auto& pipeline : mPipelines) {
+        vkDestroyPipeline(mDevice, pipeline.second, VKALLOC);
+    }
+    for (auto& retired : mRetiredPipelines) {
+        vkDestroyPipeline(mDevice, retired.first, VKALLOC);
+    }
+    mPipelines.clear();
+    mRetiredPipelines.clear();
+
+    for (auto& slot : mDescriptorPools) {
+        for (VkDescriptorPool pool : slot.pools) {
+            vkDestroyDescriptorPool(mDevice, pool, VKALLOC);
+        }
+        slot.pools.clear();
+        slot.current = 0;
+    }
+
+    if (mPipelineLayout == VK_NULL_HANDLE) {
+        return;
+    }
+    vkDestroyPipelineLayout(mDevice, mPipelineLayout, VKALLOC);
+    mPipelineLayout = VK_NULL_HANDLE;
+    for (auto& layout : mDescriptorSetLayouts) {
+        vkDestroyDescriptorSetLayout(mDevice, layout, VKALLOC);
+        layout = VK_NULL_HANDLE;
+    }
+}
+
+} // namespace backend
+} // namespace VR
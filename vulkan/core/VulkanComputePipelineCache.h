@@ -0,0 +1,75 @@
+#ifndef VULKAN_COMPUTE_PIPELINE_CACHE_H
+#define VULKAN_COMPUTE_PIPELINE_CACHE_H
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "NonCopyable.h"
+#include "VulkanMacros.h"
+#include "VulkanUtils.h"
+#include "VulkanCommandPool.h"
+
+namespace VR {
+namespace backend {
+
+// compute pipelines share one fixed layout, so a pipeline only depends on its shader module
+class VulkanComputePipelineCache : public CommandBufferObserver, NonCopyable {
+public:
+
+    struct DescriptorInfo {
+        VkDescriptorBufferInfo storageBuffers[STORAGE_BUFFER_BINDING_COUNT] = {};
+        VkDescriptorImageInfo storageImages[STORAGE_IMAGE_BINDING_COUNT] = {};
+        // images the bound views belong to
+        VkImage images[STORAGE_IMAGE_BINDING_COUNT] = {};
+    };
+
+    VulkanComputePipelineCache();
+    virtual ~VulkanComputePipelineCache();
+
+    void setDevice(VkDevice device) { mDevice = device; }
+
+    void bindStorageBuffer(uint32_t bindingIndex, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    void bindStorageImage(uint32_t bindingIndex, VkImage image, VkImageView imageView);
+    void bindPushConstants(const void* data, uint32_t size);
+    void unbindBuffer(VkBuffer buffer);
+    void unbindImage(VkImage image);
+    // binds the pipeline, descriptor sets and push constants of the next dispatch
+    void bindPipeline(VkCommandBuffer cmdbuffer, VkShaderModule shader);
+    // pipelines of a destroyed program stay alive until no command buffer in flight can use them
+    void retirePipeline(VkShaderModule shader);
+
+    void destroyCache();
+    void onCommandBuffer(const VulkanCommandBuffer& cmdbuffer) override;
+
+private:
+
+    void createLayouts();
+    VkDescriptorPool createDescriptorPool() const;
+    void allocateDescriptorSets(VkDescriptorSet descriptorSets[2]);
+
+    struct DescriptorPools {
+        std::vector<VkDescriptorPool> pools;
+        uint32_t current = 0;
+    };
+
+    VkDevice mDevice = VK_NULL_HANDLE;
+    DescriptorInfo mDescriptorInfo = {};
+    uint8_t mPushConstants[COMPUTE_PUSH_CONSTANT_SIZE] = {};
+    uint32_t mPushConstantSize = 0;
+
+    VkDescriptorSetLayout mDescriptorSetLayouts[2] = {};
+    VkPipelineLayout mPipelineLayout = VK_NULL_HANDLE;
+    std::unordered_map<VkShaderModule, VkPipeline> mPipelines;
+    // retired pipelines and the number of command buffers begun since
+    std::vector<std::pair<VkPipeline, uint32_t>> mRetiredPipelines;
+
+    // sets are never freed one by one, a slot's pools are reset once its command buffer is recycled
+    DescriptorPools mDescriptorPools[VK_MAX_COMMAND_BUFFERS] = {};
+    uint32_t mCmdBufferIndex = 0;
+    uint32_t mDescriptorPoolSize = 64;
+};
+
+} // namespace backend
+} // namespace VR
+
+#endif // VULKAN_COMPUTE_PIPELINE_CACHE_H
@@ -0,0 +1,23 @@
+#include "VulkanComputeProgram.h"
+
+namespace VR {
+namespace backend {
+
+VulkanComputeProgram::VulkanComputeProgram(VulkanContext& context, const void* spirv, size_t size, std::string programName) :
+        mContext(context), mName(programName) {
+    VR_ASSERT(spirv != nullptr && size != 0);
+
+    VkShaderModuleCreateInfo shaderModuleInfo = {};
+    shaderModuleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderModuleInfo.codeSize = size;
+    shaderModuleInfo.pCode = (const uint32_t*) spirv;
+    VkResult err = vkCreateShaderModule(mContext.device, &shaderModuleInfo, VKALLOC, &mShaderModule);
+    VR_VK_CHECK(err == VK_SUCCESS, "Create compute shader module failed.");
+}
+
+VulkanComputeProgram::~VulkanComputeProgram() {
+    DELETE_SHADER_MODULE(mContext.device, mShaderModule, VKALLOC);
+}
+
+} // namespace backend
+} // namespace VR
@@ -0,0 +1,27 @@
+#ifndef VULKAN_COMPUTE_PROGRAM_H
+#define VULKAN_COMPUTE_PROGRAM_H
+
+#include "VulkanContext.h"
+
+namespace VR {
+namespace backend {
+
+class VulkanComputeProgram : public NonCopyable {
+
+public:
+    // spirv: a compiled compute shader with a "main" entry point
+    VulkanComputeProgram(VulkanContext& context, const void* spirv, size_t size, std::string programName);
+    virtual ~VulkanComputeProgram();
+    VkShaderModule getShaderModule() const { return mShaderModule; }
+    std::string& getProgramName() { return mName; }
+
+private:
+    VulkanContext& mContext;
+    VkShaderModule mShaderModule = VK_NULL_HANDLE;
+    std::string mName;
+};
+
+} // namespace backend
+} // namespace VR
+
+#endif // VULKAN_COMPUTE_PROGRAM_H
@@ -66,6 +66,23 @@ void selectPhysicalDevice(VulkanContext& context) {
         }
         if (context.graphicsQueueFamilyIndex == 0xffff) continue;
 
+        // prefer a transfer-only family for uploads, then any other family that can copy,
+        // families with a coarse transfer granularity can't copy arbitrary mip levels
+        context.transferQueueFamilyIndex = context.graphicsQueueFamilyIndex;
+        const VkQueueFlags copyFlags = VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+        for (uint32_t j = 0; j < queueFamiliesCount; ++j) {
+            VkQueueFamilyProperties props = queueFamiliesProperties[j];
+            const VkExtent3D granularity = props.minImageTransferGranularity;
+            if (j == context.graphicsQueueFamilyIndex || props.queueCount == 0 || !(props.queueFlags & copyFlags) ||
+                    granularity.width != 1 || granularity.height != 1 || granularity.depth != 1) {
+                continue;
+            }
+            const bool transferOnly = !(props.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+            if (transferOnly || context.transferQueueFamilyIndex == context.graphicsQueueFamilyIndex) {
+                context.transferQueueFamilyIndex = j;
+            }
+        }
+
         // support the VK_KHR_swapchain
         uint32_t extensionCount;
         result = vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
@@ -76,7 +93,10 @@ void selectPhysicalDevice(VulkanContext& context) {
         VR_VK_CHECK(result == VK_SUCCESS, "vkEnumerateDeviceExtensionProperties error.");
         
         bool supportsSwapchain = false;
+        bool supportsTimelineSemaphore = false;
+        bool supportsDescriptorIndexing = false;
         context.debugMarkersSupported = false;
+        context.drawIndirectCountSupported = false;
         for (uint32_t k = 0; k < extensionCount; ++k) {
             if (!strcmp(extensions[k].extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME)) {
                 supportsSwapchain = true;
@@ -96,6 +116,15 @@ void selectPhysicalDevice(VulkanContext& context) {
             if (!strcmp(extensions[k].extensionName, VK_KHR_MAINTENANCE3_EXTENSION_NAME)) {
                 context.maintenanceSupported[2] = true;
             }
+            if (!strcmp(extensions[k].extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+                supportsTimelineSemaphore = true;
+            }
+            if (!strcmp(extensions[k].extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+                supportsDescriptorIndexing = true;
+            }
+            if (!strcmp(extensions[k].extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+                context.drawIndirectCountSupported = true;
+            }
         }
         if (!supportsSwapchain) continue;
 
@@ -115,13 +144,56 @@ void selectPhysicalDevice(VulkanContext& context) {
             VR_PRINT("Vulkan device driver: %s %s", driverProperties.driverName, driverProperties.driverInfo);
         }
 
+        context.timelineSemaphoreSupported = false;
+        if (supportsTimelineSemaphore && vkGetPhysicalDeviceFeatures2) {
+            VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+            };
+            VkPhysicalDeviceFeatures2 physicalDeviceFeatures2 = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &timelineSemaphoreFeatures,
+            };
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &physicalDeviceFeatures2);
+            context.timelineSemaphoreSupported = timelineSemaphoreFeatures.timelineSemaphore;
+        }
+
+        context.bindlessTextureCount = 0;
+        if (supportsDescriptorIndexing && context.maintenanceSupported[2] && vkGetPhysicalDeviceFeatures2 && vkGetPhysicalDeviceProperties2) {
+            VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
+            };
+            VkPhysicalDeviceFeatures2 physicalDeviceFeatures2 = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &indexingFeatures,
+            };
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &physicalDeviceFeatures2);
+            VkPhysicalDeviceDescriptorIndexingProperties indexingProperties = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES,
+            };
+            VkPhysicalDeviceProperties2 physicalDeviceProperties2 = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+                .pNext = &indexingProperties,
+            };
+            vkGetPhysicalDeviceProperties2(physicalDevice, &physicalDeviceProperties2);
+            if (indexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+                indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+                indexingFeatures.descriptorBindingUpdateUnusedWhilePending &&
+                indexingFeatures.descriptorBindingPartiallyBound &&
+                indexingFeatures.runtimeDescriptorArray) {
+                context.bindlessTextureCount = std::min({ (uint32_t) BINDLESS_TEXTURE_COUNT,
+                        indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+                        indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                        indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers });
+            }
+        }
+
         return;
     }
     VR_ERROR("Unable to find suitable device.");
 }
 
 void createLogicalDevice(VulkanContext& context) {
-    VkDeviceQueueCreateInfo deviceQueueCreateInfo[1] = {};
+    VkDeviceQueueCreateInfo deviceQueueCreateInfo[2] = {};
     const float queuePriority[] = {1.0f};
     VkDeviceCreateInfo deviceCreateInfo = {};
     std::vector<const char*> deviceExtensionNames = {
@@ -142,21 +214,37 @@ void createLogicalDevice(VulkanContext& context) {
     if (context.maintenanceSupported[2]) {
         deviceExtensionNames.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
     }
+    if (context.timelineSemaphoreSupported) {
+        deviceExtensionNames.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    }
+    if (context.bindlessTextureCount != 0) {
+        deviceExtensionNames.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    }
+    if (context.drawIndirectCountSupported) {
+        deviceExtensionNames.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
 
-    deviceQueueCreateInfo->sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    deviceQueueCreateInfo->queueFamilyIndex = context.graphicsQueueFamilyIndex;
-    deviceQueueCreateInfo->queueCount = 1;
-    deviceQueueCreateInfo->pQueuePriorities = &queuePriority[0];
+    deviceQueueCreateInfo[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    deviceQueueCreateInfo[0].queueFamilyIndex = context.graphicsQueueFamilyIndex;
+    deviceQueueCreateInfo[0].queueCount = 1;
+    deviceQueueCreateInfo[0].pQueuePriorities = &queuePriority[0];
+    deviceQueueCreateInfo[1] = deviceQueueCreateInfo[0];
+    deviceQueueCreateInfo[1].queueFamilyIndex = context.transferQueueFamilyIndex;
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.queueCreateInfoCount = 1;
+    deviceCreateInfo.queueCreateInfoCount = context.transferQueueFamilyIndex != context.graphicsQueueFamilyIndex ? 2 : 1;
     deviceCreateInfo.pQueueCreateInfos = deviceQueueCreateInfo;
 
     const auto& supportedFeatures = context.physicalDeviceFeatures;
     VkPhysicalDeviceFeatures enabledFeatures {
+        .multiDrawIndirect = supportedFeatures.multiDrawIndirect,
+        .drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance,
         .samplerAnisotropy = supportedFeatures.samplerAnisotropy,
         .textureCompressionETC2 = supportedFeatures.textureCompressionETC2,
         .textureCompressionBC = supportedFeatures.textureCompressionBC,
+        .pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery,
     };
+    context.pipelineStatisticsSupported = supportedFeatures.pipelineStatisticsQuery;
+    context.multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect;
 
     deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
     deviceCreateInfo.enabledExtensionCount = (uint32_t)deviceExtensionNames.size();
@@ -173,11 +261,37 @@ void createLogicalDevice(VulkanContext& context) {
     }
 #endif // VK_ENABLE_BETA_EXTENSIONS
 
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+        .pNext = nullptr,
+        .timelineSemaphore = VK_TRUE,
+    };
+    if (context.timelineSemaphoreSupported) {
+        timelineSemaphoreFeatures.pNext = const_cast<void*>(deviceCreateInfo.pNext);
+        deviceCreateInfo.pNext = &timelineSemaphoreFeatures;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
+        .pNext = nullptr,
+        .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+        .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+        .descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+        .descriptorBindingPartiallyBound = VK_TRUE,
+        .runtimeDescriptorArray = VK_TRUE,
+    };
+    if (context.bindlessTextureCount != 0) {
+        indexingFeatures.pNext = const_cast<void*>(deviceCreateInfo.pNext);
+        deviceCreateInfo.pNext = &indexingFeatures;
+    }
+
     VkResult result = vkCreateDevice(context.physicalDevice, &deviceCreateInfo, VKALLOC,
             &context.device);
     VR_VK_CHECK(result == VK_SUCCESS, "vkCreateDevice error.");
     vkGetDeviceQueue(context.device, context.graphicsQueueFamilyIndex, 0,
             &context.graphicsQueue);
+    vkGetDeviceQueue(context.device, context.transferQueueFamilyIndex, 0,
+            &context.transferQueue);
 
     VkCommandPoolCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -253,6 +367,7 @@ void waitForIdle(VulkanContext& context) {
     if (!context.device) {
         return;
     }
+    // flushes the upload pool as well, graphics work waits on it
     context.commandpool->flush();
     context.commandpool->wait();
 }
@@ -285,6 +400,11 @@ VkImageLayout getTextureLayout(TextureUsage usage) {
         return VK_IMAGE_LAYOUT_GENERAL;
     }
 
+    // storage images are written by compute and sampled by graphics
+    if (any(usage & TextureUsage::STORAGE)) {
+        return VK_IMAGE_LAYOUT_GENERAL;
+    }
+
     // for immutable textures: read-only.
     return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 }
@@ -39,6 +39,7 @@ struct VulkanRenderTarget;
 struct VulkanSwapChain;
 struct VulkanTexture;
 class VulkanMemoryPool;
+class VulkanFramebufferCache;
 
 struct VulkanAttachment {
     VkFormat format;
@@ -56,6 +57,8 @@ struct VulkanRenderPass {
     uint32_t subpassMask;
     int currentSubpass;
     VulkanTexture* depthFeedback;
+    VkFramebuffer framebuffer;
+    uint32_t workerCount;
 };
 
 struct VulkanContext {
@@ -68,10 +71,20 @@ struct VulkanContext {
     VkCommandPool commandPool;
     uint32_t graphicsQueueFamilyIndex;
     VkQueue graphicsQueue;
+    uint32_t transferQueueFamilyIndex;
+    VkQueue transferQueue;
     bool debugMarkersSupported;
     bool debugUtilsSupported;
     bool portabilitySubsetSupported;
     bool maintenanceSupported[3];
+    bool timelineSemaphoreSupported;
+    // VK_EXT_descriptor_indexing with update-after-bind sampled images, 0 when unsupported
+    uint32_t bindlessTextureCount;
+    // pipelineStatisticsQuery feature, enabled at device creation when present
+    bool pipelineStatisticsSupported;
+    // multiDrawIndirect feature and VK_KHR_draw_indirect_count, indirect draws loop one command at a time without them
+    bool multiDrawIndirectSupported;
+    bool drawIndirectCountSupported;
     VulkanPipelineCache::RasterState rasterState;
     VulkanSwapChain* currentSwapChain;
     VulkanRenderPass currentRenderPass;
@@ -80,6 +93,10 @@ struct VulkanContext {
     VmaAllocator allocator;
     VulkanTexture* emptyTexture = nullptr;
     VulkanCommandPool* commandpool = nullptr;
+    // staging copies on the transfer queue, null when it shares the graphics family
+    VulkanCommandPool* uploadpool = nullptr;
+    // purged of the views textures and swap chains destroy
+    VulkanFramebufferCache* framebufferCache = nullptr;
 };
 
 void selectPhysicalDevice(VulkanContext& context);
@@ -336,6 +336,7 @@ enum class TextureUsage : uint8_t {
     UPLOADABLE          = 0x8,                      
     SAMPLEABLE          = 0x10,                     
     SUBPASS_INPUT       = 0x20,                     
+    STORAGE             = 0x40,                     
     DEFAULT             = UPLOADABLE | SAMPLEABLE   
 };
 
@@ -518,6 +519,8 @@ enum class BlendFunction : uint8_t {
 struct Attribute {
     static constexpr uint8_t FLAG_NORMALIZED     = 0x1;
     static constexpr uint8_t FLAG_INTEGER_TARGET = 0x2;
+    // advances once per instance instead of once per vertex
+    static constexpr uint8_t FLAG_INSTANCE       = 0x4;
     static constexpr uint8_t BUFFER_UNUSED = 0xFF;
     uint32_t offset = 0;                   
     uint8_t stride = 0;                    
@@ -528,6 +531,13 @@ struct Attribute {
 
 using AttributeArray = std::array<Attribute, MAX_VERTEX_ATTRIBUTE_COUNT>;
 
+// one level of detail, a range of the primitive's index buffer
+struct MeshLod {
+    uint32_t offset; // first index
+    uint32_t count;
+    float error;     // deviation from the full mesh in object space units
+};
+
 enum ShaderType : uint8_t {
     VERTEX = 0,
     FRAGMENT = 1
@@ -612,6 +622,10 @@ struct RenderPassParams {
     double clearDepth = 1.0;
     uint32_t clearStencil = 0;
     uint32_t subpassMask = 0;
+    // threads recording the pass into secondary command buffers, 0 records inline
+    uint32_t workerCount = 0;
+    // gpu profiler scope, unnamed passes are reported by their order in the frame
+    const char* name = nullptr;
 };
 
 } // namespace backend
@@ -4,22 +4,77 @@
 namespace VR {
 namespace backend {
 
+static inline void hashCombine(size_t& hash, uint32_t value) {
+    hash = (hash ^ value) * 16777619u;
+}
+
+static inline void hashCombine(size_t& hash, uint64_t value) {
+    hashCombine(hash, uint32_t(value));
+    hashCombine(hash, uint32_t(value >> 32));
+}
+
+size_t VulkanFramebufferCache::RenderPassInfoHash::operator()(const RenderPassInfo& info) const {
+    // FNV-1a over every field
+    size_t hash = 2166136261u;
+    for (int i = 0; i < MAX_SUPPORTED_RENDER_TARGET_COUNT; i++) {
+        hashCombine(hash, uint32_t(info.colorLayout[i]));
+        hashCombine(hash, uint32_t(info.colorFormat[i]));
+    }
+    hashCombine(hash, uint32_t(info.depthLayout));
+    hashCombine(hash, uint32_t(info.depthFormat));
+    hashCombine(hash, uint32_t(info.clear));
+    hashCombine(hash, uint32_t(info.discardStart));
+    hashCombine(hash, uint32_t(info.discardEnd));
+    hashCombine(hash, uint32_t(info.samples) | uint32_t(info.needsResolveMask) << 8 | uint32_t(info.subpassMask) << 16);
+    return hash;
+}
+
+bool VulkanFramebufferCache::RenderPassInfoEqual::operator()(const RenderPassInfo& a, const RenderPassInfo& b) const {
+    for (int i = 0; i < MAX_SUPPORTED_RENDER_TARGET_COUNT; i++) {
+        if (a.colorLayout[i] != b.colorLayout[i] || a.colorFormat[i] != b.colorFormat[i]) {
+            return false;
+        }
+    }
+    return a.depthLayout == b.depthLayout && a.depthFormat == b.depthFormat && a.clear == b.clear &&
+           a.discardStart == b.discardStart && a.discardEnd == b.discardEnd && a.samples == b.samples &&
+           a.needsResolveMask == b.needsResolveMask && a.subpassMask == b.subpassMask;
+}
+
+size_t VulkanFramebufferCache::FrameBufferInfoHash::operator()(const FrameBufferInfo& info) const {
+    size_t hash = 2166136261u;
+    hashCombine(hash, uint64_t(info.renderPass));
+    hashCombine(hash, uint32_t(info.width) | uint32_t(info.height) << 16);
+    hashCombine(hash, uint32_t(info.layers) | uint32_t(info.samples) << 16);
+    for (int i = 0; i < MAX_SUPPORTED_RENDER_TARGET_COUNT; i++) {
+        hashCombine(hash, uint64_t(info.color[i]));
+        hashCombine(hash, uint64_t(info.resolve[i]));
+    }
+    hashCombine(hash, uint64_t(info.depth));
+    return hash;
+}
+
+bool VulkanFramebufferCache::FrameBufferInfoEqual::operator()(const FrameBufferInfo& a, const FrameBufferInfo& b) const {
+    for (int i = 0; i < MAX_SUPPORTED_RENDER_TARGET_COUNT; i++) {
+        if (a.color[i] != b.color[i] || a.resolve[i] != b.resolve[i]) {
+            return false;
+        }
+    }
+    return a.renderPass == b.renderPass && a.width == b.width && a.height == b.height && a.layers == b.layers &&
+           a.samples == b.samples && a.depth == b.depth;
+}
+
 VulkanFramebufferCache::VulkanFramebufferCache(VulkanContext& context) : mContext(context) {
-    mRenderPasses.resize(VK_MAX_COMMAND_BUFFERS);
-    mFramebuffers.resize(VK_MAX_COMMAND_BUFFERS);
 }
 
 VulkanFramebufferCache::~VulkanFramebufferCache() {
     // Do nothing
 }
 
-VkFramebuffer VulkanFramebufferCache::getFramebuffer(const FrameBufferInfo& fboInfo, uint32_t swapchainIndex) {
-    if (mFramebuffers.size() < VK_MAX_COMMAND_BUFFERS) {
-        mFramebuffers.resize(VK_MAX_COMMAND_BUFFERS);
-    }
-    
-    if (mFramebuffers[swapchainIndex] != VK_NULL_HANDLE) {
-        return mFramebuffers[swapchainIndex];
+VkFramebuffer VulkanFramebufferCache::getFramebuffer(const FrameBufferInfo& fboInfo) {
+    auto iter = mFramebuffers.find(fboInfo);
+    if (iter != mFramebuffers.end()) {
+        iter->second.lastUsed = mCurrentTime;
+        return iter->second.handle;
     }
     // color attachments, resolve attachments, and depth attachment
     VkImageView attachments[MAX_SUPPORTED_RENDER_TARGET_COUNT + MAX_SUPPORTED_RENDER_TARGET_COUNT + 1];
@@ -53,19 +108,56 @@ VkFramebuffer VulkanFramebufferCache::getFramebuffer(const FrameBufferInfo& fboI
     VkResult error = vkCreateFramebuffer(mContext.device, &info, VKALLOC, &framebuffer);
     VR_VK_ASSERT(error == VK_SUCCESS, "Unable to create framebuffer.");
     
-    mFramebuffers[swapchainIndex] = framebuffer;
+    FramebufferEntry entry = {
+        .handle = framebuffer,
+        .lastUsed = mCurrentTime,
+    };
+    mFramebuffers.emplace(fboInfo, entry);
     return framebuffer;
 }
 
-VkRenderPass VulkanFramebufferCache::getRenderPass(const RenderPassInfo& renderPassInfo, uint32_t swapchainIndex) {
-    if (mRenderPasses.size() < VK_MAX_COMMAND_BUFFERS) {
-        mRenderPasses.resize(VK_MAX_COMMAND_BUFFERS);
+void VulkanFramebufferCache::destroyFramebuffer(VkRenderPass renderPass, VkFramebuffer framebuffer) {
+    vkDestroyFramebuffer(mContext.device, framebuffer, VKALLOC);
+    auto refCount = mRenderPassRefCount.find(renderPass);
+    if (refCount != mRenderPassRefCount.end() && refCount->second > 0) {
+        refCount->second--;
     }
-    
-    if (mRenderPasses[swapchainIndex] != VK_NULL_HANDLE) {
-        return mRenderPasses[swapchainIndex];
+}
+
+void VulkanFramebufferCache::purge(VkImageView imageView) {
+    if (imageView == VK_NULL_HANDLE) {
+        return;
     }
+    for (auto iter = mFramebuffers.begin(); iter != mFramebuffers.end();) {
+        const FrameBufferInfo& info = iter->first;
+        bool attached = info.depth == imageView;
+        for (int i = 0; i < MAX_SUPPORTED_RENDER_TARGET_COUNT && !attached; i++) {
+            attached = info.color[i] == imageView || info.resolve[i] == imageView;
+        }
+        if (attached) {
+            destroyFramebuffer(info.renderPass, iter->second.handle);
+            iter = mFramebuffers.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
 
+VkRenderPass VulkanFramebufferCache::getRenderPass(const RenderPassInfo& renderPassInfo) {
+    auto iter = mRenderPasses.find(renderPassInfo);
+    if (iter != mRenderPasses.end()) {
+        iter->second.lastUsed = mCurrentTime;
+        return iter->second.handle;
+    }
+    RenderPassEntry entry = {
+        .handle = createRenderPass(renderPassInfo),
+        .lastUsed = mCurrentTime,
+    };
+    mRenderPasses.emplace(renderPassInfo, entry);
+    return entry.handle;
+}
+
+VkRenderPass VulkanFramebufferCache::createRenderPass(const RenderPassInfo& renderPassInfo) {
     const bool isPresent = renderPassInfo.colorLayout[0] == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
     const bool hasSubpasses = renderPassInfo.subpassMask != 0;
 
@@ -245,29 +337,52 @@ VkRenderPass VulkanFramebufferCache::getRenderPass(const RenderPassInfo& renderP
     VkRenderPass renderPass;
     VkResult error = vkCreateRenderPass(mContext.device, &renderPassCreateInfo, VKALLOC, &renderPass);
     VR_VK_ASSERT(error == VK_SUCCESS, "Unable to create render pass.");
-    
-    mRenderPasses[swapchainIndex] = renderPass;
     return renderPass;
 }
 
 void VulkanFramebufferCache::reset() {
     for (auto& framebuffer : mFramebuffers) {
-        vkDestroyFramebuffer(mContext.device, framebuffer, VKALLOC);
+        vkDestroyFramebuffer(mContext.device, framebuffer.second.handle, VKALLOC);
     }
     mFramebuffers.clear();
+    mRenderPassRefCount.clear();
     
-    for (auto& renderpass  : mRenderPasses) {
-        vkDestroyRenderPass(mContext.device, renderpass, VKALLOC);
+    for (auto& renderPass : mRenderPasses) {
+        vkDestroyRenderPass(mContext.device, renderPass.second.handle, VKALLOC);
     }
     mRenderPasses.clear();
 }
 
-void VulkanFramebufferCache::gc() {
+void VulkanFramebufferCache::gc(VulkanPipelineCache& pipelineCache) {
     if (++mCurrentTime <= VK_MAX_COMMAND_BUFFERS) {
         return;
     }
-    // TODO
-    return;
+    // least recently used framebuffers first, their render passes may then go in the same collection
+    for (auto iter = mFramebuffers.begin(); iter != mFramebuffers.end();) {
+        if (mCurrentTime - iter->second.lastUsed > VK_MAX_FRAMEBUFFER_AGE) {
+            destroyFramebuffer(iter->first.renderPass, iter->second.handle);
+            iter = mFramebuffers.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    // unused for longer than any command buffer can be in flight and without framebuffers
+    for (auto iter = mRenderPasses.begin(); iter != mRenderPasses.end();) {
+        const VkRenderPass handle = iter->second.handle;
+        auto refCount = mRenderPassRefCount.find(handle);
+        if (mCurrentTime - iter->second.lastUsed > VK_MAX_RENDER_PASS_AGE &&
+                (refCount == mRenderPassRefCount.end() || refCount->second == 0)) {
+            // no command buffer in flight uses the pass, nor any pipeline created for it
+            pipelineCache.purgeRenderPass(handle);
+            vkDestroyRenderPass(mContext.device, handle, VKALLOC);
+            if (refCount != mRenderPassRefCount.end()) {
+                mRenderPassRefCount.erase(refCount);
+            }
+            iter = mRenderPasses.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
 }
 
 } // namespace backend
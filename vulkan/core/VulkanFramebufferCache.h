@@ -3,7 +3,9 @@
 
 #include <map>
 #include <string>
+#include <unordered_map>
 #include "VulkanContext.h"
+#include "VulkanPipelineCache.h"
 
 namespace VR {
 namespace backend {
@@ -41,21 +43,56 @@ public:
         VkImageView depth;
     };
 
+    struct RenderPassInfoHash {
+        size_t operator()(const RenderPassInfo& info) const;
+    };
+
+    struct RenderPassInfoEqual {
+        bool operator()(const RenderPassInfo& a, const RenderPassInfo& b) const;
+    };
+
+    struct FrameBufferInfoHash {
+        size_t operator()(const FrameBufferInfo& info) const;
+    };
+
+    struct FrameBufferInfoEqual {
+        bool operator()(const FrameBufferInfo& a, const FrameBufferInfo& b) const;
+    };
+
     VulkanFramebufferCache(VulkanContext& context);
     virtual ~VulkanFramebufferCache();
 
-    VkFramebuffer getFramebuffer(const FrameBufferInfo& fboInfo, uint32_t swapchainIndex);
-    VkRenderPass getRenderPass(const RenderPassInfo& fboInfo, uint32_t swapchainIndex);
-    void gc();
+    VkFramebuffer getFramebuffer(const FrameBufferInfo& fboInfo);
+    VkRenderPass getRenderPass(const RenderPassInfo& renderPassInfo);
+    // destroys the framebuffers attaching imageView, call before the view is destroyed
+    void purge(VkImageView imageView);
+    // pipelines of evicted render passes are purged from pipelineCache
+    void gc(VulkanPipelineCache& pipelineCache);
     void reset();
 
 private:
+    struct RenderPassEntry {
+        VkRenderPass handle;
+        uint32_t lastUsed;
+    };
+
+    struct FramebufferEntry {
+        VkFramebuffer handle;
+        uint32_t lastUsed;
+    };
+
+    void destroyFramebuffer(VkRenderPass renderPass, VkFramebuffer framebuffer);
+
+    VkRenderPass createRenderPass(const RenderPassInfo& renderPassInfo);
+
     VulkanContext& mContext;
+    // framebuffers created with each render pass, a referenced render pass is never evicted
     std::map<VkRenderPass, uint32_t> mRenderPassRefCount;
     uint32_t mCurrentTime = 0;
     
-    std::vector<VkFramebuffer> mFramebuffers;
-    std::vector<VkRenderPass> mRenderPasses;
+    std::unordered_map<FrameBufferInfo, FramebufferEntry, FrameBufferInfoHash, FrameBufferInfoEqual> mFramebuffers;
+    // hashed and compared field by field, the padding of RenderPassInfo is not initialized
+    std::unordered_map<RenderPassInfo, RenderPassEntry, RenderPassInfoHash, RenderPassInfoEqual> mRenderPasses;
     
 };
 
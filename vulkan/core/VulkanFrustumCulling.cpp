@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cstring>
+#include "VulkanFrustumCulling.h"
+#include "VulkanMacros.h"
+#include "VulkanTrace.h"
+
+#include <glm/gtc/matrix_access.hpp>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define VR_CULL_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VR_CULL_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VR_CULL_NEON 1
+#endif
+
+namespace VR {
+namespace backend {
+
+// all SoA arrays are padded to this many floats so the SIMD loops never read past the end
+static constexpr uint32_t PADDING = 8;
+
+VulkanFrustumCulling::VulkanFrustumCulling(uint32_t workerCount) : mNextChunk(0) {
+    if (workerCount == 0) {
+        const uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+    for (uint32_t i = 0; i < workerCount; i++) {
+        mWorkers.push_back(std::thread(&VulkanFrustumCulling::workerLoop, this));
+    }
+}
+
+VulkanFrustumCulling::~VulkanFrustumCulling() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExit = true;
+    }
+    mCondition.notify_all();
+    for (std::thread& worker : mWorkers) {
+        worker.join();
+    }
+}
+
+VulkanFrustumCulling::Frustum VulkanFrustumCulling::extractFrustum(const glm::mat4& viewProjection) {
+    const glm::vec4 row0 = glm::row(viewProjection, 0);
+    const glm::vec4 row1 = glm::row(viewProjection, 1);
+    const glm::vec4 row2 = glm::row(viewProjection, 2);
+    const glm::vec4 row3 = glm::row(viewProjection, 3);
+    Frustum frustum = {{
+        row3 + row0,
+        row3 - row0,
+        row3 + row1,
+        row3 - row1,
+        row2,
+        row3 - row2,
+    }};
+    for (glm::vec4& plane : frustum.planes) {
+        const float length = glm::length(glm::vec3(plane));
+        if (length > 0.0f) {
+            plane /= length;
+        }
+    }
+    return frustum;
+}
+
+uint32_t VulkanFrustumCulling::addSphere(const glm::vec3& center, float radius) {
+    const uint32_t index = mCount++;
+    const size_t padded = (mCount + PADDING - 1) / PADDING * PADDING;
+    if (mRadius.size() < padded) {
+        mCenterX.resize(padded, 0.0f);
+        mCenterY.resize(padded, 0.0f);
+        mCenterZ.resize(padded, 0.0f);
+        mRadius.resize(padded, 0.0f);
+    }
+    setSphere(index, center, radius);
+    return index;
+}
+
+void VulkanFrustumCulling::setSphere(uint32_t index, const glm::vec3& center, float radius) {
+    VR_ASSERT(index < mCount);
+    mCenterX[index] = center.x;
+    mCenterY[index] = center.y;
+    mCenterZ[index] = center.z;
+    mRadius[index] = radius;
+}
+
+void VulkanFrustumCulling::clear() {
+    mCenterX.clear();
+    mCenterY.clear();
+    mCenterZ.clear();
+    mRadius.clear();
+    mCount = 0;
+}
+
+void VulkanFrustumCulling::cull(const glm::mat4& viewProjection, std::vector<uint32_t>& visible) {
+    cull(extractFrustum(viewProjection), visible);
+}
+
+void VulkanFrustumCulling::cull(const Frustum& frustum, std::vector<uint32_t>& visible) {
+    VR_TRACE_SCOPE("VulkanFrustumCulling::cull");
+    visible.clear();
+    if (mCount == 0) {
+        return;
+    }
+    mFrustum = frustum;
+    mChunkCount = (mCount + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    // padded like the SoA arrays, the SIMD loops store one slot past the last visible sphere
+    mChunkIndices.resize(mRadius.size());
+    mChunkVisible.assign(mChunkCount, 0);
+    mNextChunk.store(0, std::memory_order_relaxed);
+
+    // small sets are not worth waking the workers
+    if (mChunkCount == 1 || mWorkers.empty()) {
+        runChunks();
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mGeneration++;
+            mBusyWorkers = (uint32_t) mWorkers.size();
+        }
+        mCondition.notify_all();
+        runChunks();
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDoneCondition.wait(lock, [this]() { return mBusyWorkers == 0; });
+    }
+
+    // chunks wrote into their own range, compact them in order
+    uint32_t visibleCount = 0;
+    for (uint32_t chunk = 0; chunk < mChunkCount; chunk++) {
+        visibleCount += mChunkVisible[chunk];
+    }
+    visible.resize(visibleCount);
+    uint32_t* out = visible.data();
+    for (uint32_t chunk = 0; chunk < mChunkCount; chunk++) {
+        memcpy(out, mChunkIndices.data() + chunk * CHUNK_SIZE, mChunkVisible[chunk] * sizeof(uint32_t));
+        out += mChunkVisible[chunk];
+    }
+}
+
+void VulkanFrustumCulling::runChunks() {
+    for (;;) {
+        const uint32_t chunk = mNextChunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= mChunkCount) {
+            return;
+        }
+        const uint32_t begin = chunk * CHUNK_SIZE;
+        const uint32_t end = std::min(begin + CHUNK_SIZE, mCount);
+        mChunkVisible[chunk] = cullRange(begin, end, mChunkIndices.data() + begin);
+    }
+}
+
+void VulkanFrustumCulling::workerLoop() {
+    uint64_t generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this, generation]() { return mExit || mGeneration != generation; });
+            if (mExit) {
+                return;
+            }
+            generation = mGeneration;
+        }
+        runChunks();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mBusyWorkers--;
+        }
+        mDoneCondition.notify_one();
+    }
+}
+
+uint32_t VulkanFrustumCulling::cullRange(uint32_t begin, uint32_t end, uint32_t* out) const {
+    const float* cx = mCenterX.data();
+    const float* cy = mCenterY.data();
+    const float* cz = mCenterZ.data();
+    const float* cr = mRadius.data();
+    const glm::vec4* planes = mFrustum.planes;
+    uint32_t count = 0;
+
+    // a sphere is outside once it is entirely behind one plane: dot(plane, center) < -radius
+#if defined(VR_CULL_AVX)
+    for (uint32_t i = begin; i < end; i += 8) {
+        const __m256 x = _mm256_loadu_ps(cx + i);
+        const __m256 y = _mm256_loadu_ps(cy + i);
+        const __m256 z = _mm256_loadu_ps(cz + i);
+        const __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(cr + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (uint32_t p = 0; p < 6; p++) {
+            __m256 d = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(planes[p].x)), _mm256_set1_ps(planes[p].w));
+            d = _mm256_add_ps(d, _mm256_mul_ps(y, _mm256_set1_ps(planes[p].y)));
+            d = _mm256_add_ps(d, _mm256_mul_ps(z, _mm256_set1_ps(planes[p].z)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negRadius, _CMP_GE_OQ));
+        }
+        const uint32_t mask = (uint32_t) _mm256_movemask_ps(inside);
+        // branch-free append, the slot of a culled sphere is overwritten by the next visible one
+        for (uint32_t lane = 0; lane < 8; lane++) {
+            out[count] = i + lane;
+            count += ((mask >> lane) & 1) & (i + lane < end ? 1 : 0);
+        }
+    }
+#elif defined(VR_CULL_SSE)
+    for (uint32_t i = begin; i < end; i += 4) {
+        const __m128 x = _mm_loadu_ps(cx + i);
+        const __m128 y = _mm_loadu_ps(cy + i);
+        const __m128 z = _mm_loadu_ps(cz + i);
+        const __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(cr + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (uint32_t p = 0; p < 6; p++) {
+            __m128 d = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p].x)), _mm_set1_ps(planes[p].w));
+            d = _mm_add_ps(d, _mm_mul_ps(y, _mm_set1_ps(planes[p].y)));
+            d = _mm_add_ps(d, _mm_mul_ps(z, _mm_set1_ps(planes[p].z)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negRadius));
+        }
+        const uint32_t mask = (uint32_t) _mm_movemask_ps(inside);
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            out[count] = i + lane;
+            count += ((mask >> lane) & 1) & (i + lane < end ? 1 : 0);
+        }
+    }
+#elif defined(VR_CULL_NEON)
+    for (uint32_t i = begin; i < end; i += 4) {
+        const float32x4_t x = vld1q_f32(cx + i);
+        const float32x4_t y = vld1q_f32(cy + i);
+        const float32x4_t z = vld1q_f32(cz + i);
+        const float32x4_t negRadius = vnegq_f32(vld1q_f32(cr + i));
+        uint32x4_t inside = vdupq_n_u32(0xFFFFFFFFu);
+        for (uint32_t p = 0; p < 6; p++) {
+            float32x4_t d = vmlaq_n_f32(vdupq_n_f32(planes[p].w), x, planes[p].x);
+            d = vmlaq_n_f32(d, y, planes[p].y);
+            d = vmlaq_n_f32(d, z, planes[p].z);
+            inside = vandq_u32(inside, vcgeq_f32(d, negRadius));
+        }
+        const uint32_t lanes[4] = {
+            vgetq_lane_u32(inside, 0) & 1, vgetq_lane_u32(inside, 1) & 1,
+            vgetq_lane_u32(inside, 2) & 1, vgetq_lane_u32(inside, 3) & 1,
+        };
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            out[count] = i + lane;
+            count += lanes[lane] & (i + lane < end ? 1 : 0);
+        }
+    }
+#else
+    for (uint32_t i = begin; i < end; i++) {
+        bool inside = true;
+        for (uint32_t p = 0; p < 6 && inside; p++) {
+            const float d = planes[p].x * cx[i] + planes[p].y * cy[i] + planes[p].z * cz[i] + planes[p].w;
+            inside = d >= -cr[i];
+        }
+        out[count] = i;
+        count += inside ? 1 : 0;
+    }
+#endif
+    return count;
+}
+
+} // namespace backend
+} // namespace VR
@@ -0,0 +1,75 @@
+#ifndef VULKAN_FRUSTUM_CULLING_H
+#define VULKAN_FRUSTUM_CULLING_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "NonCopyable.h"
+
+namespace VR {
+namespace backend {
+
+// bounding spheres culled against the view frustum on the CPU. Bounds live in SoA arrays tested 8 (AVX)
+// or 4 (SSE, NEON) at a time, large sets are split into chunks shared by a small worker pool.
+// The visible list holds sphere indices in increasing order, e.g. to push the matching draws to a VulkanRenderQueue.
+class VulkanFrustumCulling : public NonCopyable {
+public:
+
+    // inward facing, normalized, for a view projection with depth in [0, 1]
+    struct Frustum {
+        glm::vec4 planes[6];
+    };
+
+    // workerCount threads help the calling thread, 0 picks one less than the hardware threads
+    explicit VulkanFrustumCulling(uint32_t workerCount = 0);
+    virtual ~VulkanFrustumCulling();
+
+    static Frustum extractFrustum(const glm::mat4& viewProjection);
+
+    uint32_t addSphere(const glm::vec3& center, float radius);
+    void setSphere(uint32_t index, const glm::vec3& center, float radius);
+    void clear();
+    uint32_t size() const { return mCount; }
+
+    void cull(const glm::mat4& viewProjection, std::vector<uint32_t>& visible);
+    void cull(const Frustum& frustum, std::vector<uint32_t>& visible);
+
+private:
+
+    // spheres per job, a multiple of the SIMD width
+    static constexpr uint32_t CHUNK_SIZE = 16384;
+
+    // writes the visible indices of [begin, end) to out, returns how many
+    uint32_t cullRange(uint32_t begin, uint32_t end, uint32_t* out) const;
+    void runChunks();
+    void workerLoop();
+
+    std::vector<float> mCenterX;
+    std::vector<float> mCenterY;
+    std::vector<float> mCenterZ;
+    std::vector<float> mRadius;
+    uint32_t mCount = 0;
+
+    // state of the cull in progress
+    Frustum mFrustum = {};
+    uint32_t mChunkCount = 0;
+    std::atomic<uint32_t> mNextChunk;
+    std::vector<uint32_t> mChunkIndices;
+    std::vector<uint32_t> mChunkVisible;
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::condition_variable mDoneCondition;
+    uint64_t mGeneration = 0;
+    uint32_t mBusyWorkers = 0;
+    bool mExit = false;
+};
+
+} // namespace backend
+} // namespace VR
+
+#endif // VULKAN_FRUSTUM_CULLING_H
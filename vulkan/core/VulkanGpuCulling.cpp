@@ -0,0 +1,195 @@
+#include <cmath>
+#include "VulkanGpuCulling.h"
+
+namespace VR {
+namespace backend {
+
+struct HiZReduceConstants {
+    uint32_t size[2];
+    uint32_t format;
+};
+
+struct HiZDownsampleConstants {
+    uint32_t srcSize[2];
+    uint32_t dstSize[2];
+    uint32_t srcOffset;
+    uint32_t dstOffset;
+};
+
+// format selector of hiz_reduce.comp and the bytes per texel of the copied depth
+static uint32_t getDepthCopyFormat(VkFormat format, uint32_t* bytes) {
+    switch (format) {
+        case VK_FORMAT_D32_SFLOAT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            *bytes = 4;
+            return 0;
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+            *bytes = 4;
+            return 1;
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+            *bytes = 2;
+            return 2;
+        default:
+            VR_ERROR("Unsupported depth format for hi-z.\n");
+            *bytes = 4;
+            return 0;
+    }
+}
+
+static uint32_t groupCount(uint32_t size, uint32_t groupSize) {
+    return (size + groupSize - 1) / groupSize;
+}
+
+VulkanGpuCulling::VulkanGpuCulling(VulkanRuntime& runtime, const Shaders& shaders) : mRuntime(runtime) {
+    std::string name = "hiz_reduce";
+    mRuntime.createComputeProgram(mReduceProgram, shaders.hizReduce, shaders.hizReduceSize, name);
+    name = "hiz_downsample";
+    mRuntime.createComputeProgram(mDownsampleProgram, shaders.hizDownsample, shaders.hizDownsampleSize, name);
+    name = "cull";
+    mRuntime.createComputeProgram(mCullProgram, shaders.cull, shaders.cullSize, name);
+    mRuntime.createBufferObject(mParams, sizeof(CullParams));
+}
+
+VulkanGpuCulling::~VulkanGpuCulling() {
+    mRuntime.destroyComputeProgram(mReduceProgram);
+    mRuntime.destroyComputeProgram(mDownsampleProgram);
+    mRuntime.destroyComputeProgram(mCullProgram);
+    mRuntime.destroyBufferObject(mDepthCopy);
+    mRuntime.destroyBufferObject(mPyramid);
+    mRuntime.destroyBufferObject(mParams);
+}
+
+void VulkanGpuCulling::resize(uint32_t width, uint32_t height, uint32_t depthBytes) {
+    if (width == mWidth && height == mHeight && depthBytes == mDepthBytes) {
+        return;
+    }
+    // the old buffers may still be read by frames in flight
+    if (mPyramid != nullptr) {
+        mRuntime.finish();
+    }
+    mRuntime.destroyBufferObject(mDepthCopy);
+    mRuntime.destroyBufferObject(mPyramid);
+
+    mWidth = width;
+    mHeight = height;
+    mDepthBytes = depthBytes;
+    mLevelCount = 0;
+    uint32_t texelCount = 0;
+    uint32_t levelWidth = width;
+    uint32_t levelHeight = height;
+    while (mLevelCount < MAX_LEVEL_COUNT) {
+        mLevelOffsets[mLevelCount++] = texelCount;
+        texelCount += levelWidth * levelHeight;
+        if (levelWidth == 1 && levelHeight == 1) {
+            break;
+        }
+        levelWidth = std::max(levelWidth / 2, 1u);
+        levelHeight = std::max(levelHeight / 2, 1u);
+    }
+
+    mRuntime.createBufferObject(mDepthCopy, (width * height * depthBytes + 3) & ~3u);
+    mRuntime.createBufferObject(mPyramid, texelCount * sizeof(float));
+    mPyramidValid = false;
+}
+
+void VulkanGpuCulling::buildHiZ(VulkanRenderTarget* renderTarget) {
+    VR_TRACE_SCOPE("VulkanGpuCulling::buildHiZ");
+    VR_ASSERT(renderTarget != nullptr);
+    const VkExtent2D extent = renderTarget->getRenderTargetSize();
+    uint32_t depthBytes = 0;
+    const uint32_t format = getDepthCopyFormat(renderTarget->getDepthAttachment().format, &depthBytes);
+    resize(extent.width, extent.height, depthBytes);
+
+    mRuntime.beginGpuScope("HiZ");
+    mRuntime.copyDepthToBufferObject(renderTarget, mDepthCopy);
+
+    HiZReduceConstants reduce = {
+        .size = { mWidth, mHeight },
+        .format = format,
+    };
+    mRuntime.bindStorageBuffer(0, mDepthCopy);
+    mRuntime.bindStorageBuffer(1, mPyramid);
+    mRuntime.setComputeConstants(&reduce, sizeof(reduce));
+    mRuntime.dispatch(mReduceProgram, groupCount(mWidth, 8), groupCount(mHeight, 8), 1);
+
+    mRuntime.bindStorageBuffer(0, mPyramid);
+    uint32_t srcWidth = mWidth;
+    uint32_t srcHeight = mHeight;
+    for (uint32_t level = 1; level < mLevelCount; level++) {
+        HiZDownsampleConstants downsample = {
+            .srcSize = { srcWidth, srcHeight },
+            .dstSize = { std::max(srcWidth / 2, 1u), std::max(srcHeight / 2, 1u) },
+            .srcOffset = mLevelOffsets[level - 1],
+            .dstOffset = mLevelOffsets[level],
+        };
+        mRuntime.setComputeConstants(&downsample, sizeof(downsample));
+        mRuntime.dispatch(mDownsampleProgram, groupCount(downsample.dstSize[0], 8), groupCount(downsample.dstSize[1], 8), 1);
+        srcWidth = downsample.dstSize[0];
+        srcHeight = downsample.dstSize[1];
+    }
+    mRuntime.endGpuScope();
+    mPyramidValid = true;
+}
+
+void VulkanGpuCulling::cull(VulkanBufferObject* instances, uint32_t instanceCount, const float viewProjection[16],
+        VulkanBufferObject* commands, VulkanBufferObject* drawCount, bool occlusion) {
+    VR_TRACE_SCOPE("VulkanGpuCulling::cull");
+    VR_ASSERT(instances != nullptr && commands != nullptr && drawCount != nullptr);
+    VR_VK_ASSERT(commands->byteCount >= instanceCount * sizeof(VkDrawIndexedIndirectCommand), "Indirect command buffer is too small.");
+
+    CullParams params = {};
+    memcpy(params.viewProjection, viewProjection, sizeof(params.viewProjection));
+    // rows of the column-major matrix give the planes, pointing inwards, depth in [0, 1]
+    const float* m = viewProjection;
+    const float rows[4][4] = {
+        { m[0], m[4], m[8], m[12] },
+        { m[1], m[5], m[9], m[13] },
+        { m[2], m[6], m[10], m[14] },
+        { m[3], m[7], m[11], m[15] },
+    };
+    for (uint32_t i = 0; i < 4; i++) {
+        params.planes[0][i] = rows[3][i] + rows[0][i];
+        params.planes[1][i] = rows[3][i] - rows[0][i];
+        params.planes[2][i] = rows[3][i] + rows[1][i];
+        params.planes[3][i] = rows[3][i] - rows[1][i];
+        params.planes[4][i] = rows[2][i];
+        params.planes[5][i] = rows[3][i] - rows[2][i];
+    }
+    for (uint32_t p = 0; p < 6; p++) {
+        float* plane = params.planes[p];
+        const float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (length > 0.0f) {
+            for (uint32_t i = 0; i < 4; i++) {
+                plane[i] /= length;
+            }
+        }
+    }
+    const bool testOcclusion = occlusion && mPyramidValid;
+    memcpy(params.levelOffsets, mLevelOffsets, sizeof(params.levelOffsets));
+    params.pyramidSize[0] = mWidth;
+    params.pyramidSize[1] = mHeight;
+    params.levelCount = testOcclusion ? mLevelCount : 0;
+    params.instanceCount = instanceCount;
+
+    BufferDescriptor data(&params, sizeof(params));
+    mRuntime.updateBufferObject(mParams, data, 0);
+    mRuntime.fillBufferObject(drawCount, 0, sizeof(uint32_t), 0);
+    // without drawIndirectCount all instanceCount commands are drawn, the ones past the visible
+    // count must not replay last frame's draws
+    if (instanceCount != 0) {
+        mRuntime.fillBufferObject(commands, 0, instanceCount * sizeof(VkDrawIndexedIndirectCommand), 0);
+    }
+
+    mRuntime.bindStorageBuffer(0, mParams);
+    mRuntime.bindStorageBuffer(1, instances);
+    // the shader skips the pyramid when levelCount is 0, any buffer keeps the binding valid
+    mRuntime.bindStorageBuffer(2, testOcclusion ? mPyramid : mParams);
+    mRuntime.bindStorageBuffer(3, commands);
+    mRuntime.bindStorageBuffer(4, drawCount);
+    mRuntime.dispatch(mCullProgram, groupCount(instanceCount, 64), 1, 1);
+}
+
+} // namespace backend
+} // namespace VR
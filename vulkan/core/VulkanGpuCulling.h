@@ -0,0 +1,82 @@
+#ifndef VULKAN_GPU_CULLING_H
+#define VULKAN_GPU_CULLING_H
+
+#include "VulkanRuntime.h"
+
+namespace VR {
+namespace backend {
+
+// frustum and occlusion culling in compute. The depth of a frame is reduced into a hi-z pyramid that
+// the next frame's cull tests bounding spheres against, visible instances become compacted indirect
+// draw commands plus a count for VulkanRuntime::drawIndirect. Everything is recorded outside render passes.
+class VulkanGpuCulling : public NonCopyable {
+public:
+
+    // SPIR-V from shaders/spirvs/hiz_reduce_comp.spv, hiz_downsample_comp.spv and cull_comp.spv
+    struct Shaders {
+        const void* hizReduce;
+        size_t hizReduceSize;
+        const void* hizDownsample;
+        size_t hizDownsampleSize;
+        const void* cull;
+        size_t cullSize;
+    };
+
+    // std430 layout of Instance in cull.comp
+    struct Instance {
+        float center[3];
+        float radius;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        int32_t vertexOffset;
+        uint32_t padding;
+    };
+
+    VulkanGpuCulling(VulkanRuntime& runtime, const Shaders& shaders);
+    virtual ~VulkanGpuCulling();
+
+    // reduces the offscreen target's depth into the pyramid, call after the frame's depth is complete
+    void buildHiZ(VulkanRenderTarget* renderTarget);
+    // writes one command per visible instance into commands and their number as a uint32_t into drawCount,
+    // firstInstance is the instance index, the remaining commands are zeroed so drawing all instanceCount
+    // of them is valid without drawIndirectCount. viewProjection is column major with depth in [0, 1]
+    void cull(VulkanBufferObject* instances, uint32_t instanceCount, const float viewProjection[16],
+              VulkanBufferObject* commands, VulkanBufferObject* drawCount, bool occlusion = true);
+
+private:
+
+    static constexpr uint32_t MAX_LEVEL_COUNT = 16;
+
+    // std430 layout of Params in cull.comp
+    struct CullParams {
+        float viewProjection[16];
+        float planes[6][4];
+        uint32_t levelOffsets[MAX_LEVEL_COUNT];
+        uint32_t pyramidSize[2];
+        uint32_t levelCount;
+        uint32_t instanceCount;
+    };
+
+    void resize(uint32_t width, uint32_t height, uint32_t depthBytes);
+
+    VulkanRuntime& mRuntime;
+    VulkanComputeProgram* mReduceProgram = nullptr;
+    VulkanComputeProgram* mDownsampleProgram = nullptr;
+    VulkanComputeProgram* mCullProgram = nullptr;
+
+    VulkanBufferObject* mDepthCopy = nullptr;
+    VulkanBufferObject* mPyramid = nullptr;
+    VulkanBufferObject* mParams = nullptr;
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+    uint32_t mDepthBytes = 0;
+    uint32_t mLevelCount = 0;
+    uint32_t mLevelOffsets[MAX_LEVEL_COUNT] = {};
+    // no occlusion test until a pyramid has been built
+    bool mPyramidValid = false;
+};
+
+} // namespace backend
+} // namespace VR
+
+#endif // VULKAN_GPU_CULLING_H
@@ -8,6 +8,8 @@
 #define VK_REQUIRED_VERSION_MINOR  0
 #define VK_MAX_COMMAND_BUFFERS  3
 #define VK_MAX_PIPELINE_AGE 5
+#define VK_MAX_RENDER_PASS_AGE (VK_MAX_COMMAND_BUFFERS + 2)
+#define VK_MAX_FRAMEBUFFER_AGE (VK_MAX_COMMAND_BUFFERS + 2)
 
 #define SWAP_CHAIN_CONFIG_TRANSPARENT 0x1
 #define SWAP_CHAIN_CONFIG_READABLE 0x2
@@ -16,6 +18,7 @@
 #define MAX_VERTEX_ATTRIBUTE_COUNT 16
 #define MAX_SAMPLER_COUNT 16
 #define MAX_VERTEX_BUFFER_COUNT 16
+#define MAX_LOD_COUNT 8
 #define CONFIG_BINDING_COUNT 8
 
 #define MIN_SUPPORTED_RENDER_TARGET_COUNT 4
@@ -30,6 +33,22 @@
 #define SHADER_MODULE_COUNT SHADER_TYPE_COUNT
 #define VERTEX_ATTRIBUTE_COUNT  MAX_VERTEX_ATTRIBUTE_COUNT
 
+// compute bindings: set 0 storage buffers, set 1 storage images
+#define STORAGE_BUFFER_BINDING_COUNT 8
+#define STORAGE_IMAGE_BINDING_COUNT 8
+#define COMPUTE_PUSH_CONSTANT_SIZE 128
+
+// bindless textures: one update-after-bind sampler array bound after the regular sets
+#define BINDLESS_TEXTURE_COUNT 4096
+#define BINDLESS_INVALID_INDEX 0xFFFFFFFFu
+#define GRAPHICS_PUSH_CONSTANT_SIZE 128
+
+// gpu timestamps: a frame's queries are read back once its query range comes around again
+#define PROFILER_FRAME_COUNT (VK_MAX_COMMAND_BUFFERS + 1)
+#define PROFILER_QUERIES_PER_FRAME 256
+#define PROFILER_HISTORY_SIZE 64
+#define PROFILER_STATISTICS_PER_FRAME 32
+
 #ifdef VR_VULKAN_SUPPORT_MULTIPASS
 #define DESCRIPTOR_TYPE_COUNT 3 // uniforms, combined image samplers, and input attachments
 #else
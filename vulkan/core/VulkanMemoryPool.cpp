@@ -10,6 +10,8 @@ VulkanBufferMemory const* VulkanMemoryPool::acquireBuffer(uint32_t numBytes) {
         auto buffer = iter->second;
         mFreeBuffers.erase(iter);
         mUsedBuffers.insert(buffer);
+        buffer->lastAccessed = mCurrentFrame;
+        buffer->lastSubmission = mContext.commandpool->getCurrentValue();
         return buffer;
     }
     
@@ -18,6 +20,7 @@ VulkanBufferMemory const* VulkanMemoryPool::acquireBuffer(uint32_t numBytes) {
         .buffer = VK_NULL_HANDLE,
         .capacity = numBytes,
         .lastAccessed = mCurrentFrame,
+        .lastSubmission = mContext.commandpool->getCurrentValue(),
     });
 
     mUsedBuffers.insert(buffer);
@@ -43,6 +46,8 @@ VulkanImageMemory const* VulkanMemoryPool::acquireImage(PixelDataFormat format,
         if (image->format == vkformat && image->width == width && image->height == height) {
             mFreeImages.erase(image);
             mUsedImages.insert(image);
+            image->lastAccessed = mCurrentFrame;
+            image->lastSubmission = mContext.commandpool->getCurrentValue();
             return image;
         }
     }
@@ -52,6 +57,7 @@ VulkanImageMemory const* VulkanMemoryPool::acquireImage(PixelDataFormat format,
         .width = width,
         .height = height,
         .lastAccessed = mCurrentFrame,
+        .lastSubmission = mContext.commandpool->getCurrentValue(),
     });
 
     mUsedImages.insert(image);
@@ -80,10 +86,11 @@ VulkanImageMemory const* VulkanMemoryPool::acquireImage(PixelDataFormat format,
 }
 
 void VulkanMemoryPool::gc() {
-    if (++mCurrentFrame <= VK_MAX_COMMAND_BUFFERS) {
-        return;
-    }
-    const uint64_t gcTime = mCurrentFrame - VK_MAX_COMMAND_BUFFERS;
+    ++mCurrentFrame;
+    // free staging memory as soon as the submission using it has completed
+    // the command pool waits for all submissions before it's destroyed
+    const uint64_t completed = mContext.commandpool ? mContext.commandpool->getCompletedValue() : UINT64_MAX;
+    const uint64_t gcTime = mCurrentFrame > VK_MAX_COMMAND_BUFFERS ? mCurrentFrame - VK_MAX_COMMAND_BUFFERS : 0;
 
     // destroy buffers that have not been used for several frames
     std::multimap<uint32_t, VulkanBufferMemory const*> freeBuffers;
@@ -101,7 +108,7 @@ void VulkanMemoryPool::gc() {
     std::unordered_set<VulkanBufferMemory const*> usedBuffers;
     usedBuffers.swap(mUsedBuffers);
     for (auto buffer : usedBuffers) {
-        if (buffer->lastAccessed < gcTime) {
+        if (buffer->lastSubmission <= completed) {
             buffer->lastAccessed = mCurrentFrame;
             mFreeBuffers.insert(std::make_pair(buffer->capacity, buffer));
         } else {
@@ -125,7 +132,7 @@ void VulkanMemoryPool::gc() {
     std::unordered_set<VulkanImageMemory const*> usedImages;
     usedImages.swap(mUsedImages);
     for (auto image : usedImages) {
-        if (image->lastAccessed < gcTime) {
+        if (image->lastSubmission <= completed) {
             image->lastAccessed = mCurrentFrame;
             mFreeImages.insert(image);
         } else {
@@ -13,6 +13,8 @@ struct VulkanBufferMemory {
     VkBuffer buffer;
     uint32_t capacity;
     mutable uint64_t lastAccessed;
+    // submission value of the last command buffer using it
+    mutable uint64_t lastSubmission;
 };
 
 struct VulkanImageMemory {
@@ -20,6 +22,7 @@ struct VulkanImageMemory {
     uint32_t width;
     uint32_t height;
     mutable uint64_t lastAccessed;
+    mutable uint64_t lastSubmission;
     VmaAllocation memory;
     VkImage image;
 };
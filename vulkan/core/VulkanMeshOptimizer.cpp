@@ -0,0 +1,673 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "VulkanMeshOptimizer.h"
+#include "VulkanMacros.h"
+#include "VulkanTrace.h"
+
+namespace VR {
+namespace backend {
+
+static constexpr uint32_t INVALID_INDEX = ~0u;
+
+// FIFO size used for the statistics and the overdraw clusters, close to what current GPUs behave like
+static constexpr uint32_t FIFO_CACHE_SIZE = 16;
+
+// Forsyth's tuning, scores favour vertices recently used and vertices with few triangles left
+static constexpr uint32_t FORSYTH_CACHE_SIZE = 32;
+static constexpr uint32_t FORSYTH_MAX_VALENCE = 32;
+static constexpr float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+static constexpr float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+static constexpr float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+static constexpr float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+struct ForsythScoreTable {
+    float cache[FORSYTH_CACHE_SIZE];
+    float valence[FORSYTH_MAX_VALENCE];
+
+    ForsythScoreTable() {
+        for (uint32_t i = 0; i < FORSYTH_CACHE_SIZE; i++) {
+            // the three vertices of the last triangle get a fixed score so it is not simply repeated
+            cache[i] = i < 3 ? FORSYTH_LAST_TRIANGLE_SCORE :
+                    powf(1.0f - float(i - 3) / float(FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY_POWER);
+        }
+        valence[0] = 0.0f;
+        for (uint32_t i = 1; i < FORSYTH_MAX_VALENCE; i++) {
+            valence[i] = FORSYTH_VALENCE_BOOST_SCALE * powf(float(i), -FORSYTH_VALENCE_BOOST_POWER);
+        }
+    }
+
+    float score(int32_t cachePosition, uint32_t liveTriangles) const {
+        if (liveTriangles == 0) {
+            return -1.0f;
+        }
+        const float valenceScore = liveTriangles < FORSYTH_MAX_VALENCE ? valence[liveTriangles] :
+                FORSYTH_VALENCE_BOOST_SCALE * powf(float(liveTriangles), -FORSYTH_VALENCE_BOOST_POWER);
+        return valenceScore + (cachePosition >= 0 ? cache[cachePosition] : 0.0f);
+    }
+};
+
+// FIFO simulation with a miss counter as the clock, a vertex is cached while fewer than cacheSize
+// misses happened since it was loaded and it was loaded after flushTime
+static inline bool isCached(const uint32_t* loadTime, uint32_t vertex, uint32_t time, uint32_t flushTime, uint32_t cacheSize) {
+    const uint32_t loaded = loadTime[vertex];
+    return loaded != INVALID_INDEX && loaded >= flushTime && time - loaded < cacheSize;
+}
+
+static inline const float* getPosition(const float* positions, uint32_t positionStride, uint32_t vertex) {
+    return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + size_t(vertex) * positionStride);
+}
+
+static inline void triangleNormal(const float* p0, const float* p1, const float* p2, float* n) {
+    const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize) {
+    VR_ASSERT(indexCount % 3 == 0);
+    VertexCacheStats stats = {
+        .acmr = 0.0f,
+        .atvr = 0.0f,
+    };
+    if (indexCount == 0) {
+        return stats;
+    }
+    std::vector<uint32_t> loadTime(vertexCount, INVALID_INDEX);
+    std::vector<uint8_t> referenced(vertexCount, 0);
+    uint32_t time = 0;
+    uint32_t referencedCount = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        const uint32_t vertex = indices[i];
+        VR_ASSERT(vertex < vertexCount);
+        if (!isCached(loadTime.data(), vertex, time, 0, cacheSize)) {
+            loadTime[vertex] = time++;
+        }
+        referencedCount += referenced[vertex] ? 0 : 1;
+        referenced[vertex] = 1;
+    }
+    stats.acmr = float(time) / float(indexCount / 3);
+    stats.atvr = float(time) / float(referencedCount);
+    return stats;
+}
+
+void optimizeVertexCache(uint32_t* dst, const uint32_t* indices, size_t indexCount, uint32_t vertexCount) {
+    VR_TRACE_SCOPE("optimizeVertexCache");
+    VR_ASSERT(indexCount % 3 == 0);
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+    static const ForsythScoreTable table;
+
+    // triangles of every vertex, the first liveTriangles entries are the ones not emitted yet
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    std::vector<uint32_t> adjacency(indexCount);
+    for (size_t i = 0; i < indexCount; i++) {
+        VR_ASSERT(indices[i] < vertexCount);
+        liveTriangles[indices[i]]++;
+    }
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+    }
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < indexCount; i++) {
+            adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+        }
+    }
+
+    std::vector<int32_t> cachePositions(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        vertexScores[v] = table.score(-1, liveTriangles[v]);
+    }
+    std::vector<float> triangleScores(triangleCount);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    uint32_t best = 0;
+    for (size_t t = 0; t < triangleCount; t++) {
+        const uint32_t* tri = indices + t * 3;
+        triangleScores[t] = vertexScores[tri[0]] + vertexScores[tri[1]] + vertexScores[tri[2]];
+        best = triangleScores[t] > triangleScores[best] ? uint32_t(t) : best;
+    }
+
+    std::vector<uint32_t> output(indexCount);
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t nextCache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t cacheCount = 0;
+    size_t cursor = 0;
+
+    for (size_t out = 0; out < triangleCount; out++) {
+        // nothing in the cache has triangles left, continue with the next triangle in input order
+        if (best == INVALID_INDEX) {
+            while (emitted[cursor]) {
+                cursor++;
+            }
+            best = uint32_t(cursor);
+        }
+        const uint32_t* tri = indices + best * 3;
+        memcpy(output.data() + out * 3, tri, 3 * sizeof(uint32_t));
+        emitted[best] = 1;
+
+        uint32_t nextCount = 0;
+        for (uint32_t k = 0; k < 3; k++) {
+            const uint32_t vertex = tri[k];
+            uint32_t* list = adjacency.data() + adjacencyOffsets[vertex];
+            const uint32_t live = liveTriangles[vertex];
+            for (uint32_t i = 0; i < live; i++) {
+                if (list[i] == best) {
+                    std::swap(list[i], list[live - 1]);
+                    break;
+                }
+            }
+            liveTriangles[vertex]--;
+            // degenerate triangles name a vertex twice
+            if (std::find(nextCache, nextCache + nextCount, vertex) == nextCache + nextCount) {
+                nextCache[nextCount++] = vertex;
+            }
+        }
+        for (uint32_t i = 0; i < cacheCount; i++) {
+            if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2]) {
+                nextCache[nextCount++] = cache[i];
+            }
+        }
+
+        // evicted vertices are rescored too, their triangles lose the cache bonus
+        for (uint32_t i = 0; i < nextCount; i++) {
+            const uint32_t vertex = nextCache[i];
+            cachePositions[vertex] = i < FORSYTH_CACHE_SIZE ? int32_t(i) : -1;
+            vertexScores[vertex] = table.score(cachePositions[vertex], liveTriangles[vertex]);
+        }
+        best = INVALID_INDEX;
+        float bestScore = 0.0f;
+        for (uint32_t i = 0; i < nextCount; i++) {
+            const uint32_t vertex = nextCache[i];
+            const uint32_t* list = adjacency.data() + adjacencyOffsets[vertex];
+            for (uint32_t j = 0; j < liveTriangles[vertex]; j++) {
+                const uint32_t t = list[j];
+                const uint32_t* candidate = indices + t * 3;
+                triangleScores[t] = vertexScores[candidate[0]] + vertexScores[candidate[1]] + vertexScores[candidate[2]];
+                if (triangleScores[t] > bestScore) {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+        }
+        cacheCount = std::min(nextCount, FORSYTH_CACHE_SIZE);
+        memcpy(cache, nextCache, cacheCount * sizeof(uint32_t));
+    }
+    memcpy(dst, output.data(), indexCount * sizeof(uint32_t));
+}
+
+void optimizeOverdraw(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions,
+                      uint32_t positionStride, uint32_t vertexCount, float threshold) {
+    VR_TRACE_SCOPE("optimizeOverdraw");
+    VR_ASSERT(indexCount % 3 == 0);
+    VR_ASSERT(positions != nullptr && positionStride >= 3 * sizeof(float));
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // a cluster ends once its acmr, counted from a flushed cache, is within threshold of the whole mesh's.
+    // Drawing it after any other cluster can then only cost about that much
+    const float maxAcmr = analyzeVertexCache(indices, indexCount, vertexCount, FIFO_CACHE_SIZE).acmr * threshold;
+    std::vector<uint32_t> clusterStarts(1, 0);
+    {
+        std::vector<uint32_t> loadTime(vertexCount, INVALID_INDEX);
+        uint32_t time = 0;
+        uint32_t flushTime = 0;
+        uint32_t clusterMisses = 0;
+        uint32_t clusterTriangles = 0;
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (uint32_t k = 0; k < 3; k++) {
+                const uint32_t vertex = indices[t * 3 + k];
+                if (!isCached(loadTime.data(), vertex, time, flushTime, FIFO_CACHE_SIZE)) {
+                    loadTime[vertex] = time++;
+                    clusterMisses++;
+                }
+            }
+            clusterTriangles++;
+            if (float(clusterMisses) <= maxAcmr * float(clusterTriangles) && t + 1 < triangleCount) {
+                clusterStarts.push_back(uint32_t(t + 1));
+                flushTime = time;
+                clusterMisses = 0;
+                clusterTriangles = 0;
+            }
+        }
+    }
+    const uint32_t clusterCount = uint32_t(clusterStarts.size());
+    clusterStarts.push_back(uint32_t(triangleCount));
+
+    // area weighted centroid and normal of every cluster and of the mesh
+    std::vector<float> clusterData(clusterCount * 6, 0.0f);
+    float meshCentroid[3] = {};
+    float meshArea = 0.0f;
+    for (uint32_t c = 0; c < clusterCount; c++) {
+        float* centroid = clusterData.data() + c * 6;
+        float* normal = centroid + 3;
+        float clusterArea = 0.0f;
+        for (uint32_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+            const float* p[3];
+            for (uint32_t k = 0; k < 3; k++) {
+                p[k] = getPosition(positions, positionStride, indices[t * 3 + k]);
+            }
+            float n[3];
+            triangleNormal(p[0], p[1], p[2], n);
+            const float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (uint32_t i = 0; i < 3; i++) {
+                centroid[i] += (p[0][i] + p[1][i] + p[2][i]) * area;
+                normal[i] += n[i];
+            }
+            clusterArea += area;
+        }
+        for (uint32_t i = 0; i < 3; i++) {
+            meshCentroid[i] += centroid[i];
+            centroid[i] = clusterArea > 0.0f ? centroid[i] / (clusterArea * 3.0f) : 0.0f;
+        }
+        meshArea += clusterArea;
+    }
+    for (uint32_t i = 0; i < 3; i++) {
+        meshCentroid[i] = meshArea > 0.0f ? meshCentroid[i] / (meshArea * 3.0f) : 0.0f;
+    }
+
+    // clusters far out along their normal occlude the rest of the mesh from most directions
+    std::vector<float> sortKeys(clusterCount);
+    std::vector<uint32_t> order(clusterCount);
+    for (uint32_t c = 0; c < clusterCount; c++) {
+        const float* centroid = clusterData.data() + c * 6;
+        const float* normal = centroid + 3;
+        const float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        const float d = (centroid[0] - meshCentroid[0]) * normal[0] + (centroid[1] - meshCentroid[1]) * normal[1] +
+                (centroid[2] - meshCentroid[2]) * normal[2];
+        sortKeys[c] = length > 0.0f ? d / length : 0.0f;
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t a, uint32_t b) {
+        return sortKeys[a] > sortKeys[b];
+    });
+
+    std::vector<uint32_t> output(indexCount);
+    uint32_t* out = output.data();
+    for (uint32_t c : order) {
+        const size_t count = size_t(clusterStarts[c + 1] - clusterStarts[c]) * 3;
+        memcpy(out, indices + size_t(clusterStarts[c]) * 3, count * sizeof(uint32_t));
+        out += count;
+    }
+    memcpy(dst, output.data(), indexCount * sizeof(uint32_t));
+}
+
+uint32_t optimizeVertexFetchRemap(uint32_t* remap, const uint32_t* indices, size_t indexCount, uint32_t vertexCount) {
+    std::fill(remap, remap + vertexCount, INVALID_INDEX);
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        const uint32_t vertex = indices[i];
+        VR_ASSERT(vertex < vertexCount);
+        if (remap[vertex] == INVALID_INDEX) {
+            remap[vertex] = next++;
+        }
+    }
+    return next;
+}
+
+void remapIndexBuffer(uint32_t* dst, const uint32_t* indices, size_t indexCount, const uint32_t* remap) {
+    for (size_t i = 0; i < indexCount; i++) {
+        dst[i] = remap[indices[i]];
+    }
+}
+
+void remapVertexBuffer(void* dst, const void* src, uint32_t vertexCount, size_t vertexSize, const uint32_t* remap) {
+    VR_ASSERT(dst != src);
+    const uint8_t* in = static_cast<const uint8_t*>(src);
+    uint8_t* out = static_cast<uint8_t*>(dst);
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        if (remap[v] != INVALID_INDEX) {
+            memcpy(out + remap[v] * vertexSize, in + v * vertexSize, vertexSize);
+        }
+    }
+}
+
+uint32_t optimizeMesh(uint32_t* indices, size_t indexCount, void* const* buffers, uint32_t vertexCount,
+                      const AttributeArray& attributes, uint8_t positionAttribute, MeshOptimizerStats* stats) {
+    VR_TRACE_SCOPE("optimizeMesh");
+    VR_ASSERT(positionAttribute < MAX_VERTEX_ATTRIBUTE_COUNT);
+    const Attribute& position = attributes[positionAttribute];
+    VR_ASSERT(position.buffer < MAX_VERTEX_BUFFER_COUNT && !(position.flags & Attribute::FLAG_INSTANCE));
+    VR_VK_ASSERT(position.type == ElementType::FLOAT3 || position.type == ElementType::FLOAT4,
+                 "Mesh optimization needs float positions.");
+
+    if (stats) {
+        stats->before = analyzeVertexCache(indices, indexCount, vertexCount, FIFO_CACHE_SIZE);
+    }
+
+    optimizeVertexCache(indices, indices, indexCount, vertexCount);
+    const float* positions = reinterpret_cast<const float*>(
+            static_cast<const uint8_t*>(buffers[position.buffer]) + position.offset);
+    optimizeOverdraw(indices, indices, indexCount, positions, position.stride, vertexCount);
+
+    std::vector<uint32_t> remap(vertexCount);
+    const uint32_t newVertexCount = optimizeVertexFetchRemap(remap.data(), indices, indexCount, vertexCount);
+    remapIndexBuffer(indices, indices, indexCount, remap.data());
+
+    // every per vertex buffer is moved once, whatever the number of attributes it holds
+    bool remapped[MAX_VERTEX_BUFFER_COUNT] = {};
+    std::vector<uint8_t> scratch;
+    for (const Attribute& attrib : attributes) {
+        if (attrib.buffer == Attribute::BUFFER_UNUSED || (attrib.flags & Attribute::FLAG_INSTANCE)) {
+            continue;
+        }
+        VR_ASSERT(attrib.buffer < MAX_VERTEX_BUFFER_COUNT && buffers[attrib.buffer] != nullptr);
+        VR_ASSERT(attrib.stride != 0 && attrib.offset < attrib.stride);
+        if (remapped[attrib.buffer]) {
+            continue;
+        }
+        remapped[attrib.buffer] = true;
+        const uint8_t* data = static_cast<const uint8_t*>(buffers[attrib.buffer]);
+        scratch.assign(data, data + size_t(vertexCount) * attrib.stride);
+        remapVertexBuffer(buffers[attrib.buffer], scratch.data(), vertexCount, attrib.stride, remap.data());
+    }
+
+    if (stats) {
+        stats->after = analyzeVertexCache(indices, indexCount, newVertexCount, FIFO_CACHE_SIZE);
+    }
+    return newVertexCount;
+}
+
+// sum of area weighted squared distances to the planes of a vertex's triangles
+struct Quadric {
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+
+    void add(const Quadric& q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+        b0 += q.b0; b1 += q.b1; b2 += q.b2;
+        c += q.c;
+        weight += q.weight;
+    }
+
+    // mean squared distance of p to the planes
+    float error(const float* p) const {
+        const double x = p[0], y = p[1], z = p[2];
+        const double e = x * (a00 * x + 2.0 * (a01 * y + a02 * z + b0)) + y * (a11 * y + 2.0 * (a12 * z + b1)) +
+                z * (a22 * z + 2.0 * b2) + c;
+        return weight > 0.0 ? float(std::max(e, 0.0) / weight) : 0.0f;
+    }
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    float error;
+};
+
+size_t simplifyMesh(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions,
+                    uint32_t positionStride, uint32_t vertexCount, size_t targetIndexCount,
+                    float targetError, float* resultError) {
+    VR_TRACE_SCOPE("simplifyMesh");
+    VR_ASSERT(indexCount % 3 == 0);
+    VR_ASSERT(positions != nullptr && positionStride >= 3 * sizeof(float));
+
+    // vertices sharing a position belong to the one with the lowest index
+    std::vector<uint32_t> canonical(vertexCount);
+    {
+        std::vector<uint32_t> sorted(vertexCount);
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            sorted[v] = v;
+        }
+        std::sort(sorted.begin(), sorted.end(), [positions, positionStride](uint32_t a, uint32_t b) {
+            const int order = memcmp(getPosition(positions, positionStride, a), getPosition(positions, positionStride, b),
+                                     3 * sizeof(float));
+            return order != 0 ? order < 0 : a < b;
+        });
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            const bool same = i > 0 && memcmp(getPosition(positions, positionStride, sorted[i - 1]),
+                                               getPosition(positions, positionStride, sorted[i]), 3 * sizeof(float)) == 0;
+            canonical[sorted[i]] = same ? canonical[sorted[i - 1]] : sorted[i];
+        }
+    }
+
+    // seams and open edges stay where they are, moving them would tear the mesh apart
+    std::vector<uint8_t> locked(vertexCount, 0);
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        if (canonical[v] != v) {
+            locked[v] = 1;
+            locked[canonical[v]] = 1;
+        }
+    }
+    {
+        std::vector<uint64_t> edges;
+        edges.reserve(indexCount);
+        for (size_t i = 0; i < indexCount; i += 3) {
+            for (uint32_t k = 0; k < 3; k++) {
+                const uint32_t a = canonical[indices[i + k]];
+                const uint32_t b = canonical[indices[i + (k + 1) % 3]];
+                if (a != b) {
+                    edges.push_back(uint64_t(std::min(a, b)) << 32 | std::max(a, b));
+                }
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        for (size_t i = 0; i < edges.size();) {
+            size_t end = i + 1;
+            while (end < edges.size() && edges[end] == edges[i]) {
+                end++;
+            }
+            if (end - i == 1) {
+                locked[uint32_t(edges[i] >> 32)] = 1;
+                locked[uint32_t(edges[i])] = 1;
+            }
+            i = end;
+        }
+    }
+
+    std::vector<Quadric> quadrics(vertexCount, Quadric());
+    for (size_t i = 0; i < indexCount; i += 3) {
+        const float* p0 = getPosition(positions, positionStride, indices[i]);
+        const float* p1 = getPosition(positions, positionStride, indices[i + 1]);
+        const float* p2 = getPosition(positions, positionStride, indices[i + 2]);
+        float n[3];
+        triangleNormal(p0, p1, p2, n);
+        const float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (area == 0.0f) {
+            continue;
+        }
+        const double nx = n[0] / area, ny = n[1] / area, nz = n[2] / area;
+        const double d = -(nx * p0[0] + ny * p0[1] + nz * p0[2]);
+        const double w = area;
+        const Quadric q = {
+            w * nx * nx, w * nx * ny, w * nx * nz, w * ny * ny, w * ny * nz, w * nz * nz,
+            w * nx * d, w * ny * d, w * nz * d,
+            w * d * d,
+            w,
+        };
+        for (uint32_t k = 0; k < 3; k++) {
+            quadrics[canonical[indices[i + k]]].add(q);
+        }
+    }
+
+    std::vector<uint32_t> current(indices, indices + indexCount);
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<uint8_t> touched(vertexCount);
+    const float maxError = targetError < FLT_MAX ? targetError * targetError : FLT_MAX;
+    float error = 0.0f;
+
+    // every pass collapses the cheapest edges that do not share a neighbourhood
+    while (current.size() > targetIndexCount) {
+        const size_t currentCount = current.size();
+        std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+        for (size_t i = 0; i < currentCount; i++) {
+            adjacencyOffsets[current[i] + 1]++;
+        }
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        }
+        adjacency.resize(currentCount);
+        {
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t i = 0; i < currentCount; i++) {
+                adjacency[fill[current[i]]++] = uint32_t(i / 3);
+            }
+        }
+
+        collapses.clear();
+        for (size_t i = 0; i < currentCount; i += 3) {
+            for (uint32_t k = 0; k < 3; k++) {
+                const uint32_t a = current[i + k];
+                const uint32_t b = current[i + (k + 1) % 3];
+                if (a == b) {
+                    continue;
+                }
+                Quadric q = quadrics[canonical[a]];
+                q.add(quadrics[canonical[b]]);
+                if (!locked[a]) {
+                    collapses.push_back({ a, b, q.error(getPosition(positions, positionStride, b)) });
+                }
+                if (!locked[b]) {
+                    collapses.push_back({ b, a, q.error(getPosition(positions, positionStride, a)) });
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+            return x.error < y.error;
+        });
+
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            remap[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), 0);
+        const size_t budget = (currentCount - targetIndexCount) / 3;
+        size_t removed = 0;
+        size_t collapsed = 0;
+        for (const Collapse& collapse : collapses) {
+            if (removed >= budget || collapse.error > maxError) {
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to]) {
+                continue;
+            }
+            // moving from onto to must not fold any remaining triangle over
+            const float* target = getPosition(positions, positionStride, collapse.to);
+            size_t collapsedTriangles = 0;
+            bool flips = false;
+            for (uint32_t j = adjacencyOffsets[collapse.from]; j < adjacencyOffsets[collapse.from + 1] && !flips; j++) {
+                const uint32_t* tri = current.data() + size_t(adjacency[j]) * 3;
+                if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) {
+                    collapsedTriangles++;
+                    continue;
+                }
+                const float* p[3];
+                const float* moved[3];
+                for (uint32_t k = 0; k < 3; k++) {
+                    p[k] = getPosition(positions, positionStride, tri[k]);
+                    moved[k] = tri[k] == collapse.from ? target : p[k];
+                }
+                float before[3];
+                float after[3];
+                triangleNormal(p[0], p[1], p[2], before);
+                triangleNormal(moved[0], moved[1], moved[2], after);
+                flips = before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0f;
+            }
+            if (flips) {
+                continue;
+            }
+            remap[collapse.from] = collapse.to;
+            quadrics[canonical[collapse.to]].add(quadrics[canonical[collapse.from]]);
+            for (uint32_t j = adjacencyOffsets[collapse.from]; j < adjacencyOffsets[collapse.from + 1]; j++) {
+                const uint32_t* tri = current.data() + size_t(adjacency[j]) * 3;
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+            }
+            removed += collapsedTriangles;
+            collapsed++;
+            error = std::max(error, collapse.error);
+        }
+        if (collapsed == 0) {
+            break;
+        }
+
+        size_t write = 0;
+        for (size_t i = 0; i < currentCount; i += 3) {
+            const uint32_t a = remap[current[i]];
+            const uint32_t b = remap[current[i + 1]];
+            const uint32_t c = remap[current[i + 2]];
+            if (a != b && b != c && c != a) {
+                current[write++] = a;
+                current[write++] = b;
+                current[write++] = c;
+            }
+        }
+        current.resize(write);
+    }
+
+    if (resultError) {
+        *resultError = sqrtf(error);
+    }
+    memcpy(dst, current.data(), current.size() * sizeof(uint32_t));
+    return current.size();
+}
+
+uint32_t generateLods(std::vector<uint32_t>& indices, const float* positions, uint32_t positionStride,
+                      uint32_t vertexCount, MeshLod* lods, uint32_t maxLodCount, float reduction) {
+    VR_TRACE_SCOPE("generateLods");
+    VR_ASSERT(maxLodCount > 0 && reduction > 0.0f && reduction < 1.0f);
+    const size_t indexCount = indices.size();
+    lods[0] = {
+        .offset = 0,
+        .count = uint32_t(indexCount),
+        .error = 0.0f,
+    };
+    uint32_t lodCount = 1;
+    std::vector<uint32_t> lod(indexCount);
+    size_t targetIndexCount = indexCount;
+    while (lodCount < maxLodCount) {
+        targetIndexCount = size_t(float(targetIndexCount) * reduction) / 3 * 3;
+        if (targetIndexCount == 0) {
+            break;
+        }
+        // always from the full mesh so the error is measured against it
+        float error = 0.0f;
+        const size_t count = simplifyMesh(lod.data(), indices.data(), indexCount, positions, positionStride,
+                                          vertexCount, targetIndexCount, FLT_MAX, &error);
+        const MeshLod& previous = lods[lodCount - 1];
+        // locked borders and seams keep the rest from shrinking any further
+        if (count == 0 || float(count) > float(previous.count) * 0.9f) {
+            break;
+        }
+        optimizeVertexCache(lod.data(), lod.data(), count, vertexCount);
+        lods[lodCount++] = {
+            .offset = uint32_t(indices.size()),
+            .count = uint32_t(count),
+            .error = std::max(error, previous.error),
+        };
+        indices.insert(indices.end(), lod.begin(), lod.begin() + count);
+        targetIndexCount = count;
+    }
+    return lodCount;
+}
+
+float getLodProjectionScale(float verticalFov, uint32_t viewportHeight) {
+    return float(viewportHeight) / (2.0f * tanf(verticalFov * 0.5f));
+}
+
+uint32_t selectLod(const MeshLod* lods, uint32_t lodCount, float distance, float projectionScale, float maxPixelError) {
+    if (distance <= 0.0f) {
+        return 0;
+    }
+    for (uint32_t i = lodCount; i > 1; i--) {
+        if (lods[i - 1].error * projectionScale <= maxPixelError * distance) {
+            return i - 1;
+        }
+    }
+    return 0;
+}
+
+} // namespace backend
+} // namespace VR
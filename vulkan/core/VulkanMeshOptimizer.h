@@ -0,0 +1,74 @@
+#ifndef VULKAN_MESH_OPTIMIZER_H
+#define VULKAN_MESH_OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cfloat>
+#include <vector>
+#include "VulkanEnums.h"
+
+namespace VR {
+namespace backend {
+
+// load time mesh optimization, run on the CPU copies before updateIndexBuffer and updateBufferObject.
+// Triangle lists only, indices are 32-bit, an index buffer may still be narrowed at upload afterwards.
+
+// post-transform vertex cache efficiency of a FIFO cache of cacheSize entries
+struct VertexCacheStats {
+    float acmr; // average cache misses per triangle, 0.5 is ideal for a regular grid, 3 is the worst
+    float atvr; // average transforms per referenced vertex, 1 is ideal
+};
+
+struct MeshOptimizerStats {
+    VertexCacheStats before;
+    VertexCacheStats after;
+};
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount,
+                                    uint32_t cacheSize = 16);
+
+// Forsyth's linear-speed vertex cache optimization, dst may be indices
+void optimizeVertexCache(uint32_t* dst, const uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+
+// splits cache optimized indices into clusters that keep their acmr under threshold times the mesh's even
+// after a cache flush, then draws the clusters facing away from the mesh center first so they occlude
+// the rest from most view directions. positions are float3 with a byte stride, dst may be indices
+void optimizeOverdraw(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions,
+                      uint32_t positionStride, uint32_t vertexCount, float threshold = 1.05f);
+
+// remap[old vertex] = new vertex in order of first use, ~0u for unreferenced vertices. Returns the new vertex count
+uint32_t optimizeVertexFetchRemap(uint32_t* remap, const uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+// dst may be src
+void remapIndexBuffer(uint32_t* dst, const uint32_t* indices, size_t indexCount, const uint32_t* remap);
+// moves vertexSize byte vertices to their remapped slot, dst may not be src
+void remapVertexBuffer(void* dst, const void* src, uint32_t vertexCount, size_t vertexSize, const uint32_t* remap);
+
+// runs all of the above in place on a mesh described by attributes. buffers[i] holds the vertices of
+// Attribute::buffer i, vertexCount records of the attributes' stride. Per instance buffers are left alone.
+// The position attribute must be FLOAT3 or FLOAT4. Returns the vertex count after unused vertices are dropped
+uint32_t optimizeMesh(uint32_t* indices, size_t indexCount, void* const* buffers, uint32_t vertexCount,
+                      const AttributeArray& attributes, uint8_t positionAttribute, MeshOptimizerStats* stats = nullptr);
+
+// quadric error metric simplification by edge collapses onto existing vertices, so the vertex buffer is
+// reused as is. Mesh borders and vertices split for other attributes (seams) never move. Stops at
+// targetIndexCount or before the error, a distance in position units, would exceed targetError.
+// Returns the index count written to dst, which holds indexCount indices, resultError gets the error reached
+size_t simplifyMesh(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions,
+                    uint32_t positionStride, uint32_t vertexCount, size_t targetIndexCount,
+                    float targetError = FLT_MAX, float* resultError = nullptr);
+
+// appends coarser versions of the mesh to indices, each about reduction times the previous one, and
+// describes them in lods, lods[0] being the original indices. Returns the number of lods, at most maxLodCount.
+// Upload all of indices to the primitive's index buffer and pass lods to VulkanRuntime::setRenderPrimitiveLods
+uint32_t generateLods(std::vector<uint32_t>& indices, const float* positions, uint32_t positionStride,
+                      uint32_t vertexCount, MeshLod* lods, uint32_t maxLodCount, float reduction = 0.5f);
+
+// pixels covered by one position unit at distance 1
+float getLodProjectionScale(float verticalFov, uint32_t viewportHeight);
+// the coarsest lod whose error projects to at most maxPixelError pixels at distance
+uint32_t selectLod(const MeshLod* lods, uint32_t lodCount, float distance, float projectionScale, float maxPixelError);
+
+} // namespace backend
+} // namespace VR
+
+#endif // VULKAN_MESH_OPTIMIZER_H
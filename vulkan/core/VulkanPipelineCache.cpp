@@ -1,14 +1,139 @@
 #include "VulkanPipelineCache.h"
 #include "VulkanAlloc.h"
 #include "VulkanProgram.h"
+#include "VulkanTrace.h"
 
 namespace VR {
 namespace backend {
 
 static VulkanPipelineCache::RasterState createDefaultRasterState();
 
+thread_local VulkanPipelineCache::BindingState* VulkanPipelineCache::sThreadBindingState = nullptr;
+
+// FNV-1a, only over members without padding
+static uint32_t hashBytes(uint32_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+template<typename T>
+static uint32_t hashValue(uint32_t hash, const T& value) {
+    return hashBytes(hash, &value, sizeof(T));
+}
+
+// the create infos carry padding after sType and a pNext that is always null, so RasterState is
+// hashed and compared field by field
+static uint32_t hashRasterState(uint32_t hash, const VulkanPipelineCache::RasterState& state) {
+    const VkPipelineRasterizationStateCreateInfo& rasterization = state.rasterization;
+    hash = hashValue(hash, rasterization.depthClampEnable);
+    hash = hashValue(hash, rasterization.rasterizerDiscardEnable);
+    hash = hashValue(hash, rasterization.polygonMode);
+    hash = hashValue(hash, rasterization.cullMode);
+    hash = hashValue(hash, rasterization.frontFace);
+    hash = hashValue(hash, rasterization.depthBiasEnable);
+    hash = hashValue(hash, rasterization.depthBiasConstantFactor);
+    hash = hashValue(hash, rasterization.depthBiasClamp);
+    hash = hashValue(hash, rasterization.depthBiasSlopeFactor);
+    hash = hashValue(hash, rasterization.lineWidth);
+    hash = hashValue(hash, state.blending);
+    const VkPipelineDepthStencilStateCreateInfo& depthStencil = state.depthStencil;
+    hash = hashValue(hash, depthStencil.depthTestEnable);
+    hash = hashValue(hash, depthStencil.depthWriteEnable);
+    hash = hashValue(hash, depthStencil.depthCompareOp);
+    hash = hashValue(hash, depthStencil.depthBoundsTestEnable);
+    hash = hashValue(hash, depthStencil.stencilTestEnable);
+    hash = hashValue(hash, depthStencil.front);
+    hash = hashValue(hash, depthStencil.back);
+    hash = hashValue(hash, depthStencil.minDepthBounds);
+    hash = hashValue(hash, depthStencil.maxDepthBounds);
+    const VkPipelineMultisampleStateCreateInfo& multisampling = state.multisampling;
+    hash = hashValue(hash, multisampling.rasterizationSamples);
+    hash = hashValue(hash, multisampling.sampleShadingEnable);
+    hash = hashValue(hash, multisampling.minSampleShading);
+    hash = hashValue(hash, multisampling.pSampleMask);
+    hash = hashValue(hash, multisampling.alphaToCoverageEnable);
+    hash = hashValue(hash, multisampling.alphaToOneEnable);
+    return hashValue(hash, state.colorTargetCount);
+}
+
+static bool equivalent(const VkStencilOpState& a, const VkStencilOpState& b) {
+    return a.failOp == b.failOp && a.passOp == b.passOp && a.depthFailOp == b.depthFailOp &&
+           a.compareOp == b.compareOp && a.compareMask == b.compareMask && a.writeMask == b.writeMask &&
+           a.reference == b.reference;
+}
+
+static bool equivalent(const VulkanPipelineCache::RasterState& a, const VulkanPipelineCache::RasterState& b) {
+    const VkPipelineRasterizationStateCreateInfo& ra = a.rasterization;
+    const VkPipelineRasterizationStateCreateInfo& rb = b.rasterization;
+    if (ra.depthClampEnable != rb.depthClampEnable || ra.rasterizerDiscardEnable != rb.rasterizerDiscardEnable ||
+            ra.polygonMode != rb.polygonMode || ra.cullMode != rb.cullMode || ra.frontFace != rb.frontFace ||
+            ra.depthBiasEnable != rb.depthBiasEnable || ra.depthBiasConstantFactor != rb.depthBiasConstantFactor ||
+            ra.depthBiasClamp != rb.depthBiasClamp || ra.depthBiasSlopeFactor != rb.depthBiasSlopeFactor ||
+            ra.lineWidth != rb.lineWidth) {
+        return false;
+    }
+    const VkPipelineColorBlendAttachmentState& ba = a.blending;
+    const VkPipelineColorBlendAttachmentState& bb = b.blending;
+    if (ba.blendEnable != bb.blendEnable || ba.srcColorBlendFactor != bb.srcColorBlendFactor ||
+            ba.dstColorBlendFactor != bb.dstColorBlendFactor || ba.colorBlendOp != bb.colorBlendOp ||
+            ba.srcAlphaBlendFactor != bb.srcAlphaBlendFactor || ba.dstAlphaBlendFactor != bb.dstAlphaBlendFactor ||
+            ba.alphaBlendOp != bb.alphaBlendOp || ba.colorWriteMask != bb.colorWriteMask) {
+        return false;
+    }
+    const VkPipelineDepthStencilStateCreateInfo& da = a.depthStencil;
+    const VkPipelineDepthStencilStateCreateInfo& db = b.depthStencil;
+    if (da.depthTestEnable != db.depthTestEnable || da.depthWriteEnable != db.depthWriteEnable ||
+            da.depthCompareOp != db.depthCompareOp || da.depthBoundsTestEnable != db.depthBoundsTestEnable ||
+            da.stencilTestEnable != db.stencilTestEnable || !equivalent(da.front, db.front) || !equivalent(da.back, db.back) ||
+            da.minDepthBounds != db.minDepthBounds || da.maxDepthBounds != db.maxDepthBounds) {
+        return false;
+    }
+    const VkPipelineMultisampleStateCreateInfo& ma = a.multisampling;
+    const VkPipelineMultisampleStateCreateInfo& mb = b.multisampling;
+    return ma.rasterizationSamples == mb.rasterizationSamples && ma.sampleShadingEnable == mb.sampleShadingEnable &&
+           ma.minSampleShading == mb.minSampleShading && ma.pSampleMask == mb.pSampleMask &&
+           ma.alphaToCoverageEnable == mb.alphaToCoverageEnable && ma.alphaToOneEnable == mb.alphaToOneEnable &&
+           a.colorTargetCount == b.colorTargetCount;
+}
+
+size_t VulkanPipelineCache::PipelineInfoHash::operator()(const PipelineInfo& info) const {
+    uint32_t hash = 2166136261u;
+    hash = hashValue(hash, info.shaders);
+    hash = hashRasterState(hash, info.rasterState);
+    hash = hashValue(hash, info.renderPass);
+    hash = hashValue(hash, info.topology);
+    hash = hashValue(hash, info.subpassIndex);
+    hash = hashValue(hash, info.vertexAttributes);
+    return hashValue(hash, info.vertexBuffers);
+}
+
+void VulkanPipelineCache::VertexAttributeArray::computeHash() {
+    // 64-bit FNV-1a, wide enough that a matching hash stands in for comparing the arrays
+    // runs once per vertex buffer, so the arrays are hashed bytewise
+    uint64_t value = 14695981039346656037ull;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(attributes);
+    for (size_t i = 0; i < sizeof(attributes); i++) {
+        value = (value ^ bytes[i]) * 1099511628211ull;
+    }
+    bytes = reinterpret_cast<const uint8_t*>(buffers);
+    for (size_t i = 0; i < sizeof(buffers); i++) {
+        value = (value ^ bytes[i]) * 1099511628211ull;
+    }
+    hash = value;
+}
+
+bool VulkanPipelineCache::PipelineInfoEqual::operator()(const PipelineInfo& a, const PipelineInfo& b) const {
+    // the arrays have no padding
+    return memcmp(a.shaders, b.shaders, sizeof(a.shaders)) == 0 && equivalent(a.rasterState, b.rasterState) &&
+           a.renderPass == b.renderPass && a.topology == b.topology && a.subpassIndex == b.subpassIndex &&
+           memcmp(a.vertexAttributes, b.vertexAttributes, sizeof(a.vertexAttributes)) == 0 &&
+           memcmp(a.vertexBuffers, b.vertexBuffers, sizeof(a.vertexBuffers)) == 0;
+}
+
 VulkanPipelineCache::VulkanPipelineCache() : mDefaultRasterState(createDefaultRasterState()) {
-    mPipelines.resize(VK_MAX_COMMAND_BUFFERS);
 }
 
 VulkanPipelineCache::~VulkanPipelineCache() {
@@ -16,94 +141,156 @@ VulkanPipelineCache::~VulkanPipelineCache() {
 }
 
 bool VulkanPipelineCache::bindDescriptorSets(VkCommandBuffer cmdbuffer) {
-    VkDescriptorSet descriptors[DESCRIPTOR_TYPE_COUNT];
-    bool bound = false;
-    createDescriptorSets(descriptors, &bound);
-    if (bound && mDescriptorTypeCount != 0) {
+    BindingState& bindings = getBindingState();
+    CmdBufferState& cmdBufferState = bindings.cmdBufferState[bindings.cmdBufferIndex];
+
+    // the release store publishes the layouts to the threads that did not create them
+    if (!mLayoutsCreated.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mLayoutsCreated.load(std::memory_order_relaxed)) {
+            createLayoutsAndDescriptors();
+            mLayoutsCreated.store(true, std::memory_order_release);
+        }
+    }
+
+    // new sets only when the bindings changed or this command buffer has none bound yet
+    if (mDescriptorTypeCount != 0 && (bindings.descriptorsDirty || !cmdBufferState.descriptorSetsBound)) {
+        VkDescriptorSet descriptors[DESCRIPTOR_TYPE_COUNT];
+        createDescriptorSets(descriptors);
         vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, 0, mDescriptorTypeCount, descriptors, 0, nullptr);
+        bindings.descriptorsDirty = false;
+        cmdBufferState.descriptorSetsBound = true;
+    }
+
+    bool& bindlessBound = bindings.cmdBufferState[bindings.cmdBufferIndex].bindlessBound;
+    if (mBindlessSet != VK_NULL_HANDLE && !bindlessBound) {
+        vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, DESCRIPTOR_TYPE_COUNT, 1, &mBindlessSet, 0, nullptr);
+        bindlessBound = true;
+    }
+    PushConstants& pushConstants = bindings.pushConstants;
+    if (pushConstants.dirty) {
+        vkCmdPushConstants(cmdbuffer, mPipelineLayout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, pushConstants.size, pushConstants.data);
+        pushConstants.dirty = false;
     }
     return true;
 }
 
 void VulkanPipelineCache::bindPipeline(VkCommandBuffer cmdbuffer) {
-    if (mPipelineCache == VK_NULL_HANDLE) {
-        VkPipelineCacheCreateInfo pipelineCacheCreateInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO, };
-        VkResult result = vkCreatePipelineCache(mDevice, &pipelineCacheCreateInfo, nullptr, &mPipelineCache);
-        VR_VK_ASSERT(result == VK_SUCCESS, "vkCreatePipelineCache error.")
+    VR_TRACE_SCOPE("VulkanPipelineCache::bindPipeline");
+    BindingState& bindings = getBindingState();
+    VkPipeline& currentPipeline = bindings.cmdBufferState[bindings.cmdBufferIndex].currentPipeline;
+    if (!bindings.pipelineDirty && currentPipeline != VK_NULL_HANDLE) {
+        return;
     }
-    
-    VkPipeline pipeline;
-    if (createPipeline(&pipeline)) {
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mPipelineCache == VK_NULL_HANDLE) {
+            VkPipelineCacheCreateInfo pipelineCacheCreateInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO, };
+            VkResult result = vkCreatePipelineCache(mDevice, &pipelineCacheCreateInfo, nullptr, &mPipelineCache);
+            VR_VK_ASSERT(result == VK_SUCCESS, "vkCreatePipelineCache error.")
+        }
+        auto found = mPipelines.find(bindings.pipelineInfo);
+        if (found != mPipelines.end()) {
+            pipeline = found->second;
+        }
+    }
+
+    if (pipeline == VK_NULL_HANDLE) {
+        // created outside the lock, another thread may have raced us to the same state
+        VkPipeline created = createPipeline(bindings.pipelineInfo);
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto inserted = mPipelines.emplace(bindings.pipelineInfo, created);
+        if (!inserted.second) {
+            vkDestroyPipeline(mDevice, created, VKALLOC);
+        }
+        pipeline = inserted.first->second;
+    }
+
+    bindings.pipelineDirty = false;
+    if (pipeline != currentPipeline) {
         vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    }    
+        currentPipeline = pipeline;
+    }
 }
 
 void VulkanPipelineCache::bindScissor(VkCommandBuffer cmdbuffer, VkRect2D scissor) {
-    VkRect2D& currentScissor = mCmdBufferState[mCmdBufferIndex].scissor;
+    BindingState& bindings = getBindingState();
+    VkRect2D& currentScissor = bindings.cmdBufferState[bindings.cmdBufferIndex].scissor;
     if (!equivalent(currentScissor, scissor)) {
         currentScissor = scissor;
         vkCmdSetScissor(cmdbuffer, 0, 1, &scissor);
     }
 }
 
-void VulkanPipelineCache::createDescriptorSets(VkDescriptorSet descriptorSets[DESCRIPTOR_TYPE_COUNT], bool* bound) {
-
-    if (!mPipelineLayout) {
-        createLayoutsAndDescriptors();
+void VulkanPipelineCache::bindVertexBuffers(VkCommandBuffer cmdbuffer, uint32_t bufferCount, const VkBuffer* buffers, const VkDeviceSize* offsets) {
+    BindingState& bindings = getBindingState();
+    CmdBufferState& state = bindings.cmdBufferState[bindings.cmdBufferIndex];
+    if (state.vertexBufferCount == bufferCount &&
+            std::equal(buffers, buffers + bufferCount, state.vertexBuffers) &&
+            std::equal(offsets, offsets + bufferCount, state.vertexOffsets)) {
+        return;
     }
+    std::copy(buffers, buffers + bufferCount, state.vertexBuffers);
+    std::copy(offsets, offsets + bufferCount, state.vertexOffsets);
+    state.vertexBufferCount = bufferCount;
+    vkCmdBindVertexBuffers(cmdbuffer, 0, bufferCount, buffers, offsets);
+}
 
-    DescriptorSetInfo*& descriptorSetInfo = mCmdBufferState[mCmdBufferIndex].currentDescriptorSetInfo;
-    if (descriptorSetInfo != nullptr) {
-        for (uint32_t i = 0; i < mDescriptorTypeCount; ++i) {
-            descriptorSets[i] = descriptorSetInfo->descSets[i];
-        }
-        *bound = true;
-        return;
+void VulkanPipelineCache::bindIndexBuffer(VkCommandBuffer cmdbuffer, VkBuffer buffer, VkIndexType indexType) {
+    BindingState& bindings = getBindingState();
+    CmdBufferState& state = bindings.cmdBufferState[bindings.cmdBufferIndex];
+    if (state.indexBuffer != buffer || state.indexType != indexType) {
+        state.indexBuffer = buffer;
+        state.indexType = indexType;
+        vkCmdBindIndexBuffer(cmdbuffer, buffer, 0, indexType);
     }
-    
-    // no cached descriptor sets then create new ones for each type
-    if (mDescriptorSets[0].empty()) {
-        if (mDescriptorTypeCount == 0) {
-            return;
-        }
+}
+
+void VulkanPipelineCache::createDescriptorSets(VkDescriptorSet descriptorSets[DESCRIPTOR_TYPE_COUNT]) {
+    BindingState& bindings = getBindingState();
+    {
+        // sets are never shared between command buffers since other threads may be recording with them,
+        // a slot's pools are reset once its previous command buffer has completed
+        std::lock_guard<std::mutex> lock(mMutex);
+        DescriptorPools& slot = mDescriptorPools[bindings.cmdBufferIndex];
         VkDescriptorSetAllocateInfo allocInfo = {};
         allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = mDescriptorPool;
         allocInfo.descriptorSetCount = mDescriptorTypeCount;
         allocInfo.pSetLayouts = mDescriptorSetLayouts;
-        VkResult result = vkAllocateDescriptorSets(mDevice, &allocInfo, descriptorSets);
-        
-        VR_ASSERT(result == VK_SUCCESS);
-        if (result != VK_SUCCESS) {
-            return;
-        }
-    } else {
-        for (uint32_t i = 0; i < mDescriptorTypeCount; ++i) {
-            descriptorSets[i] = mDescriptorSets[i].back();
-            mDescriptorSets[i].pop_back();
+
+        VkResult result = VK_ERROR_OUT_OF_POOL_MEMORY;
+        while (result != VK_SUCCESS) {
+            // the current pool is exhausted, move on to the next one
+            if (slot.current == slot.pools.size()) {
+                slot.pools.push_back(createDescriptorPool(mDescriptorPoolSize));
+            }
+            allocInfo.descriptorPool = slot.pools[slot.current];
+            result = vkAllocateDescriptorSets(mDevice, &allocInfo, descriptorSets);
+            if (result != VK_SUCCESS) {
+                VR_VK_CHECK(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL,
+                        "vkAllocateDescriptorSets error.");
+                slot.current++;
+            }
         }
-    }
-    
-    descriptorSetInfo = new DescriptorSetInfo;
-    for (uint32_t i = 0; i < mDescriptorTypeCount; ++i) {
-        descriptorSetInfo->descSets[i] = descriptorSets[i];
-        mDescriptorSets[i].push_back(descriptorSets[i]);
+        VR_TRACE_COUNTER(DESCRIPTOR_SETS_ALLOCATED, mDescriptorTypeCount);
     }
     
     uint32_t uniformDesSize = 0;
-    for(auto& uniform : mDescriptorInfo.uniformBuffers) {
+    for(auto& uniform : bindings.descriptorInfo.uniformBuffers) {
         if (uniform != VK_NULL_HANDLE) {
             uniformDesSize++;
         }
     }
     uint32_t samplerDesSize = 0;
-    for(auto& sampler : mDescriptorInfo.samplers) {
+    for(auto& sampler : bindings.descriptorInfo.samplers) {
         if (sampler.sampler != VK_NULL_HANDLE) {
             samplerDesSize++;
         }
     }
     uint32_t inputAttachmentDesSize = 0;
-    for(auto& input : mDescriptorInfo.inputAttachments) {
+    for(auto& input : bindings.descriptorInfo.inputAttachments) {
         if (input.sampler != VK_NULL_HANDLE) {
             inputAttachmentDesSize++;
         }
@@ -122,11 +309,11 @@ void VulkanPipelineCache::createDescriptorSets(VkDescriptorSet descriptorSets[DE
     // Uniform Buffers
     for (uint32_t binding = 0; binding < uniformDesSize; binding++) {
         VkWriteDescriptorSet& writeInfo = writeDescriptorSets[writesCount++];
-        if (mDescriptorInfo.uniformBuffers[binding]) {
+        if (bindings.descriptorInfo.uniformBuffers[binding]) {
             VkDescriptorBufferInfo& bufferInfo = descriptorBuffers[binding];
-            bufferInfo.buffer = mDescriptorInfo.uniformBuffers[binding];
-            bufferInfo.offset = mDescriptorInfo.uniformBufferOffsets[binding];
-            bufferInfo.range = mDescriptorInfo.uniformBufferSizes[binding];
+            bufferInfo.buffer = bindings.descriptorInfo.uniformBuffers[binding];
+            bufferInfo.offset = bindings.descriptorInfo.uniformBufferOffsets[binding];
+            bufferInfo.range = bindings.descriptorInfo.uniformBufferSizes[binding];
             writeInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             writeInfo.pNext = nullptr;
             writeInfo.dstArrayElement = 0;
@@ -136,15 +323,15 @@ void VulkanPipelineCache::createDescriptorSets(VkDescriptorSet descriptorSets[DE
             writeInfo.pBufferInfo = &bufferInfo;
             writeInfo.pTexelBufferView = nullptr;
         }
-        writeInfo.dstSet = descriptorSetInfo->descSets[0];
+        writeInfo.dstSet = descriptorSets[0];
         writeInfo.dstBinding = binding;
     }
     // Image Samplers
     for (uint32_t binding = 0; binding < samplerDesSize; binding++) {
         VkWriteDescriptorSet& writeInfo = writeDescriptorSets[writesCount++];
-        if (mDescriptorInfo.samplers[binding].sampler) {
+        if (bindings.descriptorInfo.samplers[binding].sampler) {
             VkDescriptorImageInfo& imageInfo = descriptorSamplers[binding];
-            imageInfo = mDescriptorInfo.samplers[binding];
+            imageInfo = bindings.descriptorInfo.samplers[binding];
             writeInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             writeInfo.pNext = nullptr;
             writeInfo.dstArrayElement = 0;
@@ -154,7 +341,7 @@ void VulkanPipelineCache::createDescriptorSets(VkDescriptorSet descriptorSets[DE
             writeInfo.pBufferInfo = nullptr;
             writeInfo.pTexelBufferView = nullptr;
         }
-        writeInfo.dstSet = descriptorSetInfo->descSets[1];
+        writeInfo.dstSet = descriptorSets[1];
         writeInfo.dstBinding = binding;
     }
     
@@ -162,9 +349,9 @@ void VulkanPipelineCache::createDescriptorSets(VkDescriptorSet descriptorSets[DE
     // Input Attachments
     for (uint32_t binding = 0; binding < inputAttachmentDesSize; binding++) {
         VkWriteDescriptorSet& writeInfo = writeDescriptorSets[writesCount++];
-        if (mDescriptorInfo.inputAttachments[binding].imageView) {
+        if (bindings.descriptorInfo.inputAttachments[binding].imageView) {
             VkDescriptorImageInfo& imageInfo = descriptorInputAttachments[binding];
-            imageInfo = mDescriptorInfo.inputAttachments[binding];
+            imageInfo = bindings.descriptorInfo.inputAttachments[binding];
             writeInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             writeInfo.pNext = nullptr;
             writeInfo.dstArrayElement = 0;
@@ -174,26 +361,17 @@ void VulkanPipelineCache::createDescriptorSets(VkDescriptorSet descriptorSets[DE
             writeInfo.pBufferInfo = nullptr;
             writeInfo.pTexelBufferView = nullptr;
         }
-        writeInfo.dstSet = descriptorSetInfo->descSets[2];
+        writeInfo.dstSet = descriptorSets[2];
         writeInfo.dstBinding = binding;
     }
 #endif
     vkUpdateDescriptorSets(mDevice, writesCount, writeDescriptorSets, 0, nullptr);
-    *bound = true;
 }
 
-bool VulkanPipelineCache::createPipeline(VkPipeline* pipeline) {
-
+VkPipeline VulkanPipelineCache::createPipeline(const PipelineInfo& pipelineInfo) {
     VR_ASSERT(mPipelineLayout);
-    VR_VK_ASSERT(mPipelineInfo.shaders[0] != VK_NULL_HANDLE, "Vertex shader is not bound.");
-    VR_VK_ASSERT(mPipelineInfo.shaders[1] != VK_NULL_HANDLE, "Fragment shader is not bound.");
-    
-    VkPipeline& currentPipeline = mCmdBufferState[mCmdBufferIndex].currentPipeline;
-
-    if (currentPipeline != VK_NULL_HANDLE) {
-        *pipeline = currentPipeline;
-        return true;
-    }
+    VR_VK_ASSERT(pipelineInfo.shaders[0] != VK_NULL_HANDLE, "Vertex shader is not bound.");
+    VR_VK_ASSERT(pipelineInfo.shaders[1] != VK_NULL_HANDLE, "Fragment shader is not bound.");
 
     VkPipelineShaderStageCreateInfo shaderStages[SHADER_MODULE_COUNT];
     shaderStages[0] = VkPipelineShaderStageCreateInfo{};
@@ -213,17 +391,17 @@ bool VulkanPipelineCache::createPipeline(VkPipeline* pipeline) {
     colorBlendState.attachmentCount = 1;
     colorBlendState.pAttachments = colorBlendAttachments;
 
-    shaderStages[0].module = mPipelineInfo.shaders[0];
-    shaderStages[1].module = mPipelineInfo.shaders[1];
+    shaderStages[0].module = pipelineInfo.shaders[0];
+    shaderStages[1].module = pipelineInfo.shaders[1];
 
     uint32_t numVertexAttribs = 0;
     uint32_t numVertexBuffers = 0;
     // use available atrributes
     for (uint32_t i = 0; i < VERTEX_ATTRIBUTE_COUNT; i++) {
-        if (mPipelineInfo.vertexAttributes[i].format > 0) {
+        if (pipelineInfo.vertexAttributes[i].format > 0) {
             numVertexAttribs++;
         }
-        if (mPipelineInfo.vertexBuffers[i].stride > 0) {
+        if (pipelineInfo.vertexBuffers[i].stride > 0) {
             numVertexBuffers++;
         }
     }
@@ -231,13 +409,13 @@ bool VulkanPipelineCache::createPipeline(VkPipeline* pipeline) {
     VkPipelineVertexInputStateCreateInfo vertexInputState = {};
     vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
     vertexInputState.vertexBindingDescriptionCount = numVertexBuffers;
-    vertexInputState.pVertexBindingDescriptions = mPipelineInfo.vertexBuffers;
+    vertexInputState.pVertexBindingDescriptions = pipelineInfo.vertexBuffers;
     vertexInputState.vertexAttributeDescriptionCount = numVertexAttribs;
-    vertexInputState.pVertexAttributeDescriptions = mPipelineInfo.vertexAttributes;
+    vertexInputState.pVertexAttributeDescriptions = pipelineInfo.vertexAttributes;
 
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
     inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssemblyState.topology = mPipelineInfo.topology;
+    inputAssemblyState.topology = pipelineInfo.topology;
 
     VkPipelineViewportStateCreateInfo viewportState = {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -256,128 +434,116 @@ bool VulkanPipelineCache::createPipeline(VkPipeline* pipeline) {
     VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
     pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipelineCreateInfo.layout = mPipelineLayout;
-    pipelineCreateInfo.renderPass = mPipelineInfo.renderPass;
-    pipelineCreateInfo.subpass = mPipelineInfo.subpassIndex;
+    pipelineCreateInfo.renderPass = pipelineInfo.renderPass;
+    pipelineCreateInfo.subpass = pipelineInfo.subpassIndex;
     pipelineCreateInfo.stageCount = SHADER_MODULE_COUNT;
     pipelineCreateInfo.pStages = shaderStages;
     pipelineCreateInfo.pVertexInputState = &vertexInputState;
     pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
-    pipelineCreateInfo.pRasterizationState = &mPipelineInfo.rasterState.rasterization;
+    pipelineCreateInfo.pRasterizationState = &pipelineInfo.rasterState.rasterization;
     pipelineCreateInfo.pColorBlendState = &colorBlendState;
-    pipelineCreateInfo.pMultisampleState = &mPipelineInfo.rasterState.multisampling;
+    pipelineCreateInfo.pMultisampleState = &pipelineInfo.rasterState.multisampling;
     pipelineCreateInfo.pViewportState = &viewportState;
-    pipelineCreateInfo.pDepthStencilState = &mPipelineInfo.rasterState.depthStencil;
+    pipelineCreateInfo.pDepthStencilState = &pipelineInfo.rasterState.depthStencil;
     pipelineCreateInfo.pDynamicState = &dynamicState;
 
-    colorBlendState.attachmentCount = mPipelineInfo.rasterState.colorTargetCount;
+    colorBlendState.attachmentCount = pipelineInfo.rasterState.colorTargetCount;
     for (auto& target : colorBlendAttachments) {
-        target = mPipelineInfo.rasterState.blending;
+        target = pipelineInfo.rasterState.blending;
     }
 
-    VkResult result = vkCreateGraphicsPipelines(mDevice, mPipelineCache, 1, &pipelineCreateInfo, VKALLOC, pipeline);
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult result = vkCreateGraphicsPipelines(mDevice, mPipelineCache, 1, &pipelineCreateInfo, VKALLOC, &pipeline);
     VR_VK_ASSERT(result == VK_SUCCESS, "vkCreateGraphicsPipelines error.");
-    mPipelines[mCmdBufferIndex] = *pipeline;
-    currentPipeline = *pipeline;
-    
-    return true;
+    VR_TRACE_COUNTER(PIPELINES_CREATED, 1);
+    return pipeline;
 }
 
 void VulkanPipelineCache::bindProgram(const VkShaderModule& vertex, const VkShaderModule& fragment) {
+    BindingState& bindings = getBindingState();
     const VkShaderModule shaders[2] = { vertex, fragment };
     for (uint32_t i = 0; i < SHADER_MODULE_COUNT; i++) {
-        if (mPipelineInfo.shaders[i] != shaders[i]) {
-            mPipelineInfo.shaders[i] = shaders[i];
+        if (bindings.pipelineInfo.shaders[i] != shaders[i]) {
+            bindings.pipelineInfo.shaders[i] = shaders[i];
+            bindings.pipelineDirty = true;
         }
     }
 }
 
 void VulkanPipelineCache::bindRasterState(const RasterState& rasterState) {
-
-    VkPipelineRasterizationStateCreateInfo& raster0 = mPipelineInfo.rasterState.rasterization;
-    const VkPipelineRasterizationStateCreateInfo& raster1 = rasterState.rasterization;
-    VkPipelineColorBlendAttachmentState& blend0 = mPipelineInfo.rasterState.blending;
-    const VkPipelineColorBlendAttachmentState& blend1 = rasterState.blending;
-    VkPipelineDepthStencilStateCreateInfo& ds0 = mPipelineInfo.rasterState.depthStencil;
-    const VkPipelineDepthStencilStateCreateInfo& ds1 = rasterState.depthStencil;
-    VkPipelineMultisampleStateCreateInfo& ms0 = mPipelineInfo.rasterState.multisampling;
-    const VkPipelineMultisampleStateCreateInfo& ms1 = rasterState.multisampling;
-    if (
-            mPipelineInfo.rasterState.colorTargetCount != rasterState.colorTargetCount ||
-            raster0.polygonMode != raster1.polygonMode ||
-            raster0.cullMode != raster1.cullMode ||
-            raster0.frontFace != raster1.frontFace ||
-            raster0.rasterizerDiscardEnable != raster1.rasterizerDiscardEnable ||
-            raster0.depthBiasEnable != raster1.depthBiasEnable ||
-            raster0.depthBiasConstantFactor != raster1.depthBiasConstantFactor ||
-            raster0.depthBiasSlopeFactor != raster1.depthBiasSlopeFactor ||
-            blend0.colorWriteMask != blend1.colorWriteMask ||
-            blend0.blendEnable != blend1.blendEnable ||
-            ds0.depthTestEnable != ds1.depthTestEnable ||
-            ds0.depthWriteEnable != ds1.depthWriteEnable ||
-            ds0.depthCompareOp != ds1.depthCompareOp ||
-            ds0.stencilTestEnable != ds1.stencilTestEnable ||
-            ms0.rasterizationSamples != ms1.rasterizationSamples ||
-            ms0.alphaToCoverageEnable != ms1.alphaToCoverageEnable
-    ) {
-        mPipelineInfo.rasterState = rasterState;
+    BindingState& bindings = getBindingState();
+    if (!equivalent(bindings.pipelineInfo.rasterState, rasterState)) {
+        bindings.pipelineInfo.rasterState = rasterState;
+        bindings.pipelineDirty = true;
     }
 }
 
 void VulkanPipelineCache::bindRenderPass(VkRenderPass renderPass, int subpassIndex) {
-    if (mPipelineInfo.renderPass != renderPass || mPipelineInfo.subpassIndex != subpassIndex) {
-        mPipelineInfo.renderPass = renderPass;
-        mPipelineInfo.subpassIndex = subpassIndex;
+    BindingState& bindings = getBindingState();
+    if (bindings.pipelineInfo.renderPass != renderPass || bindings.pipelineInfo.subpassIndex != subpassIndex) {
+        bindings.pipelineInfo.renderPass = renderPass;
+        bindings.pipelineInfo.subpassIndex = subpassIndex;
+        bindings.pipelineDirty = true;
     }
 }
 
 void VulkanPipelineCache::bindPrimitiveTopology(VkPrimitiveTopology topology) {
-    if (mPipelineInfo.topology != topology) {
-        mPipelineInfo.topology = topology;
+    BindingState& bindings = getBindingState();
+    if (bindings.pipelineInfo.topology != topology) {
+        bindings.pipelineInfo.topology = topology;
+        bindings.pipelineDirty = true;
     }
 }
 
 void VulkanPipelineCache::bindVertexAttributeArray(const VertexAttributeArray& varray) {
-    for (size_t i = 0; i < VERTEX_ATTRIBUTE_COUNT; i++) {
-        VkVertexInputAttributeDescription& attribDst = mPipelineInfo.vertexAttributes[i];
-        const VkVertexInputAttributeDescription& attribSrc = varray.attributes[i];
-        if (attribSrc.location != attribDst.location || attribSrc.binding != attribDst.binding ||
-                attribSrc.format != attribDst.format || attribSrc.offset != attribDst.offset) {
-            attribDst.format = attribSrc.format;
-            attribDst.binding = attribSrc.binding;
-            attribDst.location = attribSrc.location;
-            attribDst.offset = attribSrc.offset;
-        }
-        VkVertexInputBindingDescription& bufferDst = mPipelineInfo.vertexBuffers[i];
-        const VkVertexInputBindingDescription& bufferSrc = varray.buffers[i];
-        if (bufferDst.binding != bufferSrc.binding || bufferDst.stride != bufferSrc.stride) {
-            bufferDst.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-            bufferDst.binding = bufferSrc.binding;
-            bufferDst.stride = bufferSrc.stride;
-        }
+    BindingState& bindings = getBindingState();
+    if (bindings.vertexLayoutHash == varray.hash) {
+        return;
     }
+    memcpy(bindings.pipelineInfo.vertexAttributes, varray.attributes, sizeof(varray.attributes));
+    memcpy(bindings.pipelineInfo.vertexBuffers, varray.buffers, sizeof(varray.buffers));
+    bindings.vertexLayoutHash = varray.hash;
+    bindings.pipelineDirty = true;
 }
 
 void VulkanPipelineCache::unbindUniformBuffer(VkBuffer uniformBuffer) {
-    auto& dpInfo = mDescriptorInfo;
+    unbindUniformBuffer(mBindingState, uniformBuffer);
+    for (auto& state : mThreadBindingStates) {
+        unbindUniformBuffer(*state, uniformBuffer);
+    }
+}
+
+void VulkanPipelineCache::unbindUniformBuffer(BindingState& bindings, VkBuffer uniformBuffer) {
+    auto& dpInfo = bindings.descriptorInfo;
     for (uint32_t bindingIndex = 0u; bindingIndex < UBUFFER_BINDING_COUNT; ++bindingIndex) {
         if (dpInfo.uniformBuffers[bindingIndex] == uniformBuffer) {
             dpInfo.uniformBuffers[bindingIndex] = {};
             dpInfo.uniformBufferSizes[bindingIndex] = {};
             dpInfo.uniformBufferOffsets[bindingIndex] = {};
+            bindings.descriptorsDirty = true;
         }
     }
 }
 
 void VulkanPipelineCache::unbindImageView(VkImageView imageView) {
-    for (auto& sampler : mDescriptorInfo.samplers) {
+    unbindImageView(mBindingState, imageView);
+    for (auto& state : mThreadBindingStates) {
+        unbindImageView(*state, imageView);
+    }
+}
+
+void VulkanPipelineCache::unbindImageView(BindingState& bindings, VkImageView imageView) {
+    for (auto& sampler : bindings.descriptorInfo.samplers) {
         if (sampler.imageView == imageView) {
             sampler = {};
+            bindings.descriptorsDirty = true;
         }
     }
 #ifdef VR_VULKAN_SUPPORT_MULTIPASS
-    for (auto& target : mDescriptorInfo.inputAttachments) {
+    for (auto& target : bindings.descriptorInfo.inputAttachments) {
         if (target.imageView == imageView) {
             target = {};
+            bindings.descriptorsDirty = true;
         }
     }
 #endif
@@ -387,7 +553,8 @@ void VulkanPipelineCache::bindUniformBuffer(uint32_t bindingIndex, VkBuffer unif
    
     VR_VK_ASSERT(bindingIndex < UBUFFER_BINDING_COUNT, "Uniform bindings out of range.");
     
-    auto& dpInfo = mDescriptorInfo;
+    BindingState& bindings = getBindingState();
+    auto& dpInfo = bindings.descriptorInfo;
 
     if (dpInfo.uniformBuffers[bindingIndex] != uniformBuffer ||
         dpInfo.uniformBufferOffsets[bindingIndex] != offset ||
@@ -396,19 +563,22 @@ void VulkanPipelineCache::bindUniformBuffer(uint32_t bindingIndex, VkBuffer unif
         dpInfo.uniformBuffers[bindingIndex] = uniformBuffer;
         dpInfo.uniformBufferOffsets[bindingIndex] = offset;
         dpInfo.uniformBufferSizes[bindingIndex] = size;
+        bindings.descriptorsDirty = true;
     }
 }
 
 void VulkanPipelineCache::bindSamplers(VkDescriptorImageInfo samplers[SAMPLER_BINDING_COUNT]) {
+    BindingState& bindings = getBindingState();
     
     for (uint32_t bindingIndex = 0; bindingIndex < SAMPLER_BINDING_COUNT; bindingIndex++) {
         const VkDescriptorImageInfo& requested = samplers[bindingIndex];
-        VkDescriptorImageInfo& existing = mDescriptorInfo.samplers[bindingIndex];
+        VkDescriptorImageInfo& existing = bindings.descriptorInfo.samplers[bindingIndex];
         if (existing.sampler != requested.sampler ||
             existing.imageView != requested.imageView ||
             existing.imageLayout != requested.imageLayout) 
         {
             existing = requested;
+            bindings.descriptorsDirty = true;
         }
     }
 }
@@ -417,16 +587,30 @@ void VulkanPipelineCache::bindInputAttachment(uint32_t bindingIndex, VkDescripto
     
     VR_VK_ASSERT(bindingIndex < TARGET_BINDING_COUNT, "Input attachment bindings out of range.");
 #ifdef VR_VULKAN_SUPPORT_MULTIPASS
-    VkDescriptorImageInfo& imageInfo = mDescriptorInfo.inputAttachments[bindingIndex];
+    BindingState& bindings = getBindingState();
+    VkDescriptorImageInfo& imageInfo = bindings.descriptorInfo.inputAttachments[bindingIndex];
     if (imageInfo.imageView != targetInfo.imageView || imageInfo.imageLayout != targetInfo.imageLayout) {
         imageInfo = targetInfo;
+        bindings.descriptorsDirty = true;
     }
 #endif
 }
 
+void VulkanPipelineCache::purgeRenderPass(VkRenderPass renderPass) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto iter = mPipelines.begin(); iter != mPipelines.end();) {
+        if (iter->first.renderPass == renderPass) {
+            vkDestroyPipeline(mDevice, iter->second, VKALLOC);
+            iter = mPipelines.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
+
 void VulkanPipelineCache::destroyCache() {
     
-    for (auto& shaderModule : mPipelineInfo.shaders) {
+    for (auto& shaderModule : mBindingState.pipelineInfo.shaders) {
         if (shaderModule != VK_NULL_HANDLE) {
             vkDestroyShaderModule(mDevice, shaderModule, VKALLOC);
             shaderModule = VK_NULL_HANDLE;
@@ -434,10 +618,14 @@ void VulkanPipelineCache::destroyCache() {
         // DELETE_SHADER_MODULE(mDevice, shaderModule, VKALLOC);
     }
 
+    // pipelines created by every binding state are owned here
+    for (auto& pipeline : mPipelines) {
+        vkDestroyPipeline(mDevice, pipeline.second, VKALLOC);
+    }
     for (int i = 0; i < VK_MAX_COMMAND_BUFFERS; i++) {
-        if (mCmdBufferState[i].currentPipeline != nullptr) {
-             vkDestroyPipeline(mDevice, mCmdBufferState[i].currentPipeline, VKALLOC);
-             mCmdBufferState[i].currentPipeline = nullptr;
+        mBindingState.cmdBufferState[i].currentPipeline = VK_NULL_HANDLE;
+        for (auto& state : mThreadBindingStates) {
+            state->cmdBufferState[i].currentPipeline = VK_NULL_HANDLE;
         }
     }
 
@@ -445,20 +633,182 @@ void VulkanPipelineCache::destroyCache() {
     vkDestroyPipelineCache(mDevice, mPipelineCache, VKALLOC);
     
     destroyLayoutsAndDescriptors();
+    destroyBindlessSet();
 }
 
 void VulkanPipelineCache::onCommandBuffer(const VulkanCommandBuffer& cmdbuffer) {
 
-    mCmdBufferIndex = cmdbuffer.cmdBufferIndex;
-    mCmdBufferState[mCmdBufferIndex].scissor = {};
-    // TODO: gc
+    mBindingState.cmdBufferIndex = cmdbuffer.cmdBufferIndex;
+    resetBoundState(mBindingState.cmdBufferState[mBindingState.cmdBufferIndex]);
+    mBindingState.pushConstants.dirty = mBindingState.pushConstants.size != 0;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    // the slot's previous command buffer and its secondaries have completed, their sets can go
+    DescriptorPools& slot = mDescriptorPools[mBindingState.cmdBufferIndex];
+    for (VkDescriptorPool pool : slot.pools) {
+        vkResetDescriptorPool(mDevice, pool, 0);
+    }
+    slot.current = 0;
+
+    // the command buffer that last used a slot has completed once all of them have cycled
+    for (size_t i = 0; i < mRetiredBindlessSlots.size();) {
+        if (++mRetiredBindlessSlots[i].second > VK_MAX_COMMAND_BUFFERS) {
+            mFreeBindlessSlots.push_back(mRetiredBindlessSlots[i].first);
+            mRetiredBindlessSlots[i] = mRetiredBindlessSlots.back();
+            mRetiredBindlessSlots.pop_back();
+        } else {
+            ++i;
+        }
+    }
+}
+
+void VulkanPipelineCache::resetCommandBufferState() {
+    // state bound in the primary command buffer is undefined after executing secondaries
+    resetBoundState(mBindingState.cmdBufferState[mBindingState.cmdBufferIndex]);
+    mBindingState.pushConstants.dirty = mBindingState.pushConstants.size != 0;
+}
+
+void VulkanPipelineCache::resetBoundState(CmdBufferState& state) {
+    state.currentPipeline = VK_NULL_HANDLE;
+    state.scissor = {};
+    state.bindlessBound = false;
+    state.descriptorSetsBound = false;
+    state.vertexBufferCount = 0;
+    state.indexBuffer = VK_NULL_HANDLE;
+}
+
+void VulkanPipelineCache::bindPushConstants(const void* data, uint32_t size) {
+    VR_VK_ASSERT(size <= GRAPHICS_PUSH_CONSTANT_SIZE, "Push constants out of range.");
+    PushConstants& pushConstants = getBindingState().pushConstants;
+    if (pushConstants.size != size || memcmp(pushConstants.data, data, size) != 0) {
+        memcpy(pushConstants.data, data, size);
+        pushConstants.size = size;
+        pushConstants.dirty = true;
+    }
+}
+
+void VulkanPipelineCache::setBindlessTextureCount(uint32_t count) {
+    VR_VK_ASSERT(mPipelineLayout == VK_NULL_HANDLE, "Bindless textures must be enabled before the first draw.");
+    mBindlessTextureCount = count;
+    if (count != 0) {
+        createBindlessSet();
+    }
+}
+
+uint32_t VulkanPipelineCache::allocateBindlessSlot(VkDescriptorImageInfo imageInfo) {
+    VR_ASSERT(mBindlessSet != VK_NULL_HANDLE);
+    uint32_t slot;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mFreeBindlessSlots.empty()) {
+            slot = mFreeBindlessSlots.back();
+            mFreeBindlessSlots.pop_back();
+        } else if (mBindlessSlotCount < mBindlessTextureCount) {
+            slot = mBindlessSlotCount++;
+        } else {
+            VR_ERROR("Bindless texture array is full.\n");
+            return BINDLESS_INVALID_INDEX;
+        }
+    }
+
+    // the slot is unused by pending command buffers, so it may be written while they execute
+    VkWriteDescriptorSet writeInfo = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = mBindlessSet,
+        .dstBinding = 0,
+        .dstArrayElement = slot,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &imageInfo,
+    };
+    vkUpdateDescriptorSets(mDevice, 1, &writeInfo, 0, nullptr);
+    return slot;
+}
+
+void VulkanPipelineCache::releaseBindlessSlot(uint32_t slot) {
+    if (slot == BINDLESS_INVALID_INDEX) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    mRetiredBindlessSlots.push_back(std::make_pair(slot, 0u));
+}
+
+void VulkanPipelineCache::createBindlessSet() {
+    const VkDescriptorBindingFlags bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindingFlags = &bindingFlags,
+    };
+    VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = mBindlessTextureCount,
+        .stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS,
+    };
+    VkDescriptorSetLayoutCreateInfo dlinfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &bindingFlagsInfo,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+    VkResult result = vkCreateDescriptorSetLayout(mDevice, &dlinfo, VKALLOC, &mBindlessSetLayout);
+    VR_VK_CHECK(result == VK_SUCCESS, "Unable to create bindless descriptor set layout.");
+
+    VkDescriptorSetLayoutCreateInfo emptyInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    };
+    result = vkCreateDescriptorSetLayout(mDevice, &emptyInfo, VKALLOC, &mEmptySetLayout);
+    VR_VK_CHECK(result == VK_SUCCESS, "Unable to create empty descriptor set layout.");
+
+    VkDescriptorPoolSize poolSize = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = mBindlessTextureCount,
+    };
+    VkDescriptorPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &poolSize,
+    };
+    result = vkCreateDescriptorPool(mDevice, &poolInfo, VKALLOC, &mBindlessPool);
+    VR_VK_CHECK(result == VK_SUCCESS, "Unable to create bindless descriptor pool.");
+
+    VkDescriptorSetAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = mBindlessPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &mBindlessSetLayout,
+    };
+    result = vkAllocateDescriptorSets(mDevice, &allocInfo, &mBindlessSet);
+    VR_VK_CHECK(result == VK_SUCCESS, "Unable to allocate bindless descriptor set.");
+}
+
+void VulkanPipelineCache::destroyBindlessSet() {
+    if (mBindlessPool == VK_NULL_HANDLE) {
+        return;
+    }
+    vkDestroyDescriptorPool(mDevice, mBindlessPool, VKALLOC);
+    vkDestroyDescriptorSetLayout(mDevice, mBindlessSetLayout, VKALLOC);
+    vkDestroyDescriptorSetLayout(mDevice, mEmptySetLayout, VKALLOC);
+    mBindlessPool = VK_NULL_HANDLE;
+    mBindlessSetLayout = VK_NULL_HANDLE;
+    mEmptySetLayout = VK_NULL_HANDLE;
+    mBindlessSet = VK_NULL_HANDLE;
+    mBindlessSlotCount = 0;
+    mFreeBindlessSlots.clear();
+    mRetiredBindlessSlots.clear();
 }
 
 void VulkanPipelineCache::createLayoutsAndDescriptors() {
-    
+    BindingState& bindings = getBindingState();
+
     uint32_t setLayoutCount = 0;
     uint32_t uniformDesSize = 0;
-    for(auto& uniform : mDescriptorInfo.uniformBuffers) {
+    for(auto& uniform : bindings.descriptorInfo.uniformBuffers) {
         if (uniform != VK_NULL_HANDLE) {
             uniformDesSize++;
         }
@@ -467,7 +817,7 @@ void VulkanPipelineCache::createLayoutsAndDescriptors() {
         setLayoutCount++;
     }
     uint32_t samplerDesSize = 0;
-    for(auto& sampler : mDescriptorInfo.samplers) {
+    for(auto& sampler : bindings.descriptorInfo.samplers) {
         if (sampler.sampler != VK_NULL_HANDLE) {
             samplerDesSize++;
         }
@@ -477,7 +827,7 @@ void VulkanPipelineCache::createLayoutsAndDescriptors() {
     }
     uint32_t inputAttachmentDesSize = 0;
 #ifdef VR_VULKAN_SUPPORT_MULTIPASS
-    for(auto& input : mDescriptorInfo.inputAttachments) {
+    for(auto& input : bindings.descriptorInfo.inputAttachments) {
         if (input.sampler != VK_NULL_HANDLE) {
          inputAttachmentDesSize++;
         }
@@ -534,15 +884,35 @@ void VulkanPipelineCache::createLayoutsAndDescriptors() {
     dlinfo.pBindings = tbindings;
     vkCreateDescriptorSetLayout(mDevice, &dlinfo, VKALLOC, &mDescriptorSetLayouts[2]);
 #endif
+    // with bindless textures every regular set is present, unused ones are empty
+    VkDescriptorSetLayout setLayouts[DESCRIPTOR_TYPE_COUNT + 1];
+    for (uint32_t i = 0; i < DESCRIPTOR_TYPE_COUNT; i++) {
+        setLayouts[i] = mDescriptorSetLayouts[i];
+    }
+    if (mBindlessSetLayout != VK_NULL_HANDLE) {
+        for (uint32_t i = 0; i < DESCRIPTOR_TYPE_COUNT; i++) {
+            if (setLayouts[i] == VK_NULL_HANDLE) {
+                setLayouts[i] = mEmptySetLayout;
+            }
+        }
+        setLayouts[DESCRIPTOR_TYPE_COUNT] = mBindlessSetLayout;
+        setLayoutCount = DESCRIPTOR_TYPE_COUNT + 1;
+    }
+    // material constants and bindless texture indices
+    VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS,
+        .offset = 0,
+        .size = GRAPHICS_PUSH_CONSTANT_SIZE,
+    };
     // create pipeline
     VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo = {};
     pPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pPipelineLayoutCreateInfo.setLayoutCount = setLayoutCount;
-    pPipelineLayoutCreateInfo.pSetLayouts = mDescriptorSetLayouts;
+    pPipelineLayoutCreateInfo.pSetLayouts = setLayouts;
+    pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
     VkResult err = vkCreatePipelineLayout(mDevice, &pPipelineLayoutCreateInfo, VKALLOC, &mPipelineLayout);
     VR_VK_CHECK(err == VK_SUCCESS, "Unable to create pipeline layout.");
-    // create descriptor pool
-    mDescriptorPool = createDescriptorPool(mDescriptorPoolSize);
 }
 
 VkDescriptorPool VulkanPipelineCache::createDescriptorPool(uint32_t size) const {
@@ -551,7 +921,7 @@ VkDescriptorPool VulkanPipelineCache::createDescriptorPool(uint32_t size) const
     VkDescriptorPoolCreateInfo poolInfo {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
         .pNext = nullptr,
-        .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+        .flags = 0,
         .maxSets = size * DESCRIPTOR_TYPE_COUNT,
         .poolSizeCount = DESCRIPTOR_TYPE_COUNT,
         .pPoolSizes = poolSizes
@@ -574,26 +944,51 @@ void VulkanPipelineCache::destroyLayoutsAndDescriptors() {
         return;
     }
 
-    for (auto& descriptorSet : mDescriptorSets) {
-        descriptorSet.clear();
-    }
-
     vkDestroyPipelineLayout(mDevice, mPipelineLayout, VKALLOC);
     mPipelineLayout = VK_NULL_HANDLE;
+    mLayoutsCreated.store(false, std::memory_order_relaxed);
 
     for (int i = 0; i < DESCRIPTOR_TYPE_COUNT; i++) {
         vkDestroyDescriptorSetLayout(mDevice, mDescriptorSetLayouts[i], VKALLOC);
         mDescriptorSetLayouts[i] = {};
     }
 
-    vkDestroyDescriptorPool(mDevice, mDescriptorPool, VKALLOC);
-    mDescriptorPool = VK_NULL_HANDLE;
-    for (int i = 0; i < VK_MAX_COMMAND_BUFFERS; i++) {
-        delete mCmdBufferState[i].currentDescriptorSetInfo;
-        mCmdBufferState[i].currentDescriptorSetInfo = nullptr;
+    // the sets go away with the pools
+    for (auto& slot : mDescriptorPools) {
+        for (VkDescriptorPool pool : slot.pools) {
+            vkDestroyDescriptorPool(mDevice, pool, VKALLOC);
+        }
+        slot.pools.clear();
+        slot.current = 0;
     }
 }
 
+VulkanPipelineCache::BindingState* VulkanPipelineCache::createBindingState() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mThreadBindingStates.emplace_back(new BindingState());
+    return mThreadBindingStates.back().get();
+}
+
+void VulkanPipelineCache::beginThreadRecording(BindingState* state, uint32_t cmdBufferIndex) {
+    VR_ASSERT(state != nullptr);
+    // start from what the recording thread has bound so far
+    state->pipelineInfo = mBindingState.pipelineInfo;
+    state->descriptorInfo = mBindingState.descriptorInfo;
+    state->cmdBufferIndex = cmdBufferIndex;
+    state->pushConstants = mBindingState.pushConstants;
+    state->vertexLayoutHash = mBindingState.vertexLayoutHash;
+    state->pushConstants.dirty = state->pushConstants.size != 0;
+    state->pipelineDirty = true;
+    state->descriptorsDirty = true;
+    // a new secondary command buffer has nothing bound yet
+    resetBoundState(state->cmdBufferState[cmdBufferIndex]);
+    sThreadBindingState = state;
+}
+
+void VulkanPipelineCache::endThreadRecording() {
+    sThreadBindingState = nullptr;
+}
+
 static VulkanPipelineCache::RasterState createDefaultRasterState() {
 
     VkPipelineRasterizationStateCreateInfo rasterization = {};
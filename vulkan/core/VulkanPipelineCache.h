@@ -1,7 +1,12 @@
 #ifndef VULKAN_PIPELINE_CACHE_H
 #define VULKAN_PIPELINE_CACHE_H
 
+#include <atomic>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <utility>
 #include <vector>
 #include "NonCopyable.h"
 #include "VulkanMacros.h"
@@ -20,6 +25,10 @@ public:
         VkVertexInputAttributeDescription attributes[VERTEX_ATTRIBUTE_COUNT] = {};
         // buffer1, buffer2 ...
         VkVertexInputBindingDescription buffers[VERTEX_ATTRIBUTE_COUNT] = {};
+        // computeHash() of the two arrays above, compared instead of the arrays on bind
+        uint64_t hash = 0;
+
+        void computeHash();
     };
 
     struct RasterState {
@@ -48,15 +57,44 @@ public:
         VkDeviceSize uniformBufferSizes[UBUFFER_BINDING_COUNT] = {}; // 8
     };
 
-    // descriptor sets
-    struct DescriptorSetInfo {
-        VkDescriptorSet descSets[DESCRIPTOR_TYPE_COUNT] = {};
-    };
-
+    // what is bound in one command buffer, draws skip binds that would not change it
     struct CmdBufferState {
         VkPipeline currentPipeline = VK_NULL_HANDLE;
-        DescriptorSetInfo* currentDescriptorSetInfo = nullptr;
         VkRect2D scissor = {};
+        bool bindlessBound = false;
+        bool descriptorSetsBound = false;
+        VkBuffer vertexBuffers[VERTEX_ATTRIBUTE_COUNT] = {};
+        VkDeviceSize vertexOffsets[VERTEX_ATTRIBUTE_COUNT] = {};
+        uint32_t vertexBufferCount = 0;
+        VkBuffer indexBuffer = VK_NULL_HANDLE;
+        VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+    };
+
+    struct PushConstants {
+        uint8_t data[GRAPHICS_PUSH_CONSTANT_SIZE] = {};
+        uint32_t size = 0;
+        bool dirty = false;
+    };
+
+    // everything bound by one recording thread
+    struct BindingState {
+        PipelineInfo pipelineInfo = {};
+        DescriptorInfo descriptorInfo = {};
+        CmdBufferState cmdBufferState[VK_MAX_COMMAND_BUFFERS] = {};
+        PushConstants pushConstants = {};
+        uint64_t vertexLayoutHash = 0;
+        uint32_t cmdBufferIndex = 0;
+        // pipelineInfo or descriptorInfo changed since they were last bound
+        bool pipelineDirty = true;
+        bool descriptorsDirty = true;
+    };
+
+    struct PipelineInfoHash {
+        size_t operator()(const PipelineInfo& info) const;
+    };
+
+    struct PipelineInfoEqual {
+        bool operator()(const PipelineInfo& a, const PipelineInfo& b) const;
     };
 
     VulkanPipelineCache();
@@ -68,6 +106,8 @@ public:
     bool bindDescriptorSets(VkCommandBuffer cmdbuffer);
     void bindPipeline(VkCommandBuffer cmdbuffer);
     void bindScissor(VkCommandBuffer cmdbuffer, VkRect2D scissor);
+    void bindVertexBuffers(VkCommandBuffer cmdbuffer, uint32_t bufferCount, const VkBuffer* buffers, const VkDeviceSize* offsets);
+    void bindIndexBuffer(VkCommandBuffer cmdbuffer, VkBuffer buffer, VkIndexType indexType);
     void bindProgram(const VkShaderModule& vertex, const VkShaderModule& fragment);
     void bindRasterState(const RasterState& rasterState);
     void bindRenderPass(VkRenderPass renderPass, int subpassIndex);
@@ -78,39 +118,79 @@ public:
     void bindVertexAttributeArray(const VertexAttributeArray& varray);
     void unbindUniformBuffer(VkBuffer uniformBuffer);
     void unbindImageView(VkImageView imageView);
-
+    void bindPushConstants(const void* data, uint32_t size);
+
+    // bindless textures live in set DESCRIPTOR_TYPE_COUNT, slots are recycled once no frame can still use them
+    void setBindlessTextureCount(uint32_t count);
+    bool isBindlessEnabled() const { return mBindlessSet != VK_NULL_HANDLE; }
+    uint32_t allocateBindlessSlot(VkDescriptorImageInfo imageInfo);
+    void releaseBindlessSlot(uint32_t slot);
+
+    // worker threads bind into their own state while recording secondary command buffers
+    BindingState* createBindingState();
+    void beginThreadRecording(BindingState* state, uint32_t cmdBufferIndex);
+    void endThreadRecording();
+    // after vkCmdExecuteCommands the primary command buffer must bind everything again
+    void resetCommandBufferState();
+
+    // destroys the pipelines created for renderPass, its handle may be reused by an incompatible pass
+    void purgeRenderPass(VkRenderPass renderPass);
     void destroyCache();
     void onCommandBuffer(const VulkanCommandBuffer& cmdbuffer) override;
 
 private:
 
-    void createDescriptorSets(VkDescriptorSet descriptors[DESCRIPTOR_TYPE_COUNT], bool* bound);
-    bool createPipeline(VkPipeline* pipeline);
+    BindingState& getBindingState() { return sThreadBindingState ? *sThreadBindingState : mBindingState; }
+    void unbindUniformBuffer(BindingState& bindings, VkBuffer uniformBuffer);
+    void unbindImageView(BindingState& bindings, VkImageView imageView);
+    void createDescriptorSets(VkDescriptorSet descriptors[DESCRIPTOR_TYPE_COUNT]);
+    VkPipeline createPipeline(const PipelineInfo& pipelineInfo);
+    static void resetBoundState(CmdBufferState& state);
     void createLayoutsAndDescriptors();
     void destroyLayoutsAndDescriptors();
     VkDescriptorPool createDescriptorPool(uint32_t size) const;
+    void createBindlessSet();
+    void destroyBindlessSet();
+
+    struct DescriptorPools {
+        std::vector<VkDescriptorPool> pools;
+        uint32_t current = 0;
+    };
 
 private:
     VkDevice mDevice = VK_NULL_HANDLE;
     const RasterState mDefaultRasterState = {};
 
-    DescriptorInfo mDescriptorInfo = {};
+    BindingState mBindingState = {};
+    std::vector<std::unique_ptr<BindingState>> mThreadBindingStates;
+    static thread_local BindingState* sThreadBindingState;
     uint32_t mDescriptorTypeCount = 0;
-    PipelineInfo mPipelineInfo = {};
-    
-    CmdBufferState mCmdBufferState[VK_MAX_COMMAND_BUFFERS] = {};
+    // guards layouts, the descriptor pools and pipeline creation shared by all threads
+    std::mutex mMutex;
 
     VkDescriptorSetLayout mDescriptorSetLayouts[DESCRIPTOR_TYPE_COUNT] = {};
-    std::vector<VkDescriptorSet> mDescriptorSets[DESCRIPTOR_TYPE_COUNT] = {};
     
     VkPipelineLayout mPipelineLayout = VK_NULL_HANDLE;
-    std::vector<VkPipeline> mPipelines = {};
+    // set once mPipelineLayout and the set layouts exist, checked without the lock on every bind
+    std::atomic<bool> mLayoutsCreated{false};
+    // hashed and compared field by field, the raster state's create infos have padding
+    std::unordered_map<PipelineInfo, VkPipeline, PipelineInfoHash, PipelineInfoEqual> mPipelines;
     VkPipelineCache mPipelineCache  = VK_NULL_HANDLE;
-    
-    uint32_t mCmdBufferIndex = 0;
 
-    VkDescriptorPool mDescriptorPool = {};
+    // sets are never freed one by one, a slot's pools are reset once its command buffer is recycled
+    DescriptorPools mDescriptorPools[VK_MAX_COMMAND_BUFFERS] = {};
     uint32_t mDescriptorPoolSize = 400;
+
+    uint32_t mBindlessTextureCount = 0;
+    VkDescriptorSetLayout mBindlessSetLayout = VK_NULL_HANDLE;
+    // fills the unused regular sets so the bindless set keeps a fixed index
+    VkDescriptorSetLayout mEmptySetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool mBindlessPool = VK_NULL_HANDLE;
+    VkDescriptorSet mBindlessSet = VK_NULL_HANDLE;
+    uint32_t mBindlessSlotCount = 0;
+    std::vector<uint32_t> mFreeBindlessSlots;
+    // released slots and the number of command buffers begun since
+    std::vector<std::pair<uint32_t, uint32_t>> mRetiredBindlessSlots;
 };
 
 } // namespace backend
@@ -0,0 +1,234 @@
+#include "VulkanProfiler.h"
+
+namespace VR {
+namespace backend {
+
+VulkanProfiler::VulkanProfiler(VulkanContext& context) : mContext(context) {
+}
+
+VulkanProfiler::~VulkanProfiler() {
+    // Do nothing
+}
+
+void VulkanProfiler::create() {
+    mCreated = true;
+
+    uint32_t queueFamiliesCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(mContext.physicalDevice, &queueFamiliesCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamiliesProperties(queueFamiliesCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(mContext.physicalDevice, &queueFamiliesCount, queueFamiliesProperties.data());
+    const uint32_t validBits = queueFamiliesProperties[mContext.graphicsQueueFamilyIndex].timestampValidBits;
+    if (validBits == 0) {
+        VR_PRINT("Timestamp queries are not supported, gpu profiling is disabled.\n");
+        return;
+    }
+    mTimestampMask = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+    mTimestampPeriod = mContext.physicalDeviceProperties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo queryPoolInfo = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = PROFILER_FRAME_COUNT * PROFILER_QUERIES_PER_FRAME,
+    };
+    VkResult result = vkCreateQueryPool(mContext.device, &queryPoolInfo, VKALLOC, &mQueryPool);
+    VR_VK_ASSERT(result == VK_SUCCESS, "vkCreateQueryPool error.");
+}
+
+void VulkanProfiler::createStatisticsPool() {
+    VkQueryPoolCreateInfo queryPoolInfo = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+        .queryCount = PROFILER_FRAME_COUNT * PROFILER_STATISTICS_PER_FRAME,
+        .pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
+    };
+    VkResult result = vkCreateQueryPool(mContext.device, &queryPoolInfo, VKALLOC, &mStatisticsPool);
+    VR_VK_ASSERT(result == VK_SUCCESS, "vkCreateQueryPool error.");
+}
+
+void VulkanProfiler::onCommandBuffer(const VulkanCommandBuffer& cmdbuffer) {
+    if (!mCreated) {
+        create();
+    }
+    // first command buffer of the frame, the range's previous frame has completed by now
+    FrameQueries& frame = mFrames[mFrameIndex];
+    if (mQueryPool != VK_NULL_HANDLE && !frame.reset) {
+        const uint32_t firstQuery = mFrameIndex * PROFILER_QUERIES_PER_FRAME;
+        readback(frame, firstQuery);
+        vkCmdResetQueryPool(cmdbuffer.cmdbuffer, mQueryPool, firstQuery, PROFILER_QUERIES_PER_FRAME);
+        frame.reset = true;
+    }
+    if (mStatisticsEnabled && !frame.statisticsReset) {
+        if (mStatisticsPool == VK_NULL_HANDLE) {
+            createStatisticsPool();
+        }
+        const uint32_t firstQuery = mFrameIndex * PROFILER_STATISTICS_PER_FRAME;
+        readbackStatistics(frame, firstQuery);
+        vkCmdResetQueryPool(cmdbuffer.cmdbuffer, mStatisticsPool, firstQuery, PROFILER_STATISTICS_PER_FRAME);
+        frame.statisticsReset = true;
+    }
+}
+
+uint32_t VulkanProfiler::getScopeIndex(const char* name) {
+    auto found = mScopeIndices.find(name);
+    if (found != mScopeIndices.end()) {
+        return found->second;
+    }
+    const uint32_t nameIndex = (uint32_t) mHistory.size();
+    mScopeIndices[name] = nameIndex;
+    mHistory.push_back({ name, {}, 0, 0 });
+    mStatistics.push_back({ name, 0, 0, 0, 0, 0 });
+    mHasStatistics.push_back(false);
+    return nameIndex;
+}
+
+void VulkanProfiler::beginScope(VkCommandBuffer cmdbuffer, const char* name) {
+    FrameQueries& frame = mFrames[mFrameIndex];
+    if (mQueryPool == VK_NULL_HANDLE || !frame.reset || frame.queryCount + 2 > PROFILER_QUERIES_PER_FRAME) {
+        mOpenScopes.push_back(-1);
+        return;
+    }
+
+    const uint32_t nameIndex = getScopeIndex(name);
+    const uint32_t query = mFrameIndex * PROFILER_QUERIES_PER_FRAME + frame.queryCount;
+    vkCmdWriteTimestamp(cmdbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, mQueryPool, query);
+    mOpenScopes.push_back((int32_t) frame.scopes.size());
+    frame.scopes.push_back({ nameIndex, query });
+    frame.queryCount += 2;
+}
+
+void VulkanProfiler::endScope(VkCommandBuffer cmdbuffer) {
+    VR_VK_ASSERT(!mOpenScopes.empty(), "No gpu scope to end.");
+    const int32_t scopeIndex = mOpenScopes.back();
+    mOpenScopes.pop_back();
+    if (scopeIndex < 0) {
+        return;
+    }
+    const Scope& scope = mFrames[mFrameIndex].scopes[scopeIndex];
+    vkCmdWriteTimestamp(cmdbuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, mQueryPool, scope.query + 1);
+}
+
+void VulkanProfiler::setPipelineStatisticsEnabled(bool enabled) {
+    VR_VK_ASSERT(!enabled || mContext.pipelineStatisticsSupported, "Pipeline statistics queries are not supported.");
+    mStatisticsEnabled = enabled && mContext.pipelineStatisticsSupported;
+}
+
+void VulkanProfiler::beginStatistics(VkCommandBuffer cmdbuffer, const char* name) {
+    FrameQueries& frame = mFrames[mFrameIndex];
+    VR_VK_ASSERT(!mStatisticsOpen, "Pipeline statistics scopes do not nest.");
+    if (!mStatisticsEnabled || !frame.statisticsReset || frame.statistics.size() >= PROFILER_STATISTICS_PER_FRAME) {
+        return;
+    }
+    const uint32_t query = mFrameIndex * PROFILER_STATISTICS_PER_FRAME + (uint32_t) frame.statistics.size();
+    frame.statistics.push_back(getScopeIndex(name));
+    vkCmdBeginQuery(cmdbuffer, mStatisticsPool, query, 0);
+    mStatisticsOpen = true;
+}
+
+void VulkanProfiler::endStatistics(VkCommandBuffer cmdbuffer) {
+    if (!mStatisticsOpen) {
+        return;
+    }
+    const FrameQueries& frame = mFrames[mFrameIndex];
+    const uint32_t query = mFrameIndex * PROFILER_STATISTICS_PER_FRAME + (uint32_t) frame.statistics.size() - 1;
+    vkCmdEndQuery(cmdbuffer, mStatisticsPool, query);
+    mStatisticsOpen = false;
+}
+
+void VulkanProfiler::endFrame() {
+    VR_VK_ASSERT(mOpenScopes.empty() && !mStatisticsOpen, "Gpu scopes are still open at the end of the frame.");
+    mOpenScopes.clear();
+    mFrameIndex = (mFrameIndex + 1) % PROFILER_FRAME_COUNT;
+    mFrames[mFrameIndex].reset = false;
+    mFrames[mFrameIndex].statisticsReset = false;
+}
+
+void VulkanProfiler::readback(FrameQueries& frame, uint32_t firstQuery) {
+    if (frame.queryCount != 0) {
+        uint64_t timestamps[PROFILER_QUERIES_PER_FRAME];
+        VkResult result = vkGetQueryPoolResults(mContext.device, mQueryPool, firstQuery, frame.queryCount, sizeof(timestamps), timestamps,
+                sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        // an unfinished frame is dropped rather than waited for
+        if (result == VK_SUCCESS) {
+            for (const Scope& scope : frame.scopes) {
+                const uint32_t begin = scope.query - firstQuery;
+                const uint64_t ticks = ((timestamps[begin + 1] & mTimestampMask) - (timestamps[begin] & mTimestampMask)) & mTimestampMask;
+                ScopeHistory& history = mHistory[scope.nameIndex];
+                history.samples[history.next] = double(ticks) * mTimestampPeriod * 1e-6;
+                history.next = (history.next + 1) % PROFILER_HISTORY_SIZE;
+                history.count = std::min(history.count + 1, (uint32_t) PROFILER_HISTORY_SIZE);
+            }
+        }
+    }
+    frame.scopes.clear();
+    frame.queryCount = 0;
+}
+
+void VulkanProfiler::readbackStatistics(FrameQueries& frame, uint32_t firstQuery) {
+    const uint32_t count = (uint32_t) frame.statistics.size();
+    if (count != 0) {
+        // results come in bit order: vertices, primitives, vertex invocations, clipping primitives, fragment invocations
+        uint64_t results[PROFILER_STATISTICS_PER_FRAME][5];
+        VkResult result = vkGetQueryPoolResults(mContext.device, mStatisticsPool, firstQuery, count, sizeof(results), results,
+                sizeof(results[0]), VK_QUERY_RESULT_64_BIT);
+        if (result == VK_SUCCESS) {
+            for (uint32_t i = 0; i < count; i++) {
+                PipelineStatistics& statistics = mStatistics[frame.statistics[i]];
+                statistics.inputAssemblyVertices = results[i][0];
+                statistics.inputAssemblyPrimitives = results[i][1];
+                statistics.vertexShaderInvocations = results[i][2];
+                statistics.clippingPrimitives = results[i][3];
+                statistics.fragmentShaderInvocations = results[i][4];
+                mHasStatistics[frame.statistics[i]] = true;
+            }
+        }
+    }
+    frame.statistics.clear();
+}
+
+std::vector<VulkanProfiler::PipelineStatistics> VulkanProfiler::getPipelineStatistics() const {
+    std::vector<PipelineStatistics> statistics;
+    for (size_t i = 0; i < mStatistics.size(); i++) {
+        if (mHasStatistics[i]) {
+            statistics.push_back(mStatistics[i]);
+        }
+    }
+    return statistics;
+}
+
+std::vector<VulkanProfiler::ScopeTiming> VulkanProfiler::getTimings() const {
+    std::vector<ScopeTiming> timings;
+    timings.reserve(mHistory.size());
+    for (const ScopeHistory& history : mHistory) {
+        if (history.count == 0) {
+            continue;
+        }
+        ScopeTiming timing = { history.name, history.samples[0], 0.0, history.samples[0], history.count };
+        for (uint32_t i = 0; i < history.count; i++) {
+            timing.minMs = std::min(timing.minMs, history.samples[i]);
+            timing.maxMs = std::max(timing.maxMs, history.samples[i]);
+            timing.avgMs += history.samples[i];
+        }
+        timing.avgMs /= history.count;
+        timings.push_back(timing);
+    }
+    return timings;
+}
+
+void VulkanProfiler::terminate() {
+    if (mQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(mContext.device, mQueryPool, VKALLOC);
+        mQueryPool = VK_NULL_HANDLE;
+    }
+    if (mStatisticsPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(mContext.device, mStatisticsPool, VKALLOC);
+        mStatisticsPool = VK_NULL_HANDLE;
+    }
+    mCreated = false;
+}
+
+} // namespace backend
+} // namespace VR
@@ -0,0 +1,113 @@
+#ifndef VULKAN_PROFILER_H
+#define VULKAN_PROFILER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "VulkanContext.h"
+
+namespace VR {
+namespace backend {
+
+// gpu time of named scopes from timestamp query pairs, results are read without waiting
+// PROFILER_FRAME_COUNT frames later when the frame's query range is reset for reuse
+class VulkanProfiler : public CommandBufferObserver, NonCopyable {
+public:
+
+    struct ScopeTiming {
+        std::string name;
+        double minMs;
+        double avgMs;
+        double maxMs;
+        uint32_t sampleCount;
+    };
+
+    // counts of the last frame read back
+    struct PipelineStatistics {
+        std::string name;
+        uint64_t inputAssemblyVertices;
+        uint64_t inputAssemblyPrimitives;
+        uint64_t vertexShaderInvocations;
+        uint64_t clippingPrimitives;
+        uint64_t fragmentShaderInvocations;
+    };
+
+    explicit VulkanProfiler(VulkanContext& context);
+    virtual ~VulkanProfiler();
+
+    bool isSupported() const { return mQueryPool != VK_NULL_HANDLE; }
+    // scopes nest, they must be closed in the frame they were opened in
+    void beginScope(VkCommandBuffer cmdbuffer, const char* name);
+    void endScope(VkCommandBuffer cmdbuffer);
+    void endFrame();
+    // rolling min/avg/max over the last PROFILER_HISTORY_SIZE samples of every scope
+    std::vector<ScopeTiming> getTimings() const;
+
+    // pipeline statistics queries need the pipelineStatisticsQuery feature and are off by default,
+    // changes apply from the next frame
+    bool isPipelineStatisticsSupported() const { return mContext.pipelineStatisticsSupported; }
+    void setPipelineStatisticsEnabled(bool enabled);
+    // statistics scopes do not nest and must be begun and ended outside of render passes
+    void beginStatistics(VkCommandBuffer cmdbuffer, const char* name);
+    void endStatistics(VkCommandBuffer cmdbuffer);
+    std::vector<PipelineStatistics> getPipelineStatistics() const;
+
+    void terminate();
+    void onCommandBuffer(const VulkanCommandBuffer& cmdbuffer) override;
+
+private:
+
+    struct Scope {
+        uint32_t nameIndex;
+        // begin timestamp, the end timestamp follows it
+        uint32_t query;
+    };
+
+    struct FrameQueries {
+        std::vector<Scope> scopes;
+        uint32_t queryCount = 0;
+        bool reset = false;
+        // pipeline statistics, one query per scope
+        std::vector<uint32_t> statistics;
+        bool statisticsReset = false;
+    };
+
+    struct ScopeHistory {
+        std::string name;
+        double samples[PROFILER_HISTORY_SIZE];
+        uint32_t count;
+        uint32_t next;
+    };
+
+    void create();
+    void createStatisticsPool();
+    uint32_t getScopeIndex(const char* name);
+    void readback(FrameQueries& frame, uint32_t firstQuery);
+    void readbackStatistics(FrameQueries& frame, uint32_t firstQuery);
+
+    VulkanContext& mContext;
+    bool mCreated = false;
+    VkQueryPool mQueryPool = VK_NULL_HANDLE;
+    uint64_t mTimestampMask = 0;
+    double mTimestampPeriod = 1.0;
+
+    FrameQueries mFrames[PROFILER_FRAME_COUNT];
+    uint32_t mFrameIndex = 0;
+    // open scopes of the current frame, -1 when the frame ran out of queries
+    std::vector<int32_t> mOpenScopes;
+
+    bool mStatisticsEnabled = false;
+    bool mStatisticsOpen = false;
+    VkQueryPool mStatisticsPool = VK_NULL_HANDLE;
+
+    std::unordered_map<std::string, uint32_t> mScopeIndices;
+    std::vector<ScopeHistory> mHistory;
+    // indexed like mHistory, statistics of scopes that have none are never reported
+    std::vector<PipelineStatistics> mStatistics;
+    std::vector<bool> mHasStatistics;
+};
+
+} // namespace backend
+} // namespace VR
+
+#endif // VULKAN_PROFILER_H
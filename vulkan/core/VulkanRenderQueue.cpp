@@ -0,0 +1,148 @@
+#include "VulkanRenderQueue.h"
+
+namespace VR {
+namespace backend {
+
+static uint32_t quantizeDepth(float depth, uint32_t bits) {
+    const float clamped = std::min(std::max(depth, 0.0f), 1.0f);
+    return (uint32_t) (clamped * (float) ((1u << bits) - 1));
+}
+
+static uint32_t hashValue(uint32_t hash, uint64_t value) {
+    hash = (hash ^ (uint32_t) value) * 16777619u;
+    return (hash ^ (uint32_t) (value >> 32)) * 16777619u;
+}
+
+uint64_t VulkanRenderQueue::makeSortKey(uint8_t pass, bool blended, uint32_t pipelineHash, uint32_t materialId, float depth) {
+    uint64_t key = (uint64_t) pass << 56;
+    if (!blended) {
+        key |= (uint64_t) (pipelineHash & 0xFFFFFFu) << 31;
+        key |= (uint64_t) (materialId & 0xFFFFu) << 15;
+        key |= quantizeDepth(depth, 15);
+    } else {
+        const uint32_t maxDepth = (1u << 24) - 1;
+        key |= 1ull << 55;
+        key |= (uint64_t) (maxDepth - quantizeDepth(depth, 24)) << 31;
+        key |= (uint64_t) (pipelineHash & 0xFFFFu) << 15;
+        key |= materialId & 0x7FFFu;
+    }
+    return key;
+}
+
+uint32_t VulkanRenderQueue::hashPipeline(const PipelineState& pipelineState, const VulkanRenderPrimitive* primitive) {
+    // the union's padding bytes are not initialized, so hash the fields one by one
+    const RasterStateT& raster = pipelineState.rasterState;
+    uint32_t hash = 2166136261u;
+    hash = hashValue(hash, (uintptr_t) pipelineState.program.get());
+    hash = hashValue(hash, (uint64_t) raster.culling |
+                           (uint64_t) raster.blendEquationRGB << 8 |
+                           (uint64_t) raster.blendEquationAlpha << 16 |
+                           (uint64_t) raster.blendFunctionSrcRGB << 24 |
+                           (uint64_t) raster.blendFunctionSrcAlpha << 32 |
+                           (uint64_t) raster.blendFunctionDstRGB << 40 |
+                           (uint64_t) raster.blendFunctionDstAlpha << 48 |
+                           (uint64_t) raster.depthFunc << 56);
+    hash = hashValue(hash, (uint64_t) raster.depthWrite |
+                           (uint64_t) raster.colorWrite << 1 |
+                           (uint64_t) raster.alphaToCoverage << 2 |
+                           (uint64_t) raster.inverseFrontFaces << 3);
+    if (primitive != nullptr) {
+        hash = hashValue(hash, primitive->primitiveTopology);
+        if (primitive->vertexBuffer != nullptr) {
+            hash = hashValue(hash, primitive->vertexBuffer->varray.hash);
+        }
+    }
+    return hash;
+}
+
+void VulkanRenderQueue::reserve(size_t count) {
+    mPackets.reserve(count);
+    mEntries.reserve(count);
+    mScratch.reserve(count);
+}
+
+void VulkanRenderQueue::push(uint64_t sortKey, const PipelineState& pipelineState, const VulkanRenderPrimitive* primitive,
+        const Material* material, uint32_t instanceCount, uint32_t lod) {
+    VR_ASSERT(primitive != nullptr && material != nullptr);
+    mEntries.push_back({ sortKey, (uint32_t) mPackets.size() });
+    mPackets.push_back({ pipelineState, primitive, material, instanceCount, lod });
+}
+
+void VulkanRenderQueue::submit(VulkanRuntime& runtime) {
+    VR_TRACE_SCOPE("VulkanRenderQueue::submit");
+    sort();
+    const Material* boundMaterial = nullptr;
+    for (const SortEntry& entry : mEntries) {
+        DrawPacket& packet = mPackets[entry.index];
+        if (packet.material != boundMaterial) {
+            bindMaterial(runtime, *packet.material);
+            boundMaterial = packet.material;
+        }
+        runtime.draw(packet.pipelineState, packet.primitive, packet.instanceCount, packet.lod);
+    }
+    clear();
+}
+
+void VulkanRenderQueue::bindMaterial(VulkanRuntime& runtime, const Material& material) {
+    for (uint32_t i = 0; i < UBUFFER_BINDING_COUNT; i++) {
+        const Material::UniformBinding& binding = material.uniformBuffers[i];
+        if (binding.buffer == nullptr) {
+            continue;
+        }
+        if (binding.size == 0) {
+            runtime.bindUniformBuffer(i, binding.buffer);
+        } else {
+            runtime.bindUniformBufferRange(i, binding.buffer, binding.offset, binding.size);
+        }
+    }
+    for (uint32_t i = 0; i < SAMPLER_BINDING_COUNT; i++) {
+        // bindSampler takes its argument over
+        VulkanSampler sampler = material.samplers[i];
+        runtime.bindSampler(i, sampler);
+    }
+    if (material.pushConstantSize != 0) {
+        runtime.pushConstants(material.pushConstants, material.pushConstantSize);
+    }
+}
+
+void VulkanRenderQueue::clear() {
+    mPackets.clear();
+    mEntries.clear();
+}
+
+void VulkanRenderQueue::sort() {
+    // LSD radix sort, 8 bits per pass, stable so equal keys keep their push order
+    const size_t count = mEntries.size();
+    if (count < 2) {
+        return;
+    }
+    mScratch.resize(count);
+    SortEntry* src = mEntries.data();
+    SortEntry* dst = mScratch.data();
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        uint32_t histogram[256] = {};
+        for (size_t i = 0; i < count; i++) {
+            histogram[(src[i].key >> shift) & 0xFF]++;
+        }
+        // all keys share this byte, e.g. the pass byte of a single pass
+        if (histogram[(src[0].key >> shift) & 0xFF] == count) {
+            continue;
+        }
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < 256; bucket++) {
+            const uint32_t bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+        for (size_t i = 0; i < count; i++) {
+            dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+    if (src != mEntries.data()) {
+        mEntries.swap(mScratch);
+    }
+}
+
+} // namespace backend
+} // namespace VR
@@ -0,0 +1,74 @@
+#ifndef VULKAN_RENDER_QUEUE_H
+#define VULKAN_RENDER_QUEUE_H
+
+#include <vector>
+#include "VulkanRuntime.h"
+
+namespace VR {
+namespace backend {
+
+// collects the draws of a render pass and submits them ordered by a 64-bit sort key, so draws
+// sharing a pipeline and material run back to back and skip the binds of the previous one
+class VulkanRenderQueue : public NonCopyable {
+public:
+
+    // the uniform buffers, samplers and push constants of a material, bound by submit() whenever the
+    // next packet uses a different material. Unset samplers are unbound, unset uniform buffers keep
+    // what was bound before, e.g. per view buffers bound ahead of submit()
+    struct Material {
+        struct UniformBinding {
+            VulkanUniformBuffer* buffer = nullptr;
+            uint32_t offset = 0;
+            uint32_t size = 0; // 0 binds the whole buffer
+        };
+        UniformBinding uniformBuffers[UBUFFER_BINDING_COUNT];
+        VulkanSampler samplers[SAMPLER_BINDING_COUNT];
+        uint8_t pushConstants[GRAPHICS_PUSH_CONSTANT_SIZE] = {};
+        uint32_t pushConstantSize = 0;
+    };
+
+    // materials are not copied, they must outlive submit()
+    struct DrawPacket {
+        PipelineState pipelineState;
+        const VulkanRenderPrimitive* primitive;
+        const Material* material;
+        uint32_t instanceCount;
+        uint32_t lod;
+    };
+
+    // opaque:  pass 8 | 0 | pipeline 24 | material 16 | depth 15, front to back inside a material
+    // blended: pass 8 | 1 | depth 24 | pipeline 16 | material 15, back to front
+    // pass orders buckets inside the render pass (e.g. opaque, sky, transparent), depth is view depth in [0, 1]
+    static uint64_t makeSortKey(uint8_t pass, bool blended, uint32_t pipelineHash, uint32_t materialId, float depth);
+    // pipeline part of the key from what selects the VkPipeline: program, raster state, topology and vertex layout
+    static uint32_t hashPipeline(const PipelineState& pipelineState, const VulkanRenderPrimitive* primitive);
+
+    void reserve(size_t count);
+    void push(uint64_t sortKey, const PipelineState& pipelineState, const VulkanRenderPrimitive* primitive,
+              const Material* material, uint32_t instanceCount = 1, uint32_t lod = 0);
+    // radix sorts the packets and draws them in key order, the queue is empty afterwards
+    void submit(VulkanRuntime& runtime);
+    void clear();
+
+    size_t size() const { return mPackets.size(); }
+    bool empty() const { return mPackets.empty(); }
+
+private:
+
+    struct SortEntry {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    void sort();
+    static void bindMaterial(VulkanRuntime& runtime, const Material& material);
+
+    std::vector<DrawPacket> mPackets;
+    std::vector<SortEntry> mEntries;
+    std::vector<SortEntry> mScratch;
+};
+
+} // namespace backend
+} // namespace VR
+
+#endif // VULKAN_RENDER_QUEUE_H
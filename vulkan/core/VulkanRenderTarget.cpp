@@ -278,6 +278,131 @@ void VulkanRenderPrimitive::setPrimitiveType(PrimitiveType pt) {
     }
 }
 
+VulkanVertexBuffer::VulkanVertexBuffer(VulkanContext& context, VulkanMemoryPool& memoryPool, uint8_t bufferCount, uint8_t attributeCount,
+        uint32_t elementCount, AttributeArray const& attribs) : mContext(context), mMemoryPool(memoryPool),
+        attributes(attribs), vertexCount(elementCount), bufferCount(bufferCount), attributeCount(attributeCount), buffers(bufferCount) {
+    VR_ASSERT(bufferCount <= MAX_VERTEX_ATTRIBUTE_COUNT);
+    updateVertexInput();
+    updateGpuBuffers();
+}
+
+void VulkanVertexBuffer::setBuffer(uint32_t index, VulkanBuffer* buffer) {
+    VR_ASSERT(index < buffers.size());
+    buffers[index] = buffer;
+    updateGpuBuffers();
+}
+
+void VulkanVertexBuffer::updateVertexInput() {
+    // attributes and bindings are packed to the front, the pipeline counts the used entries
+    varray = {};
+    uint32_t attribCount = 0;
+    uint32_t usedBindingCount = 0;
+    for (uint32_t attribIndex = 0; attribIndex < attributes.size(); attribIndex++) {
+        const Attribute& attrib = attributes[attribIndex];
+        if (attrib.buffer == Attribute::BUFFER_UNUSED) {
+            continue;
+        }
+        VR_ASSERT(attrib.buffer < bufferCount);
+        const bool isInteger = attrib.flags & Attribute::FLAG_INTEGER_TARGET;
+        const bool isNormalized = attrib.flags & Attribute::FLAG_NORMALIZED;
+        varray.attributes[attribCount++] = {
+            .location = attribIndex, // GLSL layout specifier
+            .binding = attrib.buffer,
+            .format = getVkFormat(attrib.type, isNormalized, isInteger),
+            .offset = attrib.offset,
+        };
+
+        // several attributes read from one interleaved buffer through a single binding
+        uint32_t bindingIndex = 0;
+        while (bindingIndex < usedBindingCount && varray.buffers[bindingIndex].binding != attrib.buffer) {
+            bindingIndex++;
+        }
+        const VkVertexInputRate inputRate = (attrib.flags & Attribute::FLAG_INSTANCE) ?
+                VK_VERTEX_INPUT_RATE_INSTANCE : VK_VERTEX_INPUT_RATE_VERTEX;
+        if (bindingIndex == usedBindingCount) {
+            varray.buffers[usedBindingCount++] = {
+                .binding = attrib.buffer,
+                .stride = attrib.stride,
+                .inputRate = inputRate,
+            };
+        } else {
+            VR_VK_ASSERT(varray.buffers[bindingIndex].stride == attrib.stride, "Attributes sharing a buffer must use the same stride.");
+            VR_VK_ASSERT(varray.buffers[bindingIndex].inputRate == inputRate, "Attributes sharing a buffer must use the same input rate.");
+        }
+    }
+    varray.computeHash();
+}
+
+void VulkanVertexBuffer::updateGpuBuffers() {
+    // one VkBuffer per binding, bound from binding 0 up to the highest one in use
+    bindingCount = 0;
+    complete = true;
+    VkBuffer fallback = VK_NULL_HANDLE;
+    for (uint32_t attribIndex = 0; attribIndex < attributes.size(); attribIndex++) {
+        const Attribute& attrib = attributes[attribIndex];
+        if (attrib.buffer == Attribute::BUFFER_UNUSED) {
+            continue;
+        }
+        const VulkanBuffer* buffer = buffers[attrib.buffer];
+        if (buffer == nullptr) {
+            complete = false;
+            continue;
+        }
+        fallback = buffer->getGpuBuffer();
+        bindingCount = std::max(bindingCount, attrib.buffer + 1u);
+    }
+    for (uint32_t binding = 0; binding < bindingCount; binding++) {
+        // bindings no attribute reads still need a valid handle
+        gpuBuffers[binding] = buffers[binding] ? buffers[binding]->getGpuBuffer() : fallback;
+        offsets[binding] = 0;
+    }
+}
+
+void VulkanIndexBuffer::upload(const void* data, uint32_t byteOffset, uint32_t byteCount) {
+    if (narrow && !uploaded && byteOffset == 0 && byteCount == indexCount * sizeof(uint32_t)) {
+        maxIndex = findMaxIndex(static_cast<const uint32_t*>(data), indexCount);
+        if (maxIndex <= UINT16_MAX) {
+            // nothing has been drawn from the buffer yet, it can be swapped for one half the size
+            buffer.reset(new VulkanBuffer(mContext, mMemoryPool, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexCount * sizeof(uint16_t)));
+            elementSize = sizeof(uint16_t);
+            indexType = VK_INDEX_TYPE_UINT16;
+        }
+    }
+    uploaded = true;
+
+    if (elementSize == sourceElementSize) {
+        buffer->upload(data, byteOffset, byteCount);
+        return;
+    }
+    const uint32_t count = byteCount / sizeof(uint32_t);
+    const uint32_t* indices = static_cast<const uint32_t*>(data);
+    if (findMaxIndex(indices, count) > UINT16_MAX) {
+        widen(indices, byteOffset / sizeof(uint32_t), count);
+        return;
+    }
+    std::vector<uint16_t> narrowed(count);
+    for (uint32_t i = 0; i < count; i++) {
+        narrowed[i] = (uint16_t) indices[i];
+    }
+    buffer->upload(narrowed.data(), byteOffset / 2, count * sizeof(uint16_t));
+}
+
+void VulkanIndexBuffer::widen(const uint32_t* indices, uint32_t first, uint32_t count) {
+    VR_ASSERT(first + count <= indexCount);
+    std::vector<uint16_t> narrowed(indexCount);
+    // waits for the device to go idle, so no command buffer still reads the 16-bit buffer below
+    buffer->download(narrowed.data(), 0, indexCount * sizeof(uint16_t));
+    std::vector<uint32_t> widened(narrowed.begin(), narrowed.end());
+    std::copy(indices, indices + count, widened.begin() + first);
+
+    buffer.reset(new VulkanBuffer(mContext, mMemoryPool, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexCount * sizeof(uint32_t)));
+    elementSize = sizeof(uint32_t);
+    indexType = VK_INDEX_TYPE_UINT32;
+    narrow = false;
+    maxIndex = findMaxIndex(widened.data(), indexCount);
+    buffer->upload(widened.data(), 0, indexCount * sizeof(uint32_t));
+}
+
 void VulkanRenderPrimitive::setBuffers(VulkanVertexBuffer* vertexBuffer, VulkanIndexBuffer* indexBuffer) {
     this->vertexBuffer = vertexBuffer;
     this->indexBuffer = indexBuffer;
@@ -13,8 +13,9 @@ namespace backend {
 
 struct VulkanVertexBuffer : public NonCopyable {
    VulkanVertexBuffer(VulkanContext& context, VulkanMemoryPool& memoryPool, uint8_t bufferCount, uint8_t attributeCount,
-                        uint32_t elementCount, AttributeArray const& attribs) : mContext(context), mMemoryPool(memoryPool),
-                        bufferCount(bufferCount), attributeCount(attributeCount), vertexCount(elementCount), attributes(attribs), buffers(bufferCount) {}
+                        uint32_t elementCount, AttributeArray const& attribs);
+
+    void setBuffer(uint32_t index, VulkanBuffer* buffer);
    
     VulkanContext& mContext;
     VulkanMemoryPool& mMemoryPool;
@@ -24,27 +25,53 @@ struct VulkanVertexBuffer : public NonCopyable {
     uint8_t bufferCount{};                
     uint8_t attributeCount{};                  
     std::vector<VulkanBuffer*> buffers;
+
+    // vertex input state derived from the attributes and buffers, rebuilt when either changes
+    VulkanPipelineCache::VertexAttributeArray varray = {};
+    // indexed by binding, which is Attribute::buffer
+    VkBuffer gpuBuffers[MAX_VERTEX_ATTRIBUTE_COUNT] = {};
+    VkDeviceSize offsets[MAX_VERTEX_ATTRIBUTE_COUNT] = {};
+    uint32_t bindingCount = 0;
+    // false while a used attribute has no buffer, draws are skipped
+    bool complete = false;
+
+private:
+    void updateVertexInput();
+    void updateGpuBuffers();
 };
 
 struct VulkanIndexBuffer : public NonCopyable {
-    VulkanIndexBuffer(VulkanContext& context, VulkanMemoryPool& memoryPool, uint8_t elementSize, uint32_t indexCount) : mContext(context), mMemoryPool(memoryPool),
-                        elementSize(elementSize), indexCount(indexCount), indexType(elementSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32),
-                        buffer(new VulkanBuffer(context, memoryPool, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, elementSize * indexCount)) {}
+    VulkanIndexBuffer(VulkanContext& context, VulkanMemoryPool& memoryPool, uint8_t elementSize, uint32_t indexCount, bool narrow = false) : mContext(context), mMemoryPool(memoryPool),
+                        elementSize(elementSize), sourceElementSize(elementSize), indexCount(indexCount), indexType(elementSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32),
+                        buffer(new VulkanBuffer(context, memoryPool, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, elementSize * indexCount)), narrow(narrow && elementSize == 4) {}
+
+    // data is in sourceElementSize units, 32-bit indices of a narrowing buffer are stored as 16-bit when they all fit.
+    // A later upload that does not fit turns the buffer back into a 32-bit one, which stalls the device
+    void upload(const void* data, uint32_t byteOffset, uint32_t byteCount);
     
     VulkanContext& mContext;
     VulkanMemoryPool& mMemoryPool;
     
     uint8_t elementSize{}; // num of bytes
+    uint8_t sourceElementSize{}; // num of bytes the caller uploads
     uint32_t indexCount{};
     uint32_t minIndex{};
     uint32_t maxIndex{};
-    const VkIndexType indexType;
-    const std::unique_ptr<VulkanBuffer> buffer;
+    VkIndexType indexType;
+    std::unique_ptr<VulkanBuffer> buffer;
+
+private:
+    void widen(const uint32_t* indices, uint32_t first, uint32_t count);
+
+    // decided by the first upload of the whole buffer
+    bool narrow = false;
+    bool uploaded = false;
 };
 
 struct VulkanBufferObject {
     VulkanBufferObject(VulkanContext& context, VulkanMemoryPool& memoryPool,uint32_t byteCount) : mContext(context), mMemoryPool(memoryPool),
-                        byteCount(byteCount), buffer(new VulkanBuffer(context, memoryPool, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, byteCount)) {}
+                        byteCount(byteCount), buffer(new VulkanBuffer(context, memoryPool, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, byteCount)) {}
     
     VulkanContext& mContext;
     VulkanMemoryPool& mMemoryPool;
@@ -82,12 +109,16 @@ struct VulkanRenderPrimitive : public NonCopyable {
     VulkanIndexBuffer* indexBuffer = nullptr;
     VkPrimitiveTopology primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 
-    uint32_t offset{};
+    uint32_t offset{}; // first index
     uint32_t minIndex{};
     uint32_t maxIndex{};
     uint32_t count{};
     uint32_t maxVertexCount{};
     PrimitiveType type = PrimitiveType::TRIANGLES;
+
+    // ranges drawn by the lod argument of VulkanRuntime::draw, finest first
+    MeshLod lods[MAX_LOD_COUNT] = {};
+    uint32_t lodCount = 0;
 };
 
 // Redner Target
@@ -9,6 +9,9 @@
 namespace VR {
 namespace backend {
 
+// set while the calling thread records a secondary command buffer
+static thread_local VulkanParallelRecorder* sCurrentRecorder = nullptr;
+
 #if defined(VR_VULKAN_VALIDATION)
 const std::string DESIRED_LAYERS[] = {
         "VK_LAYER_KHRONOS_validation",
@@ -45,9 +48,10 @@ std::vector<const char*> getEnabledLayers() {
 #endif
 
 VulkanRuntime::VulkanRuntime(VulkanSurface& surface, std::vector<const char *> &ppRequiredExtensions, std::vector<const char *> &ppRequiredValidationLayers) :
-                            mSurface(surface), mMemoryPool(mContext), mFramebufferCache(mContext), mSamplerCache(mContext) {
+                            mSurface(surface), mMemoryPool(mContext), mFramebufferCache(mContext), mSamplerCache(mContext), mProfiler(mContext) {
 
     mContext.rasterState = mPipelineCache.getDefaultRasterState();
+    mContext.framebufferCache = &mFramebufferCache;
     // init vulkan functions
     VR_VK_ASSERT(InitVulkan(), "Unable to load vulkan functions.");
     VkInstanceCreateInfo instanceInfo = {};
@@ -147,12 +151,20 @@ VulkanRuntime::VulkanRuntime(VulkanSurface& surface, std::vector<const char *> &
     // logical device and graphics queue
     createLogicalDevice(mContext);
 
-    mContext.commandpool = new VulkanCommandPool(mContext.device, mContext.graphicsQueueFamilyIndex);
+    mContext.commandpool = new VulkanCommandPool(mContext.device, mContext.graphicsQueueFamilyIndex, mContext.timelineSemaphoreSupported);
+    if (mContext.transferQueueFamilyIndex != mContext.graphicsQueueFamilyIndex) {
+        mContext.uploadpool = new VulkanCommandPool(mContext.device, mContext.transferQueueFamilyIndex, mContext.timelineSemaphoreSupported);
+        mContext.commandpool->setTransferPool(mContext.uploadpool);
+    }
     // default background
     createEmptyTexture();
 
-    mContext.commandpool->setObserver(&mPipelineCache);
+    mContext.commandpool->addObserver(&mPipelineCache);
+    mContext.commandpool->addObserver(&mComputePipelineCache);
+    mContext.commandpool->addObserver(&mProfiler);
     mPipelineCache.setDevice(mContext.device);
+    mPipelineCache.setBindlessTextureCount(mContext.bindlessTextureCount);
+    mComputePipelineCache.setDevice(mContext.device);
 
     mContext.depthFormat = findSupportedFormat(mContext, { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32 }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
     mSamplerBindings.resize(SAMPLER_BINDING_COUNT);
@@ -177,13 +189,18 @@ void VulkanRuntime::terminate() {
     }
 
     DELETE_PTR(mContext.commandpool);
+    DELETE_PTR(mContext.uploadpool);
     DELETE_PTR(mContext.emptyTexture);
+    mParallelRecorders.clear();
 
     mMemoryPool.gc();
     mMemoryPool.reset();
 
     mPipelineCache.destroyCache();
+    mComputePipelineCache.destroyCache();
+    mProfiler.terminate();
     mFramebufferCache.reset();
+    mContext.framebufferCache = nullptr;
     mSamplerCache.reset();
 
     vmaDestroyAllocator(mContext.allocator);
@@ -201,8 +218,11 @@ void VulkanRuntime::update(uint64_t timeStamps) {
 
 void VulkanRuntime::collectGarbage() {
     mMemoryPool.gc();
-    mFramebufferCache.gc();
+    mFramebufferCache.gc(mPipelineCache);
     mContext.commandpool->gc();
+    if (mContext.uploadpool) {
+        mContext.uploadpool->gc();
+    }
 }
 
 void VulkanRuntime::beginFrame(VulkanSwapChain* swapchain, uint64_t timeStamps, uint32_t frameId) {
@@ -211,7 +231,12 @@ void VulkanRuntime::beginFrame(VulkanSwapChain* swapchain, uint64_t timeStamps,
 }
 
 void VulkanRuntime::endFrame(uint32_t frameId) {
-    if (mContext.commandpool->flush()) {
+    VR_TRACE_SCOPE("VulkanRuntime::endFrame");
+    // queued only, commit() or a wait hands the frame's command buffers to the queue in one batch
+    const bool flushed = mContext.commandpool->flush();
+    mProfiler.endFrame();
+    mFrameRenderPassCount = 0;
+    if (flushed) {
         collectGarbage();
     }
 }
@@ -254,9 +279,9 @@ void VulkanRuntime::destroyVertexBuffer(VulkanVertexBuffer* &vertexBuffer) {
     DELETE_PTR(vertexBuffer);
 }
 
-void VulkanRuntime::createIndexBuffer(VulkanIndexBuffer* &indexBuffer, ElementType elementType, uint32_t indexCount) {
+void VulkanRuntime::createIndexBuffer(VulkanIndexBuffer* &indexBuffer, ElementType elementType, uint32_t indexCount, bool narrow) {
     auto elementSize = (uint8_t) getElementTypeSize(elementType);
-    indexBuffer = new VulkanIndexBuffer(mContext, mMemoryPool, elementSize, indexCount);
+    indexBuffer = new VulkanIndexBuffer(mContext, mMemoryPool, elementSize, indexCount, narrow);
 }
 
 void VulkanRuntime::destroyIndexBuffer(VulkanIndexBuffer* &indexBuffer) {
@@ -268,12 +293,16 @@ void VulkanRuntime::createBufferObject(VulkanBufferObject* &bufferObject, uint32
 }
 
 void VulkanRuntime::destroyBufferObject(VulkanBufferObject* &bufferObject) {
-    DELETE_PTR(bufferObject);
+    if (bufferObject != nullptr) {
+        mComputePipelineCache.unbindBuffer(bufferObject->buffer->getGpuBuffer());
+        DELETE_PTR(bufferObject);
+    }
 }
 
 void VulkanRuntime::createTexture(VulkanTexture* &texture, SamplerType target, uint8_t levels,
                                   TextureFormat format, uint8_t samples, uint32_t w, uint32_t h, uint32_t depth, TextureUsage usage) {
     texture = new VulkanTexture(mContext, target, levels, format, samples, w, h, depth, usage, mMemoryPool);
+    registerBindlessTexture(texture);
 }
 
 void VulkanRuntime::createTextureSwizzled(VulkanTexture* &texture, SamplerType target, uint8_t levels,
@@ -282,11 +311,14 @@ void VulkanRuntime::createTextureSwizzled(VulkanTexture* &texture, SamplerType t
     TextureSwizzle swizzleArray[] = {r, g, b, a};
     const VkComponentMapping swizzleMap = getSwizzleMap(swizzleArray);
     texture = new VulkanTexture(mContext, target, levels, format, samples, w, h, depth, usage, mMemoryPool, swizzleMap);
+    registerBindlessTexture(texture);
 }
 
 void VulkanRuntime::destroyTexture(VulkanTexture* &texture) {
     if (texture != nullptr) {
         mPipelineCache.unbindImageView(texture->getPrimaryImageView());
+        mComputePipelineCache.unbindImage(texture->vkImage());
+        mPipelineCache.releaseBindlessSlot(texture->bindlessIndex());
         DELETE_PTR(texture);
     }
 }
@@ -299,6 +331,17 @@ void VulkanRuntime::destroyProgram(VulkanProgram* &vkprogram) {
     DELETE_PTR(vkprogram);
 }
 
+void VulkanRuntime::createComputeProgram(VulkanComputeProgram* &vkprogram, const void* spirv, size_t size, std::string& programName) {
+    vkprogram = new VulkanComputeProgram(mContext, spirv, size, programName);
+}
+
+void VulkanRuntime::destroyComputeProgram(VulkanComputeProgram* &vkprogram) {
+    if (vkprogram != nullptr) {
+        mComputePipelineCache.retirePipeline(vkprogram->getShaderModule());
+        DELETE_PTR(vkprogram);
+    }
+}
+
 void VulkanRuntime::createDefaultRenderTarget(VulkanRenderTarget* &renderTarget) {
     renderTarget = new VulkanRenderTarget(mContext, mMemoryPool);
 }
@@ -366,12 +409,12 @@ VkResult VulkanRuntime::wait(VulkanFence* fence, uint64_t timeout) {
 
 void VulkanRuntime::setVertexBufferObject(VulkanVertexBuffer* vertexBuffer, uint32_t index, VulkanBufferObject* bufferObject) {
     VR_ASSERT(vertexBuffer != nullptr);
-    vertexBuffer->buffers[index] = bufferObject->buffer.get();
+    vertexBuffer->setBuffer(index, bufferObject->buffer.get());
 }
 
 void VulkanRuntime::updateIndexBuffer(VulkanIndexBuffer* indexBuffer, BufferDescriptor& p, uint32_t byteOffset) {
     VR_ASSERT(indexBuffer != nullptr);
-    indexBuffer->buffer->upload(p.buffer, byteOffset, p.size);
+    indexBuffer->upload(p.buffer, byteOffset, p.size);
 }
 
 void VulkanRuntime::updateBufferObject(VulkanBufferObject* bufferObject, BufferDescriptor& p, uint32_t byteOffset) {
@@ -407,20 +450,24 @@ void VulkanRuntime::loadUniformBuffer(VulkanUniformBuffer* uniformBuffer, Buffer
 }
 
 void VulkanRuntime::beginRenderPass(VulkanRenderTarget* renderTarget, const RenderPassParams& params) {
+    VR_TRACE_SCOPE("VulkanRuntime::beginRenderPass");
     if (renderTarget == nullptr) {
         VR_ERROR("No render target.");
         return;
     }
     
-    uint32_t curSwapchainIndex = getSwapChainIndex(mContext);
     mCurrentRenderTarget = renderTarget;
 
+    const bool parallel = params.workerCount > 0;
+    VR_VK_ASSERT(!parallel || params.subpassMask == 0, "Subpasses are not supported by parallel render passes.");
+
     const VkExtent2D extent = renderTarget->getRenderTargetSize();
     VR_ASSERT(extent.width > 0 && extent.height > 0);
 
     TargetBufferFlags discardStart = params.flags.discardStart;
 
-    const VkCommandBuffer cmdbuffer = mContext.commandpool->get().cmdbuffer;
+    VulkanCommandBuffer const& primary = mContext.commandpool->get();
+    const VkCommandBuffer cmdbuffer = primary.cmdbuffer;
     VulkanAttachment depth = renderTarget->getDepthAttachment();
     VulkanTexture* depthFeedback = nullptr;
 
@@ -462,7 +509,7 @@ void VulkanRuntime::beginRenderPass(VulkanRenderTarget* renderTarget, const Rend
     }
     
     // get renderpass object
-    VkRenderPass renderPass = mFramebufferCache.getRenderPass(rpInfo, curSwapchainIndex);
+    VkRenderPass renderPass = mFramebufferCache.getRenderPass(rpInfo);
     mPipelineCache.bindRenderPass(renderPass, 0);
 
     VulkanFramebufferCache::FrameBufferInfo fbInfo {
@@ -502,7 +549,7 @@ void VulkanRuntime::beginRenderPass(VulkanRenderTarget* renderTarget, const Rend
     }
     
     // get framebuffer object
-    VkFramebuffer vkFramebuffer = mFramebufferCache.getFramebuffer(fbInfo, curSwapchainIndex);
+    VkFramebuffer vkFramebuffer = mFramebufferCache.getFramebuffer(fbInfo);
     
     // set begininfo of render pass
     VkRenderPassBeginInfo renderPassInfo {
@@ -538,8 +585,20 @@ void VulkanRuntime::beginRenderPass(VulkanRenderTarget* renderTarget, const Rend
         clearValue.depthStencil = {(float) params.clearDepth, 0};
     }
     renderPassInfo.pClearValues = &clearValues[0];
+    char passName[32];
+    const char* name = params.name;
+    if (name == nullptr) {
+        snprintf(passName, sizeof(passName), "RenderPass %u", mFrameRenderPassCount);
+        name = passName;
+    }
+    mFrameRenderPassCount++;
+    mProfiler.beginScope(cmdbuffer, name);
+    // secondary command buffers do not inherit statistics queries
+    if (!parallel) {
+        mProfiler.beginStatistics(cmdbuffer, name);
+    }
     // begin render pass
-    vkCmdBeginRenderPass(cmdbuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(cmdbuffer, &renderPassInfo, parallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
 
     VkViewport viewport = mContext.viewport = {
         .x = (float) params.viewport.left,
@@ -551,19 +610,88 @@ void VulkanRuntime::beginRenderPass(VulkanRenderTarget* renderTarget, const Rend
     };
 
     mCurrentRenderTarget->setTargetRectToSurface(&viewport);
-    vkCmdSetViewport(cmdbuffer, 0, 1, &viewport);
+    if (parallel) {
+        // secondary command buffers set their own viewport
+        while (mParallelRecorders.size() < params.workerCount) {
+            VulkanParallelRecorder* recorder = new VulkanParallelRecorder();
+            recorder->commandPool.reset(new VulkanSecondaryCommandPool(mContext.device, mContext.graphicsQueueFamilyIndex));
+            recorder->bindingState = mPipelineCache.createBindingState();
+            recorder->rasterState = mPipelineCache.getDefaultRasterState();
+            mParallelRecorders.emplace_back(recorder);
+        }
+        mParallelCmdBuffer = &primary;
+    } else {
+        vkCmdSetViewport(cmdbuffer, 0, 1, &viewport);
+    }
 
     mContext.currentRenderPass = {
         .renderPass = renderPassInfo.renderPass,
         .subpassMask = params.subpassMask,
         .currentSubpass = 0,
-        .depthFeedback = depthFeedback
+        .depthFeedback = depthFeedback,
+        .framebuffer = vkFramebuffer,
+        .workerCount = params.workerCount
     };
 }
 
+void VulkanRuntime::beginParallelRecording(uint32_t workerIndex) {
+    VR_VK_ASSERT(workerIndex < mContext.currentRenderPass.workerCount, "No parallel render pass for this worker.");
+    VR_VK_ASSERT(sCurrentRecorder == nullptr, "Thread is already recording.");
+
+    VulkanParallelRecorder* recorder = mParallelRecorders[workerIndex].get();
+    const VkCommandBufferInheritanceInfo inheritance {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .renderPass = mContext.currentRenderPass.renderPass,
+        .subpass = 0,
+        .framebuffer = mContext.currentRenderPass.framebuffer,
+    };
+    VR_VK_ASSERT(recorder->cmdbuffer == VK_NULL_HANDLE, "Worker already recorded in this render pass.");
+    recorder->cmdbuffer = recorder->commandPool->begin(*mParallelCmdBuffer, inheritance);
+
+    // dynamic state is not inherited from the primary command buffer
+    VkViewport viewport = mContext.viewport;
+    mCurrentRenderTarget->setTargetRectToSurface(&viewport);
+    vkCmdSetViewport(recorder->cmdbuffer, 0, 1, &viewport);
+
+    recorder->samplerBindings = mSamplerBindings;
+    mPipelineCache.beginThreadRecording(recorder->bindingState, mParallelCmdBuffer->cmdBufferIndex);
+    sCurrentRecorder = recorder;
+}
+
+void VulkanRuntime::endParallelRecording() {
+    VR_VK_ASSERT(sCurrentRecorder != nullptr, "Thread is not recording.");
+    vkEndCommandBuffer(sCurrentRecorder->cmdbuffer);
+    mPipelineCache.endThreadRecording();
+    sCurrentRecorder = nullptr;
+}
+
+void VulkanRuntime::executeParallelRecordings(VkCommandBuffer cmdbuffer) {
+    // workers are done, execute their buffers in worker order
+    mParallelSecondaries.clear();
+    for (uint32_t i = 0; i < mContext.currentRenderPass.workerCount; i++) {
+        VulkanParallelRecorder* recorder = mParallelRecorders[i].get();
+        if (recorder->cmdbuffer != VK_NULL_HANDLE) {
+            mParallelSecondaries.push_back(recorder->cmdbuffer);
+            recorder->cmdbuffer = VK_NULL_HANDLE;
+        }
+    }
+    if (!mParallelSecondaries.empty()) {
+        vkCmdExecuteCommands(cmdbuffer, (uint32_t) mParallelSecondaries.size(), mParallelSecondaries.data());
+        mPipelineCache.resetCommandBufferState();
+    }
+    mContext.currentRenderPass.workerCount = 0;
+    mParallelCmdBuffer = nullptr;
+}
+
 void VulkanRuntime::endRenderPass() {
+    VR_TRACE_SCOPE("VulkanRuntime::endRenderPass");
     VkCommandBuffer cmdbuffer = mContext.commandpool->get().cmdbuffer;
+    if (mContext.currentRenderPass.workerCount > 0) {
+        executeParallelRecordings(cmdbuffer);
+    }
     vkCmdEndRenderPass(cmdbuffer);
+    mProfiler.endStatistics(cmdbuffer);
+    mProfiler.endScope(cmdbuffer);
 
     VR_ASSERT(mCurrentRenderTarget);
 
@@ -617,6 +745,7 @@ void VulkanRuntime::nextSubpass() {
     VR_ASSERT(mContext.currentSwapChain);
     VR_ASSERT(mCurrentRenderTarget);
     VR_ASSERT(mContext.currentRenderPass.subpassMask);
+    VR_ASSERT(mContext.currentRenderPass.workerCount == 0);
 
     // use the same command buffer for next subpass
     vkCmdNextSubpass(mContext.commandpool->get().cmdbuffer, VK_SUBPASS_CONTENTS_INLINE);
@@ -641,12 +770,29 @@ void VulkanRuntime::setRenderPrimitiveBuffer(VulkanRenderPrimitive* primitive, V
 
 void VulkanRuntime::setRenderPrimitiveRange(VulkanRenderPrimitive* primitive, PrimitiveType pt, uint32_t offset, uint32_t minIndex, uint32_t maxIndex, uint32_t count) {
     primitive->setPrimitiveType(pt);
-    primitive->offset = offset * primitive->indexBuffer->elementSize;
+    // kept in indices, the element size can still shrink when the indices are uploaded
+    primitive->offset = offset;
     primitive->count = count;
     primitive->minIndex = minIndex;
     primitive->maxIndex = maxIndex > minIndex ? maxIndex : primitive->maxVertexCount - 1;
 }
 
+void VulkanRuntime::setRenderPrimitiveLods(VulkanRenderPrimitive* primitive, const MeshLod* lods, uint32_t lodCount) {
+    VR_ASSERT(lodCount > 0 && lodCount <= MAX_LOD_COUNT);
+    memcpy(primitive->lods, lods, lodCount * sizeof(MeshLod));
+    primitive->lodCount = lodCount;
+    primitive->offset = lods[0].offset;
+    primitive->count = lods[0].count;
+}
+
+uint32_t VulkanRuntime::selectRenderPrimitiveLod(const VulkanRenderPrimitive* primitive, float distance, float projectionScale,
+        float maxPixelError) const {
+    if (primitive->lodCount == 0) {
+        return 0;
+    }
+    return selectLod(primitive->lods, primitive->lodCount, distance, projectionScale, maxPixelError);
+}
+
 void VulkanRuntime::makeCurrent(VulkanSwapChain* drawSch, VulkanSwapChain* readSch) {
     VR_ASSERT(drawSch == readSch && drawSch != nullptr);
     mContext.currentSwapChain = drawSch;
@@ -668,7 +814,10 @@ void VulkanRuntime::commit(VulkanSwapChain* swapchain) {
     // swap chain image to present layout
     swapchain->makePresentable();
 
-    if (mContext.commandpool->flush()) {
+    const bool flushed = mContext.commandpool->flush();
+    // everything queued this frame goes out in one batch before the present
+    mContext.commandpool->submit();
+    if (flushed) {
         collectGarbage();
     }
 
@@ -714,7 +863,8 @@ void VulkanRuntime::bindUniformBufferRange(uint32_t index, VulkanUniformBuffer*
 }
 
 void VulkanRuntime::bindSampler(uint32_t index, VulkanSampler& sampler) {
-    mSamplerBindings[index] = std::move(sampler);
+    std::vector<VulkanSampler>& samplerBindings = sCurrentRecorder ? sCurrentRecorder->samplerBindings : mSamplerBindings;
+    samplerBindings[index] = std::move(sampler);
 }
 
 void VulkanRuntime::readPixels(VulkanRenderTarget* renderTarget, uint32_t x, uint32_t y, uint32_t width, uint32_t height, PixelBufferDescriptor& pbd) {
@@ -891,11 +1041,14 @@ void VulkanRuntime::readPixels(VulkanRenderTarget* renderTarget, uint32_t x, uin
     vkDestroyImage(device, image, nullptr);
 }
 
-void VulkanRuntime::draw(PipelineState& pipelineState, const VulkanRenderPrimitive* renderPrimitive) {
+VkCommandBuffer VulkanRuntime::bindDrawState(PipelineState& pipelineState, const VulkanRenderPrimitive* renderPrimitive) {
     VR_VK_ASSERT(renderPrimitive != nullptr, "No render primitive.");
 
-    VulkanCommandBuffer const* commandpool = &mContext.commandpool->get();
-    VkCommandBuffer cmdbuffer = commandpool->cmdbuffer;
+    // worker threads record into their secondary command buffer with their own bindings
+    VulkanParallelRecorder* recorder = sCurrentRecorder;
+    VkCommandBuffer cmdbuffer = recorder ? recorder->cmdbuffer : mContext.commandpool->get().cmdbuffer;
+    VulkanPipelineCache::RasterState& vkRasterState = recorder ? recorder->rasterState : mContext.rasterState;
+    std::vector<VulkanSampler>& samplerBindings = recorder ? recorder->samplerBindings : mSamplerBindings;
 
     std::shared_ptr<VulkanProgram> program = pipelineState.program;
     RasterStateT& rasterState = pipelineState.rasterState;
@@ -903,7 +1056,7 @@ void VulkanRuntime::draw(PipelineState& pipelineState, const VulkanRenderPrimiti
     const Viewport& viewportScissor = pipelineState.scissor;
 
     const VulkanRenderTarget* rt = mCurrentRenderTarget;
-    mContext.rasterState.depthStencil = {
+    vkRasterState.depthStencil = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
         .depthTestEnable = VK_TRUE,
         .depthWriteEnable = (VkBool32) rasterState.depthWrite,
@@ -912,13 +1065,13 @@ void VulkanRuntime::draw(PipelineState& pipelineState, const VulkanRenderPrimiti
         .stencilTestEnable = VK_FALSE,
     };
 
-    mContext.rasterState.multisampling = {
+    vkRasterState.multisampling = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
         .rasterizationSamples = (VkSampleCountFlagBits) rt->getSamples(),
         .alphaToCoverageEnable = rasterState.alphaToCoverage,
     };
 
-    mContext.rasterState.blending = {
+    vkRasterState.blending = {
         .blendEnable = (VkBool32) rasterState.hasBlending(),
         .srcColorBlendFactor = getBlendFactor(rasterState.blendFunctionSrcRGB),
         .dstColorBlendFactor = getBlendFactor(rasterState.blendFunctionDstRGB),
@@ -929,63 +1082,26 @@ void VulkanRuntime::draw(PipelineState& pipelineState, const VulkanRenderPrimiti
         .colorWriteMask = (VkColorComponentFlags) (rasterState.colorWrite ? 0xf : 0x0),
     };
 
-    VkPipelineRasterizationStateCreateInfo& vkraster = mContext.rasterState.rasterization;
+    VkPipelineRasterizationStateCreateInfo& vkraster = vkRasterState.rasterization;
     vkraster.cullMode = getCullMode(rasterState.culling);
     vkraster.frontFace = getFrontFace(rasterState.inverseFrontFaces);
     vkraster.depthBiasEnable = (depthOffset.constant || depthOffset.slope) ? VK_TRUE : VK_FALSE;
     vkraster.depthBiasConstantFactor = depthOffset.constant;
     vkraster.depthBiasSlopeFactor = depthOffset.slope;
 
-    mContext.rasterState.colorTargetCount = rt->getColorTargetCount(mContext.currentRenderPass);
-
-    VulkanPipelineCache::VertexAttributeArray varray = {};
-    VkBuffer buffers[MAX_VERTEX_ATTRIBUTE_COUNT] = {};
-    VkDeviceSize offsets[MAX_VERTEX_ATTRIBUTE_COUNT] = {};
-
-    // process each attribute
-    const uint32_t bufferCount = renderPrimitive->vertexBuffer->attributes.size();
-    uint32_t realBufferCount = 0;
-    for (uint32_t attribIndex = 0; attribIndex < bufferCount; attribIndex++) {
-        Attribute attrib = renderPrimitive->vertexBuffer->attributes[attribIndex];
+    vkRasterState.colorTargetCount = rt->getColorTargetCount(mContext.currentRenderPass);
 
-        const bool isInteger = attrib.flags & Attribute::FLAG_INTEGER_TARGET;
-        const bool isNormalized = attrib.flags & Attribute::FLAG_NORMALIZED;
-
-        VkFormat vkformat = getVkFormat(attrib.type, isNormalized, isInteger);
-
-        if (attrib.buffer == Attribute::BUFFER_UNUSED) {
-            vkformat = isInteger ? VK_FORMAT_R8G8B8A8_UINT : VK_FORMAT_R8G8B8A8_SNORM;
-            attrib = renderPrimitive->vertexBuffer->attributes[0];
-            //FIXME: should pass
-            continue;
-        } else {
-            realBufferCount++;
-        }
-        // FIXME:attrib.buffer should be -1, if attribute num is larger than 16
-        const VulkanBuffer* buffer = renderPrimitive->vertexBuffer->buffers[attrib.buffer];
-
-        if (buffer == nullptr) {
-            return;
-        }
-
-        buffers[attribIndex] = buffer->getGpuBuffer();
-        offsets[attribIndex] = attrib.offset;
-        varray.attributes[attribIndex] = {
-            .location = attribIndex, // GLSL layout specifier
-            .binding = attribIndex, // FIXME: should be buffer index
-            .format = vkformat,
-        };
-        varray.buffers[attribIndex] = {
-            .binding = attribIndex,
-            .stride = attrib.stride,
-        };
+    // the vertex input state is built when the vertex buffer or its buffers change
+    const VulkanVertexBuffer* vertexBuffer = renderPrimitive->vertexBuffer;
+    if (!vertexBuffer->complete) {
+        return VK_NULL_HANDLE;
     }
 
     const std::vector<VkShaderModule>& shaderModules = program->getShaderModules();
     mPipelineCache.bindProgram(shaderModules[0], shaderModules[1]);
-    mPipelineCache.bindRasterState(mContext.rasterState);
+    mPipelineCache.bindRasterState(vkRasterState);
     mPipelineCache.bindPrimitiveTopology(renderPrimitive->primitiveTopology);
-    mPipelineCache.bindVertexAttributeArray(varray);
+    mPipelineCache.bindVertexAttributeArray(vertexBuffer->varray);
 
     VkDescriptorImageInfo samplers[SAMPLER_BINDING_COUNT] = {};
     // set vulkan samplers
@@ -995,7 +1111,7 @@ void VulkanRuntime::draw(PipelineState& pipelineState, const VulkanRenderPrimiti
             continue;
         }
         
-        VulkanSampler& boundSampler = mSamplerBindings[samplerIdx];
+        VulkanSampler& boundSampler = samplerBindings[samplerIdx];
         if (boundSampler.texture == nullptr) {
             continue;
         }
@@ -1027,7 +1143,7 @@ void VulkanRuntime::draw(PipelineState& pipelineState, const VulkanRenderPrimiti
     mPipelineCache.bindSamplers(samplers);
 
     if (!mPipelineCache.bindDescriptorSets(cmdbuffer)) {
-        return;
+        return VK_NULL_HANDLE;
     }
 
     // intersection of viewports
@@ -1041,27 +1157,64 @@ void VulkanRuntime::draw(PipelineState& pipelineState, const VulkanRenderPrimiti
     mPipelineCache.bindScissor(cmdbuffer, scissor);
     mPipelineCache.bindPipeline(cmdbuffer);
 
-    // bind the vertex buffers and index buffer
-    // FIXME: use realBufferCount or bufferCount
-    vkCmdBindVertexBuffers(cmdbuffer, 0, realBufferCount, buffers, offsets);
-    vkCmdBindIndexBuffer(cmdbuffer, renderPrimitive->indexBuffer->buffer->getGpuBuffer(), 0, renderPrimitive->indexBuffer->indexType);
+    // bind the vertex buffers and index buffer, skipped when the previous draw bound the same
+    mPipelineCache.bindVertexBuffers(cmdbuffer, vertexBuffer->bindingCount, vertexBuffer->gpuBuffers, vertexBuffer->offsets);
+    mPipelineCache.bindIndexBuffer(cmdbuffer, renderPrimitive->indexBuffer->buffer->getGpuBuffer(), renderPrimitive->indexBuffer->indexType);
+    return cmdbuffer;
+}
 
-    const uint32_t indexCount = renderPrimitive->count;
-    const uint32_t instanceCount = 1;
-    const uint32_t firstIndex = renderPrimitive->offset / renderPrimitive->indexBuffer->elementSize;
+void VulkanRuntime::draw(PipelineState& pipelineState, const VulkanRenderPrimitive* renderPrimitive, uint32_t instanceCount,
+        uint32_t lod) {
+    VR_TRACE_SCOPE("VulkanRuntime::draw");
+    VR_ASSERT(lod == 0 || lod < renderPrimitive->lodCount);
+    VkCommandBuffer cmdbuffer = bindDrawState(pipelineState, renderPrimitive);
+    if (cmdbuffer == VK_NULL_HANDLE) {
+        return;
+    }
+
+    // the primitive is shared by every draw of it, the lod only picks the range of this one
+    const bool useLod = lod < renderPrimitive->lodCount;
+    const uint32_t indexCount = useLod ? renderPrimitive->lods[lod].count : renderPrimitive->count;
+    const uint32_t firstIndex = useLod ? renderPrimitive->lods[lod].offset : renderPrimitive->offset;
     const int32_t vertexOffset = 0;
-    const uint32_t firstInstId = 1;
+    const uint32_t firstInstId = 0;
     vkCmdDrawIndexed(cmdbuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstId);
 }
 
+void VulkanRuntime::drawIndirect(PipelineState& pipelineState, const VulkanRenderPrimitive* renderPrimitive,
+        VulkanBufferObject* commands, uint32_t offset, uint32_t drawCount, VulkanBufferObject* countBuffer, uint32_t countOffset) {
+    VR_TRACE_SCOPE("VulkanRuntime::drawIndirect");
+    VR_VK_ASSERT(commands != nullptr, "No indirect command buffer.");
+    VR_VK_ASSERT(offset % 4 == 0 && countOffset % 4 == 0, "Indirect offsets must be 4-byte aligned.");
+    VkCommandBuffer cmdbuffer = bindDrawState(pipelineState, renderPrimitive);
+    if (cmdbuffer == VK_NULL_HANDLE || drawCount == 0) {
+        return;
+    }
+
+    // the primitive's range is ignored, every command carries its own indices and instances
+    const VkBuffer commandBuffer = commands->buffer->getGpuBuffer();
+    const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    if (countBuffer != nullptr && mContext.drawIndirectCountSupported) {
+        vkCmdDrawIndexedIndirectCountKHR(cmdbuffer, commandBuffer, offset, countBuffer->buffer->getGpuBuffer(), countOffset,
+                                         drawCount, stride);
+    } else if (mContext.multiDrawIndirectSupported) {
+        // without a GPU count every command up to drawCount runs, unused ones must have instanceCount 0,
+        // VulkanGpuCulling::cull zeroes them
+        vkCmdDrawIndexedIndirect(cmdbuffer, commandBuffer, offset, drawCount, stride);
+    } else {
+        for (uint32_t i = 0; i < drawCount; i++) {
+            vkCmdDrawIndexedIndirect(cmdbuffer, commandBuffer, offset + i * stride, 1, stride);
+        }
+    }
+}
+
 void VulkanRuntime::refreshSwapChain() {
     VulkanSwapChain& surface = *mContext.currentSwapChain;
 
     VR_VK_ASSERT(!surface.headlessQueue, "Resizing headless swap chains is not supported.");
+    // destroy() purges the framebuffers of the old swap chain views
     surface.destroy();
     surface.create();
-
-    mFramebufferCache.reset();
 }
 
 void VulkanRuntime::createEmptyTexture() {
@@ -1072,5 +1225,131 @@ void VulkanRuntime::createEmptyTexture() {
     mContext.emptyTexture->update2DImage(pixelBufferDes, 1, 1, 0);
 }
 
+void VulkanRuntime::registerBindlessTexture(VulkanTexture* texture) {
+    if (!mPipelineCache.isBindlessEnabled() || !any(texture->usage() & TextureUsage::SAMPLEABLE)) {
+        return;
+    }
+    // the bindless array is declared as sampler2D[], cube, array and 3D views can not go in it
+    if (texture->target() != SamplerType::SAMPLER_2D) {
+        return;
+    }
+    // one sampler for every slot, textures needing other filtering or wrapping are bound as usual
+    SamplerParams params = {};
+    params.filterMag = SamplerMagFilter::LINEAR;
+    params.filterMin = SamplerMinFilter::LINEAR_MIPMAP_LINEAR;
+    params.wrapS = SamplerWrapMode::REPEAT;
+    params.wrapT = SamplerWrapMode::REPEAT;
+    params.wrapR = SamplerWrapMode::REPEAT;
+    // the primary view still covers every level here, later min/max level changes do not affect the slot
+    const VkDescriptorImageInfo imageInfo = {
+        .sampler = mSamplerCache.getSampler(params),
+        .imageView = texture->getPrimaryImageView(),
+        .imageLayout = getTextureLayout(texture->usage()),
+    };
+    texture->setBindlessIndex(mPipelineCache.allocateBindlessSlot(imageInfo));
+}
+
+uint32_t VulkanRuntime::getBindlessIndex(const VulkanTexture* texture) const {
+    VR_ASSERT(texture != nullptr);
+    return texture->bindlessIndex();
+}
+
+void VulkanRuntime::pushConstants(const void* data, uint32_t size) {
+    mPipelineCache.bindPushConstants(data, size);
+}
+
+void VulkanRuntime::beginGpuScope(const char* name) {
+    VR_VK_ASSERT(mContext.currentRenderPass.workerCount == 0, "Gpu scopes can not be recorded inside parallel render passes.");
+    mProfiler.beginScope(mContext.commandpool->get().cmdbuffer, name);
+}
+
+void VulkanRuntime::endGpuScope() {
+    VR_VK_ASSERT(mContext.currentRenderPass.workerCount == 0, "Gpu scopes can not be recorded inside parallel render passes.");
+    mProfiler.endScope(mContext.commandpool->get().cmdbuffer);
+}
+
+void VulkanRuntime::bindStorageBuffer(uint32_t index, VulkanBufferObject* bufferObject, uint32_t offset, uint32_t size) {
+    VR_ASSERT(bufferObject != nullptr);
+    mComputePipelineCache.bindStorageBuffer(index, bufferObject->buffer->getGpuBuffer(), offset, size ? size : VK_WHOLE_SIZE);
+}
+
+void VulkanRuntime::bindStorageImage(uint32_t index, VulkanTexture* texture, uint32_t level) {
+    VR_ASSERT(texture != nullptr);
+    VR_VK_ASSERT(any(texture->usage() & TextureUsage::STORAGE), "Texture is not created with storage usage.");
+    mComputePipelineCache.bindStorageImage(index, texture->vkImage(), texture->getImageView(level, 0, VK_IMAGE_ASPECT_COLOR_BIT));
+}
+
+void VulkanRuntime::setComputeConstants(const void* data, uint32_t size) {
+    mComputePipelineCache.bindPushConstants(data, size);
+}
+
+void VulkanRuntime::dispatch(VulkanComputeProgram* program, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ) {
+    VR_TRACE_SCOPE("VulkanRuntime::dispatch");
+    VR_VK_ASSERT(program != nullptr, "No compute program.");
+    VR_VK_ASSERT(mContext.currentRenderPass.renderPass == VK_NULL_HANDLE, "Dispatch inside a render pass.");
+    const VkCommandBuffer cmdbuffer = mContext.commandpool->get().cmdbuffer;
+
+    // attachments, copies and earlier dispatches are done before the shader reads or writes
+    VkMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                         VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(cmdbuffer,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    mComputePipelineCache.bindPipeline(cmdbuffer, program->getShaderModule());
+    vkCmdDispatch(cmdbuffer, groupCountX, groupCountY, groupCountZ);
+
+    // results feed indirect draws, vertex fetch, sampling and copies
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                            VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmdbuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void VulkanRuntime::fillBufferObject(VulkanBufferObject* bufferObject, uint32_t offset, uint32_t size, uint32_t value) {
+    VR_ASSERT(bufferObject != nullptr);
+    VR_VK_ASSERT(mContext.currentRenderPass.renderPass == VK_NULL_HANDLE, "Fill inside a render pass.");
+    // the next dispatch waits for transfer writes
+    vkCmdFillBuffer(mContext.commandpool->get().cmdbuffer, bufferObject->buffer->getGpuBuffer(), offset, size, value);
+}
+
+void VulkanRuntime::copyDepthToBufferObject(VulkanRenderTarget* renderTarget, VulkanBufferObject* bufferObject) {
+    VR_ASSERT(renderTarget != nullptr && bufferObject != nullptr);
+    VR_VK_ASSERT(mContext.currentRenderPass.renderPass == VK_NULL_HANDLE, "Copy inside a render pass.");
+    const VulkanAttachment depth = renderTarget->getDepthAttachment();
+    VR_VK_ASSERT(depth.texture != nullptr, "Render target has no depth texture.");
+    const VkCommandBuffer cmdbuffer = mContext.commandpool->get().cmdbuffer;
+
+    VkMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmdbuffer,
+            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    region.imageSubresource.mipLevel = depth.baseMipLevel;
+    region.imageSubresource.baseArrayLayer = depth.baseLayer;
+    region.imageSubresource.layerCount = 1;
+    const VkExtent2D extent = renderTarget->getRenderTargetSize();
+    region.imageExtent = { extent.width, extent.height, 1 };
+    vkCmdCopyImageToBuffer(cmdbuffer, depth.texture->vkImage(), getTextureLayout(depth.texture->usage()),
+                           bufferObject->buffer->getGpuBuffer(), 1, &region);
+}
+
 } // namespace backend
 } // namespace VR
@@ -10,6 +10,7 @@
 #include "VulkanBuffer.h"
 #include "VulkanTexture.h"
 #include "VulkanProgram.h"
+#include "VulkanComputeProgram.h"
 #include "VulkanMemoryPool.h"
 
 #include "VulkanFence.h"
@@ -20,10 +21,14 @@
 #include "VulkanSurface.h"
 
 #include "VulkanPipelineCache.h"
+#include "VulkanComputePipelineCache.h"
 #include "VulkanFramebufferCache.h"
 #include "VulkanSamplerCache.h"
+#include "VulkanProfiler.h"
+#include "VulkanTrace.h"
 
 #include "VulkanUtils.h"
+#include "VulkanMeshOptimizer.h"
 
 namespace VR {
 namespace backend {
@@ -35,6 +40,15 @@ struct PipelineState {
     Viewport scissor{ 0, 0, (uint32_t)std::numeric_limits<int32_t>::max(),(uint32_t)std::numeric_limits<int32_t>::max()};
 };
 
+// a worker thread recording its share of a parallel render pass
+struct VulkanParallelRecorder {
+    std::unique_ptr<VulkanSecondaryCommandPool> commandPool;
+    VulkanPipelineCache::BindingState* bindingState = nullptr;
+    VulkanPipelineCache::RasterState rasterState;
+    std::vector<VulkanSampler> samplerBindings;
+    VkCommandBuffer cmdbuffer = VK_NULL_HANDLE;
+};
+
 class VulkanRuntime :public NonCopyable {
 public:
 
@@ -46,6 +60,7 @@ public:
     void terminate();
     void update(uint64_t timeStamps);
     void beginFrame(VulkanSwapChain* swapchain, uint64_t timeStamps, uint32_t frameId);
+    // endFrame and flush only queue the command buffer, commit, finish and readPixels submit the queued batch
     void endFrame(uint32_t frameId);
     void flush();
     void finish();
@@ -55,7 +70,8 @@ public:
     void destroyRenderPrimitive(VulkanRenderPrimitive* &renderPrimitivet);
     void createVertexBuffer(VulkanVertexBuffer* &vertexBuffer, uint8_t bufferCount, uint8_t attributeCount, uint32_t elementCount, AttributeArray attributes);
     void destroyVertexBuffer(VulkanVertexBuffer* &vertexBuffer);
-    void createIndexBuffer(VulkanIndexBuffer* &indexBuffer, ElementType elementType, uint32_t indexCount);
+    // narrow: UINT indices that all fit in 16 bits are stored as USHORT
+    void createIndexBuffer(VulkanIndexBuffer* &indexBuffer, ElementType elementType, uint32_t indexCount, bool narrow = false);
     void destroyIndexBuffer(VulkanIndexBuffer* &indexBuffer);
     void createBufferObject(VulkanBufferObject* &bufferObject, uint32_t byteCount);
     void destroyBufferObject(VulkanBufferObject* &bufferObject);
@@ -67,6 +83,8 @@ public:
     void destroyTexture(VulkanTexture* &texture);
     void createProgram(VulkanProgram* &vkprogram, Program& program, std::string& programName);
     void destroyProgram(VulkanProgram* &vkprogram);
+    void createComputeProgram(VulkanComputeProgram* &vkprogram, const void* spirv, size_t size, std::string& programName);
+    void destroyComputeProgram(VulkanComputeProgram* &vkprogram);
     void createDefaultRenderTarget(VulkanRenderTarget* &renderTarget);
     void createRenderTarget(VulkanRenderTarget* &renderTarget, uint32_t width, uint32_t height, uint8_t samples,
                          VulkanAttachment color[MAX_SUPPORTED_RENDER_TARGET_COUNT], VulkanTexture& depth, VulkanTexture& stencil);
@@ -89,15 +107,53 @@ public:
     void beginRenderPass(VulkanRenderTarget* renderTarget, const RenderPassParams& params);
     void endRenderPass();
     void nextSubpass();
+    // worker threads record draws between these, inside a render pass begun with params.workerCount > 0
+    void beginParallelRecording(uint32_t workerIndex);
+    void endParallelRecording();
     void setRenderPrimitiveBuffer(VulkanRenderPrimitive* primitive, VulkanVertexBuffer* vertexBuffer, VulkanIndexBuffer* indexBuffer);
     void setRenderPrimitiveRange(VulkanRenderPrimitive* primitive, PrimitiveType pt, uint32_t offset, uint32_t minIndex, uint32_t maxIndex, uint32_t count);
+    // lods from generateLods, ranges of the primitive's index buffer. Selects lods[0]
+    void setRenderPrimitiveLods(VulkanRenderPrimitive* primitive, const MeshLod* lods, uint32_t lodCount);
+    // the coarsest lod that stays within maxPixelError at distance, see selectLod. Pass it to draw(),
+    // the primitive itself is left alone so it can be drawn at several distances
+    uint32_t selectRenderPrimitiveLod(const VulkanRenderPrimitive* primitive, float distance, float projectionScale,
+                                      float maxPixelError) const;
     void makeCurrent(VulkanSwapChain* drawSch, VulkanSwapChain* readSch);
     void commit(VulkanSwapChain* swapchain);
     void bindUniformBuffer(uint32_t index, VulkanUniformBuffer* uniformBuffer);
     void bindUniformBufferRange(uint32_t index, VulkanUniformBuffer* uniformBuffer, uint32_t offset, uint32_t size);
     void bindSampler(uint32_t index, VulkanSampler& sampler);
     void readPixels(VulkanRenderTarget* renderTarget, uint32_t x, uint32_t y, uint32_t width, uint32_t height, PixelBufferDescriptor& pbd);
-    void draw(PipelineState& pipelineState, const VulkanRenderPrimitive* renderPrimitive);
+    // lod indexes the primitive's lods, primitives without lods draw their range
+    void draw(PipelineState& pipelineState, const VulkanRenderPrimitive* renderPrimitive, uint32_t instanceCount = 1,
+              uint32_t lod = 0);
+    // draws drawCount VkDrawIndexedIndirectCommands from commands at offset, with the primitive's vertex and index buffers.
+    // The commands may be written on the GPU, countBuffer optionally holds the real count as a uint32_t
+    void drawIndirect(PipelineState& pipelineState, const VulkanRenderPrimitive* renderPrimitive, VulkanBufferObject* commands,
+                      uint32_t offset, uint32_t drawCount, VulkanBufferObject* countBuffer = nullptr, uint32_t countOffset = 0);
+    bool isMultiDrawIndirectSupported() const { return mContext.multiDrawIndirectSupported; }
+    // bindless textures, indices stay valid until the texture is destroyed. Only SAMPLER_2D textures get
+    // an index, others return BINDLESS_INVALID_INDEX. Every slot samples with a fixed LINEAR_MIPMAP_LINEAR,
+    // REPEAT sampler
+    bool isBindlessSupported() const { return mPipelineCache.isBindlessEnabled(); }
+    uint32_t getBindlessIndex(const VulkanTexture* texture) const;
+    void pushConstants(const void* data, uint32_t size);
+    // gpu timing, render passes are timed automatically
+    void beginGpuScope(const char* name);
+    void endGpuScope();
+    std::vector<VulkanProfiler::ScopeTiming> getGpuTimings() const { return mProfiler.getTimings(); }
+    // per render pass invocation counts, off by default
+    bool isPipelineStatisticsSupported() const { return mProfiler.isPipelineStatisticsSupported(); }
+    void setPipelineStatisticsEnabled(bool enabled) { mProfiler.setPipelineStatisticsEnabled(enabled); }
+    std::vector<VulkanProfiler::PipelineStatistics> getPipelineStatistics() const { return mProfiler.getPipelineStatistics(); }
+    // compute, recorded outside of render passes
+    void bindStorageBuffer(uint32_t index, VulkanBufferObject* bufferObject, uint32_t offset = 0, uint32_t size = 0);
+    void bindStorageImage(uint32_t index, VulkanTexture* texture, uint32_t level = 0);
+    void setComputeConstants(const void* data, uint32_t size);
+    void dispatch(VulkanComputeProgram* program, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ);
+    void fillBufferObject(VulkanBufferObject* bufferObject, uint32_t offset, uint32_t size, uint32_t value);
+    // copies the depth aspect of an offscreen target tightly packed into the buffer, 4 bytes per texel (2 for 16-bit depth)
+    void copyDepthToBufferObject(VulkanRenderTarget* renderTarget, VulkanBufferObject* bufferObject);
     void createEmptyTexture();
     VulkanContext& getSharedContext() { return mContext; }
 
@@ -105,15 +161,26 @@ private:
     
     void refreshSwapChain();
     void collectGarbage();
+    void executeParallelRecordings(VkCommandBuffer cmdbuffer);
+    void registerBindlessTexture(VulkanTexture* texture);
+    // binds everything a draw of the primitive needs, VK_NULL_HANDLE if it must be skipped
+    VkCommandBuffer bindDrawState(PipelineState& pipelineState, const VulkanRenderPrimitive* renderPrimitive);
 
     VulkanContext mContext = {};
     VulkanSurface& mSurface;
     VulkanPipelineCache mPipelineCache;
+    VulkanComputePipelineCache mComputePipelineCache;
     VulkanMemoryPool mMemoryPool;
     VulkanFramebufferCache mFramebufferCache;
     VulkanSamplerCache mSamplerCache;
+    VulkanProfiler mProfiler;
+    uint32_t mFrameRenderPassCount = 0;
     VulkanRenderTarget* mCurrentRenderTarget = nullptr;
     std::vector<VulkanSampler> mSamplerBindings = {};
+    std::vector<std::unique_ptr<VulkanParallelRecorder>> mParallelRecorders;
+    // reused by every parallel render pass
+    std::vector<VkCommandBuffer> mParallelSecondaries;
+    VulkanCommandBuffer const* mParallelCmdBuffer = nullptr;
 };
 
 } // namespace backend
@@ -80,6 +80,7 @@ constexpr inline VkBool32 getCompareEnable(SamplerCompareMode mode) {
 VulkanSamplerCache::VulkanSamplerCache(VulkanContext& context) : mContext(context) {}
 
 VkSampler VulkanSamplerCache::getSampler(backend::SamplerParams params) {
+    std::lock_guard<std::mutex> lock(mMutex);
     auto iter = mSamplerCache.find(params.u);
     if (iter != mSamplerCache.end()) {
         return iter->second;
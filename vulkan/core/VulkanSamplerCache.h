@@ -2,6 +2,7 @@
 #define VULKAN_SAMPLER_CACHE_H
 
 #include <map>
+#include <mutex>
 #include "NonCopyable.h"
 #include "VulkanContext.h"
 #include "VulkanTexture.h"
@@ -24,6 +25,8 @@ public:
 private:
     VulkanContext& mContext;
     std::map<uint32_t, VkSampler> mSamplerCache;
+    // samplers are looked up from parallel recording threads
+    std::mutex mMutex;
 };
 
 } // namespace backend
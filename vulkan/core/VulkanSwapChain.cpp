@@ -1,5 +1,6 @@
 #include "VulkanCommandPool.h"
 #include "VulkanSwapChain.h"
+#include "VulkanFramebufferCache.h"
 
 namespace VR {
 namespace backend {
@@ -215,6 +216,9 @@ void VulkanSwapChain::destroy() {
             vkFreeMemory(device, swapContext.memory, VKALLOC);
         }
 
+        if (context.framebufferCache) {
+            context.framebufferCache->purge(swapContext.view);
+        }
         vkDestroyImageView(device, swapContext.view, VKALLOC);
         swapContext.view = VK_NULL_HANDLE;
     }
@@ -222,6 +226,9 @@ void VulkanSwapChain::destroy() {
     vkDestroySwapchainKHR(device, swapchain, VKALLOC);
     vkDestroySemaphore(device, nextImageAvailable, VKALLOC);
 
+    if (context.framebufferCache) {
+        context.framebufferCache->purge(depthAttachment.view);
+    }
     vkDestroyImageView(device, depthAttachment.view, VKALLOC);
     vkDestroyImage(device, depthAttachment.image, VKALLOC);
     vkFreeMemory(device, depthAttachment.memory, VKALLOC);
@@ -1,6 +1,8 @@
 #include "VulkanUtils.h"
 #include "VulkanTexture.h"
 #include "VulkanMemoryPool.h"
+#include "VulkanTrace.h"
+#include "VulkanFramebufferCache.h"
 
 namespace VR {
 namespace backend {
@@ -62,6 +64,26 @@ static void transitionImageLayout(VkCommandBuffer cmd, VkImage image,
     vkCmdPipelineBarrier(cmd, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
+// releases a freshly uploaded range on the transfer queue and acquires it on the graphics queue
+static void transferImageOwnership(VulkanContext& context, VkCommandBuffer release, VkCommandBuffer acquire, VkImage image,
+        VkImageLayout newLayout, uint32_t miplevel, uint32_t layerCount, VkImageAspectFlags aspect) {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = context.transferQueueFamilyIndex;
+    barrier.dstQueueFamilyIndex = context.graphicsQueueFamilyIndex;
+    barrier.image = image;
+    barrier.subresourceRange = { aspect, miplevel, 1, 0, layerCount };
+    vkCmdPipelineBarrier(release, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(acquire, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
 VulkanTexture::VulkanTexture(VulkanContext& context, SamplerType target, uint8_t levels, TextureFormat format, uint8_t samples, uint32_t w, uint32_t h, uint32_t depth,
         TextureUsage usage, VulkanMemoryPool& memoryPool, VkComponentMapping swizzle) :
         mTarget(target), mMipLevels(levels), mSamples(samples), mWidth(w), mHeight(h), mDepth(depth), mFormat(format), mUsage(usage),
@@ -110,6 +132,9 @@ VulkanTexture::VulkanTexture(VulkanContext& context, SamplerType target, uint8_t
         imageInfo.usage |= blittFlag;
         imageInfo.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
     }
+    if (any(usage & TextureUsage::STORAGE)) {
+        imageInfo.usage |= VK_IMAGE_USAGE_STORAGE_BIT | blittFlag;
+    }
 
     VkResult error = vkCreateImage(context.device, &imageInfo, VKALLOC, &mImage);
     VR_VK_ASSERT(error == VK_SUCCESS , "Unable to create image.");
@@ -160,9 +185,10 @@ VulkanTexture::VulkanTexture(VulkanContext& context, SamplerType target, uint8_t
     getImageView(mPrimaryViewRange);
 
     // transition the layout
-    if (any(usage & (TextureUsage::COLOR_ATTACHMENT | TextureUsage::DEPTH_ATTACHMENT))) {
+    if (any(usage & (TextureUsage::COLOR_ATTACHMENT | TextureUsage::DEPTH_ATTACHMENT | TextureUsage::STORAGE))) {
         const uint32_t layers = mPrimaryViewRange.layerCount;
         transitionImageLayout(mContext.commandpool->get().cmdbuffer, mImage, VK_IMAGE_LAYOUT_UNDEFINED, getTextureLayout(usage), 0, layers, levels, mAspect);
+        mUploadedLevels = ~0u;
     }
 }
 
@@ -170,6 +196,9 @@ VulkanTexture::~VulkanTexture() {
     vkDestroyImage(mContext.device, mImage, VKALLOC);
     vkFreeMemory(mContext.device, mImageMemory, VKALLOC);
      for (auto& imageView : mCachedImageViews) {
+         if (mContext.framebufferCache) {
+             mContext.framebufferCache->purge(imageView.second);
+         }
          vkDestroyImageView(mContext.device, imageView.second, VKALLOC);
      }
 }
@@ -200,6 +229,8 @@ void VulkanTexture::download2DImage(uint32_t x, uint32_t y, uint32_t width, uint
 }
 
 void VulkanTexture::update3DImage(const PixelBufferDescriptor& data, uint32_t width, uint32_t height, uint32_t depth, int miplevel) {
+    VR_TRACE_SCOPE("VulkanTexture::update3DImage");
+    VR_TRACE_COUNTER(BYTES_UPLOADED, data.size);
     VR_ASSERT(width <= this->mWidth && height <= this->mHeight && depth <= this->mDepth);
     const PixelBufferDescriptor* hostData = &data;
     PixelBufferDescriptor reshapedData;
@@ -223,9 +254,15 @@ void VulkanTexture::updateWithCopyBuffer(const PixelBufferDescriptor& hostData,
     vmaUnmapMemory(mContext.allocator, buffer->memory);
     vmaFlushAllocation(mContext.allocator, buffer->memory, 0, hostData.size);
 
-    const VkCommandBuffer cmdbuffer = mContext.commandpool->get().cmdbuffer;
+    VulkanCommandPool* uploadpool = getUploadPool(miplevel);
+    const VkCommandBuffer graphicsCmdbuffer = mContext.commandpool->get().cmdbuffer;
+    const VkCommandBuffer cmdbuffer = uploadpool ? uploadpool->get().cmdbuffer : graphicsCmdbuffer;
     transitionImageLayout(cmdbuffer, mImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, miplevel, 1, 1, mAspect);
     copyBufferToImage(cmdbuffer, buffer->buffer, mImage, width, height, depth, nullptr, miplevel);
+    if (uploadpool) {
+        transferImageOwnership(mContext, cmdbuffer, graphicsCmdbuffer, mImage, getTextureLayout(mUsage), miplevel, 1, mAspect);
+        return;
+    }
     transitionImageLayout(cmdbuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, getTextureLayout(mUsage), miplevel, 1, 1, mAspect);
 }
 
@@ -253,11 +290,14 @@ void VulkanTexture::updateWithBlitImage(const PixelBufferDescriptor& hostData, u
 
     transitionImageLayout(cmdbuffer, imageMemory->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, miplevel, 1, 1, mAspect);
     transitionImageLayout(cmdbuffer, mImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, miplevel, 1, 1, mAspect);
+    mUploadedLevels |= 1u << miplevel;
     vkCmdBlitImage(cmdbuffer, imageMemory->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, blitRegions, VK_FILTER_NEAREST); // filter: or VK_FILTER_LINEAR
     transitionImageLayout(cmdbuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, getTextureLayout(mUsage), miplevel, 1, 1, mAspect);
 }
 
 void VulkanTexture::updateCubeImage(const PixelBufferDescriptor& data, const FaceOffsets& faceOffsets, int miplevel) {
+    VR_TRACE_SCOPE("VulkanTexture::updateCubeImage");
+    VR_TRACE_COUNTER(BYTES_UPLOADED, data.size);
     VR_ASSERT(this->mTarget == SamplerType::SAMPLER_CUBEMAP);
     VR_ASSERT(getBytesPerPixel(format) == 4);
 
@@ -272,15 +312,29 @@ void VulkanTexture::updateCubeImage(const PixelBufferDescriptor& data, const Fac
     vmaUnmapMemory(mContext.allocator, buffer->memory);
     vmaFlushAllocation(mContext.allocator, buffer->memory, 0, numDstBytes);
 
-    const VkCommandBuffer cmdbuffer = mContext.commandpool->get().cmdbuffer;
+    VulkanCommandPool* uploadpool = getUploadPool(miplevel);
+    const VkCommandBuffer graphicsCmdbuffer = mContext.commandpool->get().cmdbuffer;
+    const VkCommandBuffer cmdbuffer = uploadpool ? uploadpool->get().cmdbuffer : graphicsCmdbuffer;
     const uint32_t width = std::max(1u, this->mWidth >> miplevel);
     const uint32_t height = std::max(1u, this->mHeight >> miplevel);
 
     transitionImageLayout(cmdbuffer, mImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, miplevel, 6, 1, mAspect);
     copyBufferToImage(cmdbuffer, buffer->buffer, mImage, width, height, 1, &faceOffsets, miplevel);
+    if (uploadpool) {
+        transferImageOwnership(mContext, cmdbuffer, graphicsCmdbuffer, mImage, getTextureLayout(mUsage), miplevel, 6, mAspect);
+        return;
+    }
     transitionImageLayout(cmdbuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, getTextureLayout(mUsage), miplevel, 6, 1, mAspect);
 }
 
+// the first upload of a level goes to the transfer queue, nothing on the graphics queue can be using it
+VulkanCommandPool* VulkanTexture::getUploadPool(int miplevel) {
+    const uint32_t bit = 1u << miplevel;
+    VulkanCommandPool* uploadpool = (mUploadedLevels & bit) ? nullptr : mContext.uploadpool;
+    mUploadedLevels |= bit;
+    return uploadpool;
+}
+
 void VulkanTexture::setPrimaryRange(uint32_t minMiplevel, uint32_t maxMiplevel) {
     maxMiplevel = std::min(int(maxMiplevel), int(this->mMipLevels - 1));
     mPrimaryViewRange.baseMipLevel = minMiplevel;
@@ -39,6 +39,8 @@ public:
     TextureFormat format() const { return mFormat; }
     SamplerType target() const { return mTarget; }
     VkDeviceMemory deviceMemory() const { return mImageMemory;}
+    uint32_t bindlessIndex() const { return mBindlessIndex; }
+    void setBindlessIndex(uint32_t index) { mBindlessIndex = index; }
     
 private:
 
@@ -46,6 +48,7 @@ private:
     void copyImageToBuffer(VkCommandBuffer cmd, VkImage image, VkBuffer buffer, uint32_t width, uint32_t height, uint32_t depth, FaceOffsets const* faceOffsets, uint32_t miplevel);
     void updateWithCopyBuffer(const PixelBufferDescriptor& hostData, uint32_t width, uint32_t height, uint32_t depth, int miplevel);
     void updateWithBlitImage(const PixelBufferDescriptor& hostData, uint32_t width, uint32_t height, uint32_t depth, int miplevel);
+    VulkanCommandPool* getUploadPool(int miplevel);
 
     VulkanContext& mContext;
     VulkanMemoryPool& mMemoryPool;
@@ -58,6 +61,10 @@ private:
     VkImageSubresourceRange mPrimaryViewRange;
     mutable std::map<std::string, VkImageView> mCachedImageViews{};
     VkImageAspectFlags mAspect;
+    // levels the graphics queue may already access, uploads to them stay on the graphics queue
+    uint32_t mUploadedLevels = 0;
+    // slot in the bindless texture array
+    uint32_t mBindlessIndex = BINDLESS_INVALID_INDEX;
 
 private:
     uint32_t mWidth;
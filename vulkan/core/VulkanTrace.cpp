@@ -0,0 +1,127 @@
+#include "VulkanTrace.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+#define TRACE_RING_SIZE 16384
+
+namespace VR {
+namespace backend {
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    uint64_t timestamp;
+    // duration of a scope or the running total of a counter
+    uint64_t value;
+    bool counter;
+};
+
+// single producer (the owning thread), single consumer (dump)
+struct TraceRing {
+    TraceEvent events[TRACE_RING_SIZE];
+    std::atomic<uint64_t> writeIndex{0};
+    std::atomic<uint64_t> readIndex{0};
+    std::atomic<uint64_t> dropped{0};
+    uint32_t threadId = 0;
+
+    void push(const TraceEvent& event) {
+        const uint64_t write = writeIndex.load(std::memory_order_relaxed);
+        if (write - readIndex.load(std::memory_order_acquire) >= TRACE_RING_SIZE) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        events[write % TRACE_RING_SIZE] = event;
+        writeIndex.store(write + 1, std::memory_order_release);
+    }
+};
+
+const char* const sCounterNames[(size_t) TraceCounter::COUNT] = {
+    "pipelines created",
+    "descriptor sets allocated",
+    "bytes uploaded",
+    "waits",
+};
+
+std::atomic<uint64_t> sCounters[(size_t) TraceCounter::COUNT];
+const std::chrono::steady_clock::time_point sEpoch = std::chrono::steady_clock::now();
+
+// rings outlive their threads so late dumps still see their events
+std::mutex sRingsMutex;
+std::vector<std::unique_ptr<TraceRing>> sRings;
+thread_local TraceRing* sThreadRing = nullptr;
+
+TraceRing& getThreadRing() {
+    if (sThreadRing == nullptr) {
+        std::lock_guard<std::mutex> lock(sRingsMutex);
+        sRings.emplace_back(new TraceRing());
+        sThreadRing = sRings.back().get();
+        sThreadRing->threadId = (uint32_t) sRings.size();
+    }
+    return *sThreadRing;
+}
+
+} // anonymous namespace
+
+uint64_t Trace::now() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sEpoch).count();
+}
+
+void Trace::addScope(const char* name, uint64_t beginNs, uint64_t endNs) {
+    getThreadRing().push({ name, beginNs, endNs - beginNs, false });
+}
+
+void Trace::addCounter(TraceCounter counter, uint64_t value) {
+    const uint64_t total = sCounters[(size_t) counter].fetch_add(value, std::memory_order_relaxed) + value;
+    getThreadRing().push({ sCounterNames[(size_t) counter], now(), total, true });
+}
+
+uint64_t Trace::getCounter(TraceCounter counter) {
+    return sCounters[(size_t) counter].load(std::memory_order_relaxed);
+}
+
+bool Trace::dump(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    std::lock_guard<std::mutex> lock(sRingsMutex);
+    for (auto& ring : sRings) {
+        fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                first ? "" : ",\n", ring->threadId, ring->threadId);
+        first = false;
+
+        const uint64_t write = ring->writeIndex.load(std::memory_order_acquire);
+        uint64_t read = ring->readIndex.load(std::memory_order_relaxed);
+        for (; read < write; read++) {
+            const TraceEvent& event = ring->events[read % TRACE_RING_SIZE];
+            if (event.counter) {
+                fprintf(file, ",\n{\"ph\":\"C\",\"name\":\"%s\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%llu}}",
+                        event.name, ring->threadId, event.timestamp / 1000.0, (unsigned long long) event.value);
+            } else {
+                fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        event.name, ring->threadId, event.timestamp / 1000.0, event.value / 1000.0);
+            }
+        }
+        ring->readIndex.store(read, std::memory_order_release);
+
+        const uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped != 0) {
+            fprintf(file, ",\n{\"ph\":\"i\",\"name\":\"dropped %llu events\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"s\":\"t\"}",
+                    (unsigned long long) dropped, ring->threadId, now() / 1000.0);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
+
+} // namespace backend
+} // namespace VR
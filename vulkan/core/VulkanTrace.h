@@ -0,0 +1,56 @@
+#ifndef VULKAN_TRACE_H
+#define VULKAN_TRACE_H
+
+#include <atomic>
+#include <stdint.h>
+
+// cpu trace markers, compiled out unless VR_ENABLE_TRACE is defined
+#if defined(VR_ENABLE_TRACE)
+#define VR_TRACE_CONCAT_(a, b) a##b
+#define VR_TRACE_CONCAT(a, b) VR_TRACE_CONCAT_(a, b)
+// name must be a string literal or otherwise outlive the trace
+#define VR_TRACE_SCOPE(name) ::VR::backend::TraceScope VR_TRACE_CONCAT(vrTraceScope, __LINE__)(name)
+#define VR_TRACE_COUNTER(counter, value) ::VR::backend::Trace::addCounter(::VR::backend::TraceCounter::counter, value)
+#else
+#define VR_TRACE_SCOPE(name)
+#define VR_TRACE_COUNTER(counter, value)
+#endif
+
+namespace VR {
+namespace backend {
+
+enum class TraceCounter : uint8_t {
+    PIPELINES_CREATED,
+    DESCRIPTOR_SETS_ALLOCATED,
+    BYTES_UPLOADED,
+    WAITS,
+    COUNT
+};
+
+class Trace {
+public:
+    // events go to a ring owned by the calling thread, a full ring drops them
+    static void addScope(const char* name, uint64_t beginNs, uint64_t endNs);
+    static void addCounter(TraceCounter counter, uint64_t value);
+    static uint64_t getCounter(TraceCounter counter);
+    static uint64_t now();
+    // drains every thread's ring into a Chrome trace-event JSON file, also readable by Perfetto
+    static bool dump(const char* path);
+};
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : mName(name), mBegin(Trace::now()) {}
+    ~TraceScope() { Trace::addScope(mName, mBegin, Trace::now()); }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* mName;
+    uint64_t mBegin;
+};
+
+} // namespace backend
+} // namespace VR
+
+#endif // VULKAN_TRACE_H
@@ -1,5 +1,21 @@
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
 #include "VulkanUtils.h"
 
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
 namespace VR {
 namespace backend {
 
@@ -623,11 +639,24 @@ size_t getElementTypeSize(ElementType type) {
         case ElementType::USHORT3:  return 3*sizeof(uint16_t);
         case ElementType::USHORT4:  return 4*sizeof(uint16_t);
         case ElementType::INT:      return sizeof(int32_t);
+        case ElementType::INT2:     return 2*sizeof(int32_t);
+        case ElementType::INT3:     return 3*sizeof(int32_t);
+        case ElementType::INT4:     return 4*sizeof(int32_t);
         case ElementType::UINT:     return sizeof(uint32_t);
+        case ElementType::UINT2:    return 2*sizeof(uint32_t);
+        case ElementType::UINT3:    return 3*sizeof(uint32_t);
+        case ElementType::UINT4:    return 4*sizeof(uint32_t);
         case ElementType::FLOAT:    return sizeof(float);
         case ElementType::FLOAT2:   return 2*sizeof(float);
         case ElementType::FLOAT3:   return 3*sizeof(float);
         case ElementType::FLOAT4:   return 4*sizeof(float);
+        case ElementType::HALF:     return sizeof(uint16_t);
+        case ElementType::HALF2:    return 2*sizeof(uint16_t);
+        case ElementType::HALF3:    return 3*sizeof(uint16_t);
+        case ElementType::HALF4:    return 4*sizeof(uint16_t);
+        default:
+            VR_ASSERT(false);
+            return 0;
     }
 }
 
@@ -671,6 +700,270 @@ bool operator<(const VkImageSubresourceRange& a, const VkImageSubresourceRange&
     return false;
 }
 
+uint32_t findMaxIndex(const uint32_t* indices, size_t count) {
+    size_t i = 0;
+    uint32_t maxIndex = 0;
+#if defined(__SSE4_1__)
+    __m128i maxValues = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        maxValues = _mm_max_epu32(maxValues, _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + i)));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), maxValues);
+    maxIndex = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#elif defined(__SSE2__) || defined(_M_X64)
+    // SSE2 only compares signed, flipping the sign bit keeps the unsigned order
+    const __m128i bias = _mm_set1_epi32((int32_t) 0x80000000u);
+    __m128i maxValues = bias;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i values = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + i)), bias);
+        const __m128i greater = _mm_cmpgt_epi32(values, maxValues);
+        maxValues = _mm_or_si128(_mm_and_si128(greater, values), _mm_andnot_si128(greater, maxValues));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), _mm_xor_si128(maxValues, bias));
+    maxIndex = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    uint32x4_t maxValues = vdupq_n_u32(0);
+    for (; i + 4 <= count; i += 4) {
+        maxValues = vmaxq_u32(maxValues, vld1q_u32(indices + i));
+    }
+    uint32x2_t pairs = vpmax_u32(vget_low_u32(maxValues), vget_high_u32(maxValues));
+    pairs = vpmax_u32(pairs, pairs);
+    maxIndex = vget_lane_u32(pairs, 0);
+#endif
+    for (; i < count; i++) {
+        maxIndex = std::max(maxIndex, indices[i]);
+    }
+    return maxIndex;
+}
+
+uint32_t interleaveVertexStreams(const VertexStream* streams, uint32_t streamCount, uint32_t vertexCount,
+                                 uint8_t bufferIndex, AttributeArray& attributes, void* dst) {
+    VR_ASSERT(streamCount <= MAX_VERTEX_ATTRIBUTE_COUNT);
+    // every element starts 4-byte aligned
+    uint32_t offsets[MAX_VERTEX_ATTRIBUTE_COUNT] = {};
+    uint32_t vertexStride = 0;
+    for (uint32_t i = 0; i < streamCount; i++) {
+        VR_ASSERT(streams[i].attribute < MAX_VERTEX_ATTRIBUTE_COUNT);
+        offsets[i] = vertexStride;
+        vertexStride += (getElementTypeSize(attributes[streams[i].attribute].type) + 3) & ~3u;
+    }
+    VR_VK_ASSERT(vertexStride <= UINT8_MAX, "Interleaved vertex stride does not fit Attribute::stride.");
+
+    for (uint32_t i = 0; i < streamCount; i++) {
+        Attribute& attrib = attributes[streams[i].attribute];
+        attrib.buffer = bufferIndex;
+        attrib.offset = offsets[i];
+        attrib.stride = (uint8_t) vertexStride;
+    }
+
+    if (dst != nullptr) {
+        uint8_t* out = static_cast<uint8_t*>(dst);
+        memset(out, 0, (size_t) vertexCount * vertexStride);
+        for (uint32_t i = 0; i < streamCount; i++) {
+            const size_t size = getElementTypeSize(attributes[streams[i].attribute].type);
+            const size_t srcStride = streams[i].stride ? streams[i].stride : size;
+            const uint8_t* src = static_cast<const uint8_t*>(streams[i].data);
+            uint8_t* element = out + offsets[i];
+            for (uint32_t v = 0; v < vertexCount; v++) {
+                memcpy(element, src, size);
+                src += srcStride;
+                element += vertexStride;
+            }
+        }
+    }
+    return vertexStride;
+}
+
+static inline uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    bits &= 0x7FFFFFFFu;
+    uint32_t half;
+    if (bits >= 0x47800000u) {
+        // too large for a half, or inf and nan
+        half = bits > 0x7F800000u ? 0x7E00u : 0x7C00u;
+    } else if (bits < 0x38800000u) {
+        // denormal half, adding the magic aligns the mantissa and the fpu rounds it
+        const uint32_t magicBits = 0x3F000000u;
+        float magic;
+        memcpy(&magic, &magicBits, sizeof(magic));
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        f += magic;
+        memcpy(&half, &f, sizeof(half));
+        half -= magicBits;
+    } else {
+        // rebias the exponent and round the dropped mantissa bits to nearest even
+        const uint32_t odd = (bits >> 13) & 1u;
+        half = (bits + 0xC8000FFFu + odd) >> 13;
+    }
+    return uint16_t(sign | half);
+}
+
+void convertFloatToHalf(uint16_t* dst, const float* src, size_t count) {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= count; i += 8) {
+        const __m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), halves);
+    }
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    for (; i + 4 <= count; i += 4) {
+        vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = floatToHalf(src[i]);
+    }
+}
+
+static inline int16_t floatToSnorm16(float value) {
+    const float clamped = std::min(std::max(value, -1.0f), 1.0f);
+    return int16_t(clamped >= 0.0f ? clamped * 32767.0f + 0.5f : clamped * 32767.0f - 0.5f);
+}
+
+// unit vector folded onto the octahedron and unfolded into [-1, 1]^2
+static inline void encodeOctahedral(const float* n, float* out) {
+    const float length = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+    const float x = length > 0.0f ? n[0] / length : 0.0f;
+    const float y = length > 0.0f ? n[1] / length : 0.0f;
+    const float z = length > 0.0f ? n[2] / length : 1.0f;
+    if (z >= 0.0f) {
+        out[0] = x;
+        out[1] = y;
+    } else {
+        out[0] = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        out[1] = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    }
+}
+
+uint32_t compressVertexStreams(const CompressedVertexStream* streams, uint32_t streamCount, uint32_t vertexCount,
+                               uint8_t bufferIndex, AttributeArray& attributes, void* dst,
+                               VertexDequantization* dequantization) {
+    VR_ASSERT(streamCount <= MAX_VERTEX_ATTRIBUTE_COUNT);
+    float center[3] = { 0.0f, 0.0f, 0.0f };
+    float scale[3] = { 1.0f, 1.0f, 1.0f };
+    uint32_t positionStreams = 0;
+    VertexStream layout[MAX_VERTEX_ATTRIBUTE_COUNT];
+    for (uint32_t i = 0; i < streamCount; i++) {
+        const CompressedVertexStream& stream = streams[i];
+        VR_ASSERT(stream.attribute < MAX_VERTEX_ATTRIBUTE_COUNT && stream.componentCount >= 1 && stream.componentCount <= 4);
+        const size_t srcStride = stream.stride ? stream.stride : stream.componentCount * sizeof(float);
+        Attribute& attrib = attributes[stream.attribute];
+        // only the normalized bit depends on the encoding, instancing and integer targets are the caller's
+        const bool normalized = stream.encoding == VertexEncoding::POSITION_SNORM16 ||
+                                stream.encoding == VertexEncoding::OCTAHEDRAL_SNORM16;
+        if (normalized) {
+            attrib.flags |= Attribute::FLAG_NORMALIZED;
+        } else {
+            attrib.flags &= ~Attribute::FLAG_NORMALIZED;
+        }
+        switch (stream.encoding) {
+            case VertexEncoding::POSITION_HALF:
+            case VertexEncoding::POSITION_SNORM16: {
+                VR_VK_ASSERT(stream.componentCount >= 3 && positionStreams++ == 0, "One float3 position stream is supported.");
+                attrib.type = stream.encoding == VertexEncoding::POSITION_HALF ? ElementType::HALF4 : ElementType::SHORT4;
+                float minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+                float maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+                const uint8_t* src = reinterpret_cast<const uint8_t*>(stream.data);
+                for (uint32_t v = 0; v < vertexCount; v++, src += srcStride) {
+                    const float* p = reinterpret_cast<const float*>(src);
+                    for (uint32_t c = 0; c < 3; c++) {
+                        minimum[c] = std::min(minimum[c], p[c]);
+                        maximum[c] = std::max(maximum[c], p[c]);
+                    }
+                }
+                for (uint32_t c = 0; c < 3 && vertexCount > 0; c++) {
+                    center[c] = (minimum[c] + maximum[c]) * 0.5f;
+                    scale[c] = maximum[c] > minimum[c] ? (maximum[c] - minimum[c]) * 0.5f : 1.0f;
+                }
+                break;
+            }
+            case VertexEncoding::OCTAHEDRAL_SNORM16:
+                VR_ASSERT(stream.componentCount >= 3);
+                attrib.type = stream.componentCount == 4 ? ElementType::SHORT4 : ElementType::SHORT2;
+                break;
+            case VertexEncoding::HALF: {
+                static const ElementType halfTypes[4] = { ElementType::HALF, ElementType::HALF2, ElementType::HALF4, ElementType::HALF4 };
+                attrib.type = halfTypes[stream.componentCount - 1];
+                break;
+            }
+        }
+        // every encoding writes 16-bit components, HALF2 and HALF4 streams must come out 4 and 8 bytes wide
+        const uint32_t encodedComponents = stream.encoding == VertexEncoding::OCTAHEDRAL_SNORM16 ?
+                (stream.componentCount == 4 ? 4 : 2) :
+                (stream.encoding == VertexEncoding::HALF && stream.componentCount < 3 ? stream.componentCount : 4);
+        VR_ASSERT(getElementTypeSize(attrib.type) == encodedComponents * sizeof(uint16_t));
+        layout[i] = {
+            .data = stream.data,
+            .attribute = stream.attribute,
+            .stride = uint32_t(srcStride),
+        };
+    }
+    if (dequantization) {
+        for (uint32_t c = 0; c < 3; c++) {
+            dequantization->positionScale[c] = scale[c];
+            dequantization->positionOffset[c] = center[c];
+        }
+    }
+    const uint32_t vertexStride = interleaveVertexStreams(layout, streamCount, vertexCount, bufferIndex, attributes, nullptr);
+    if (dst == nullptr) {
+        return vertexStride;
+    }
+
+    uint8_t* out = static_cast<uint8_t*>(dst);
+    memset(out, 0, (size_t) vertexCount * vertexStride);
+    std::vector<float> values;
+    std::vector<uint16_t> halves;
+    for (uint32_t i = 0; i < streamCount; i++) {
+        const CompressedVertexStream& stream = streams[i];
+        const Attribute& attrib = attributes[stream.attribute];
+        const size_t size = getElementTypeSize(attrib.type);
+        // 16-bit components of the element, gathered for all vertices so the half conversion runs in bulk
+        const uint32_t components = uint32_t(size / sizeof(uint16_t));
+        values.assign((size_t) vertexCount * components, 0.0f);
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(stream.data);
+        for (uint32_t v = 0; v < vertexCount; v++, src += layout[i].stride) {
+            const float* element = reinterpret_cast<const float*>(src);
+            float* value = values.data() + (size_t) v * components;
+            switch (stream.encoding) {
+                case VertexEncoding::POSITION_HALF:
+                case VertexEncoding::POSITION_SNORM16:
+                    for (uint32_t c = 0; c < 3; c++) {
+                        value[c] = (element[c] - center[c]) / scale[c];
+                    }
+                    value[3] = 1.0f;
+                    break;
+                case VertexEncoding::OCTAHEDRAL_SNORM16:
+                    encodeOctahedral(element, value);
+                    if (stream.componentCount == 4) {
+                        value[2] = element[3] < 0.0f ? -1.0f : 1.0f;
+                    }
+                    break;
+                case VertexEncoding::HALF:
+                    memcpy(value, element, stream.componentCount * sizeof(float));
+                    break;
+            }
+        }
+        halves.resize(values.size());
+        if (stream.encoding == VertexEncoding::POSITION_HALF || stream.encoding == VertexEncoding::HALF) {
+            convertFloatToHalf(halves.data(), values.data(), values.size());
+        } else {
+            for (size_t c = 0; c < values.size(); c++) {
+                halves[c] = uint16_t(floatToSnorm16(values[c]));
+            }
+        }
+        uint8_t* element = out + attrib.offset;
+        for (uint32_t v = 0; v < vertexCount; v++, element += vertexStride) {
+            memcpy(element, halves.data() + (size_t) v * components, size);
+        }
+    }
+    return vertexStride;
+}
+
 // template<typename Enum> inline constexpr int operator&(Enum& lhs, Enum rhs)
 // {
 //     static_assert(std::is_enum<Enum>::value, "Not an enum type");
@@ -27,6 +27,36 @@ struct VulkanLayoutTransition {
     VkAccessFlags dstAccessMask;
 };
 
+// one separate vertex stream, e.g. all positions, to pack with interleaveVertexStreams
+struct VertexStream {
+    const void* data;
+    uint8_t attribute; // index in the attribute array, its type gives the element size
+    uint32_t stride;   // source stride in bytes, 0 if tightly packed
+};
+
+// how compressVertexStreams stores a float stream
+enum class VertexEncoding : uint8_t {
+    POSITION_HALF,      // xyz relative to the bounds as HALF4, w = 1
+    POSITION_SNORM16,   // xyz relative to the bounds as normalized SHORT4, w = 1
+    OCTAHEDRAL_SNORM16, // unit vectors as normalized SHORT2, tangents as SHORT4 with the w sign in z
+    HALF,               // uvs and other small values, 3 components are padded to HALF4
+};
+
+// one float vertex stream to compress with compressVertexStreams
+struct CompressedVertexStream {
+    const float* data;
+    uint32_t stride;        // source stride in bytes, 0 if tightly packed
+    uint8_t attribute;      // index in the attribute array
+    uint8_t componentCount; // floats per element, 3 for positions and normals, 4 for tangents with the sign in w
+    VertexEncoding encoding;
+};
+
+// the shader gets back positions as stored.xyz * positionScale + positionOffset
+struct VertexDequantization {
+    float positionScale[3];
+    float positionOffset[3];
+};
+
 void createSemaphore(VkDevice device, VkSemaphore* semaphore);
 VkFormat getVkFormat(ElementType type, bool normalized, bool integer);
 VkFormat getVkFormat(TextureFormat format);
@@ -45,6 +75,20 @@ void transitionImageLayout(VkCommandBuffer cmdbuffer, VulkanLayoutTransition tra
 bool equivalent(const VkRect2D& a, const VkRect2D& b);
 bool equivalent(const VkExtent2D& a, const VkExtent2D& b);
 bool operator<(const VkImageSubresourceRange& a, const VkImageSubresourceRange& b);
+// largest of count 32-bit indices, 0 if count is 0
+uint32_t findMaxIndex(const uint32_t* indices, size_t count);
+// packs the streams into one interleaved buffer and points their attributes at bufferIndex,
+// dst holds vertexCount * the returned stride bytes, pass nullptr to only compute the layout
+uint32_t interleaveVertexStreams(const VertexStream* streams, uint32_t streamCount, uint32_t vertexCount,
+                                 uint8_t bufferIndex, AttributeArray& attributes, void* dst);
+// IEEE half floats rounded to nearest even, F16C or NEON when available
+void convertFloatToHalf(uint16_t* dst, const float* src, size_t count);
+// like interleaveVertexStreams but quantizes the float streams, their attributes get the matching type and
+// FLAG_NORMALIZED for the snorm16 encodings only. Positions are relative to their bounds, at most one
+// position stream is supported
+uint32_t compressVertexStreams(const CompressedVertexStream* streams, uint32_t streamCount, uint32_t vertexCount,
+                               uint8_t bufferIndex, AttributeArray& attributes, void* dst,
+                               VertexDequantization* dequantization);
 
 // bit mask
 
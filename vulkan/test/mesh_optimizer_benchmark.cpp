@@ -0,0 +1,99 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <vector>
+#include "../core/VulkanMeshOptimizer.h"
+
+using namespace VR::backend;
+
+struct Vertex {
+    float position[3];
+    float normal[3];
+};
+
+// uv sphere with its triangles and vertices shuffled, the worst case for the caches
+static void CreateSphere(uint32_t segments, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+    const float pi = 3.14159265f;
+    vertices.clear();
+    indices.clear();
+    for (uint32_t y = 0; y <= segments; y++) {
+        const float theta = pi * float(y) / float(segments);
+        for (uint32_t x = 0; x <= segments; x++) {
+            const float phi = 2.0f * pi * float(x) / float(segments);
+            Vertex vertex;
+            vertex.normal[0] = sinf(theta) * cosf(phi);
+            vertex.normal[1] = cosf(theta);
+            vertex.normal[2] = sinf(theta) * sinf(phi);
+            for (uint32_t i = 0; i < 3; i++) {
+                vertex.position[i] = vertex.normal[i];
+            }
+            vertices.push_back(vertex);
+        }
+    }
+    for (uint32_t y = 0; y < segments; y++) {
+        for (uint32_t x = 0; x < segments; x++) {
+            const uint32_t i0 = y * (segments + 1) + x;
+            const uint32_t i1 = i0 + segments + 1;
+            const uint32_t quad[6] = { i0, i1, i0 + 1, i0 + 1, i1, i1 + 1 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+
+    std::mt19937 random(1234);
+    const uint32_t triangleCount = (uint32_t) indices.size() / 3;
+    for (uint32_t t = triangleCount - 1; t > 0; t--) {
+        const uint32_t other = random() % (t + 1);
+        for (uint32_t k = 0; k < 3; k++) {
+            std::swap(indices[t * 3 + k], indices[other * 3 + k]);
+        }
+    }
+    std::vector<uint32_t> order(vertices.size());
+    for (uint32_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), random);
+    std::vector<Vertex> shuffled(vertices.size());
+    for (uint32_t i = 0; i < order.size(); i++) {
+        shuffled[order[i]] = vertices[i];
+    }
+    vertices.swap(shuffled);
+    for (uint32_t& index : indices) {
+        index = order[index];
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const uint32_t segments = argc > 1 ? (uint32_t) atoi(argv[1]) : 512;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    CreateSphere(segments, vertices, indices);
+
+    AttributeArray attributes;
+    attributes[0].buffer = 0;
+    attributes[0].offset = offsetof(Vertex, position);
+    attributes[0].stride = sizeof(Vertex);
+    attributes[0].type = ElementType::FLOAT3;
+    attributes[1].buffer = 0;
+    attributes[1].offset = offsetof(Vertex, normal);
+    attributes[1].stride = sizeof(Vertex);
+    attributes[1].type = ElementType::FLOAT3;
+
+    void* buffers[1] = { vertices.data() };
+    MeshOptimizerStats stats = {};
+    const auto start = std::chrono::steady_clock::now();
+    const uint32_t vertexCount = optimizeMesh(indices.data(), indices.size(), buffers, (uint32_t) vertices.size(),
+                                              attributes, 0, &stats);
+    const auto end = std::chrono::steady_clock::now();
+
+    printf("%u triangles, %u vertices\n", (uint32_t) indices.size() / 3, vertexCount);
+    printf("optimizeMesh: %.2f ms\n", std::chrono::duration<double, std::milli>(end - start).count());
+    printf("ACMR %.3f -> %.3f\n", stats.before.acmr, stats.after.acmr);
+    printf("ATVR %.3f -> %.3f\n", stats.before.atvr, stats.after.atvr);
+    return 0;
+}